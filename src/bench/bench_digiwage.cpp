@@ -0,0 +1,29 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "crypto/sha256.h"
+#include "key.h"
+#include "pubkey.h"
+#include "random.h"
+#include "util.h"
+
+int
+main(int argc, char** argv)
+{
+    RandomInit();
+    SHA256AutoDetect();
+    SetupEnvironment();
+    SelectParams(CBaseChainParams::MAIN);
+    ECC_Start();
+    ECCVerifyHandle globalVerifyHandle;
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+
+    benchmark::BenchRunner::RunAll();
+
+    ECC_Stop();
+}
@@ -0,0 +1,102 @@
+// Copyright (c) 2011-2017 The Bitcoin Core developers
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "data.h"
+
+#include "chainparams.h"
+#include "keystore.h"
+#include "main.h"
+#include "miner.h"
+#include "random.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <boost/filesystem.hpp>
+
+// Number of mempool transactions offered to the block template
+static const int MEMPOOL_TXS = 2000;
+
+// A regtest chain holding only the genesis block, in memory databases under a temporary data directory
+struct RegtestChain
+{
+    boost::filesystem::path pathTemp;
+
+    RegtestChain()
+    {
+        SelectParams(CBaseChainParams::REGTEST);
+        ClearDatadirCache();
+        pathTemp = GetTempPath() / strprintf("bench_digiwage_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+        boost::filesystem::create_directories(pathTemp);
+        mapArgs["-datadir"] = pathTemp.string();
+        pblocktree = new CBlockTreeDB(1 << 20, true);
+        pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        InitBlockIndex();
+        CValidationState state;
+        ActivateBestChain(state);
+    }
+
+    ~RegtestChain()
+    {
+        mempool.clear();
+        UnloadBlockIndex();
+        delete pcoinsTip;
+        delete pcoinsdbview;
+        delete pblocktree;
+        pcoinsTip = nullptr;
+        pcoinsdbview = nullptr;
+        pblocktree = nullptr;
+        boost::filesystem::remove_all(pathTemp);
+        mapArgs.erase("-datadir");
+        ClearDatadirCache();
+        SelectParams(CBaseChainParams::MAIN);
+    }
+};
+
+static void FillMempool(CBasicKeyStore& keystore)
+{
+    std::vector<CTransaction> vtx = benchmark::data::CreateSignedSpends(keystore, *pcoinsTip, MEMPOOL_TXS, 0);
+    LOCK(mempool.cs);
+    for (const CTransaction& tx : vtx)
+        mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, benchmark::data::SPEND_FEE, GetTime(), 0.0, 0));
+}
+
+// Template of a proof of work block on top of the tip, filled from a mempool of signed transactions
+static void AssembleBlock(benchmark::State& state)
+{
+    RegtestChain chain;
+    CBasicKeyStore keystore;
+    FillMempool(keystore);
+
+    const CScript scriptPubKey = CScript() << OP_TRUE;
+    while (state.KeepRunning()) {
+        std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(scriptPubKey, nullptr, false));
+        assert(pblocktemplate);
+    }
+}
+
+// Same template, from transactions selected ahead of time as the staker does while searching a kernel
+static void AssembleBlockStaged(benchmark::State& state)
+{
+    RegtestChain chain;
+    CBasicKeyStore keystore;
+    FillMempool(keystore);
+
+    CStagedTransactions staged;
+    SelectBlockTransactions(staged, GetChainTip());
+    assert(staged.vtx.size() == MEMPOOL_TXS);
+
+    const CScript scriptPubKey = CScript() << OP_TRUE;
+    while (state.KeepRunning()) {
+        std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(scriptPubKey, nullptr, false, &staged));
+        assert(pblocktemplate);
+    }
+}
+
+BENCHMARK(AssembleBlock);
+BENCHMARK(AssembleBlockStaged);
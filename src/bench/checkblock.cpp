@@ -0,0 +1,107 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "data.h"
+
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/merkle.h"
+#include "keystore.h"
+#include "main.h"
+#include "random.h"
+#include "streams.h"
+#include "version.h"
+
+// Number of signed transactions in the synthetic block
+static const int BLOCK_TXS = 1000;
+// Height of the synthetic block, inside the proof of work phase of regtest
+static const int BLOCK_HEIGHT = 200;
+
+// A proof of work block spending BLOCK_TXS outputs of coinsTip, with its index
+struct SyntheticBlock
+{
+    CBasicKeyStore keystore;
+    CCoinsView viewDummy;
+    CCoinsViewCache coinsTip;
+    CBlock block;
+    uint256 hashPrev;
+    uint256 hash;
+    CBlockIndex indexPrev;
+    CBlockIndex index;
+
+    SyntheticBlock() : coinsTip(&viewDummy)
+    {
+        // regtest skips the proof of work and has no checkpoints, so all scripts are verified
+        SelectParams(CBaseChainParams::REGTEST);
+
+        std::vector<CTransaction> vtx = benchmark::data::CreateSignedSpends(keystore, coinsTip, BLOCK_TXS, 1);
+
+        CMutableTransaction txCoinbase;
+        txCoinbase.vin.resize(1);
+        txCoinbase.vin[0].prevout.SetNull();
+        txCoinbase.vin[0].scriptSig = CScript() << BLOCK_HEIGHT << OP_0;
+        txCoinbase.vout.resize(1);
+        txCoinbase.vout[0].nValue = 0;
+        txCoinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+        hashPrev = GetRandHash();
+        block.nVersion = 5;
+        block.hashPrevBlock = hashPrev;
+        block.nTime = 1580000000;
+        block.nBits = 0x207fffff;
+        block.vtx.push_back(CTransaction(txCoinbase));
+        block.vtx.insert(block.vtx.end(), vtx.begin(), vtx.end());
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+        hash = block.GetHash();
+
+        indexPrev.phashBlock = &hashPrev;
+        indexPrev.nHeight = BLOCK_HEIGHT - 1;
+        index.phashBlock = &hash;
+        index.pprev = &indexPrev;
+        index.nHeight = BLOCK_HEIGHT;
+        coinsTip.SetBestBlock(hashPrev);
+
+        // CheckInputs looks the parent up to get the spend height
+        LOCK(cs_main);
+        mapBlockIndex.emplace(hashPrev, &indexPrev);
+    }
+
+    ~SyntheticBlock()
+    {
+        LOCK(cs_main);
+        mapBlockIndex.erase(hashPrev);
+        SelectParams(CBaseChainParams::MAIN);
+    }
+};
+
+static void DeserializeAndCheckBlock(benchmark::State& state)
+{
+    SyntheticBlock setup;
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << setup.block;
+
+    while (state.KeepRunning()) {
+        CDataStream ss(stream);
+        CBlock block;
+        ss >> block;
+        CValidationState validationState;
+        assert(CheckBlock(block, validationState));
+    }
+}
+
+static void ConnectBlockJustCheck(benchmark::State& state)
+{
+    SyntheticBlock setup;
+    LOCK(cs_main);
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&setup.coinsTip);
+        CValidationState validationState;
+        assert(ConnectBlock(setup.block, validationState, &setup.index, view, true, true));
+    }
+}
+
+BENCHMARK(DeserializeAndCheckBlock);
+BENCHMARK(ConnectBlockJustCheck);
@@ -0,0 +1,119 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "random.h"
+#include "wallet/wallet.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+// Confirmed outputs of a staking wallet, worth 1 to 10 coins each
+static void AddStakingOutputs(CWallet& wallet, std::vector<COutput>& vCoins, int nOutputs)
+{
+    FastRandomContext rand(true);
+    for (int i = 0; i < nOutputs; i++) {
+        CMutableTransaction tx;
+        tx.nLockTime = i; // so all transactions get different hashes
+        tx.vout.resize(1);
+        tx.vout[0].nValue = COIN + rand.randrange(9 * COIN);
+        vCoins.emplace_back(new CWalletTx(&wallet, tx), 0, 6 * 24, true);
+    }
+}
+
+static void SelectCoins(benchmark::State& state, int nOutputs, const CAmount& nTargetValue)
+{
+    CWallet wallet;
+    std::vector<COutput> vCoins;
+    AddStakingOutputs(wallet, vCoins, nOutputs);
+
+    std::set<std::pair<const CWalletTx*, unsigned int> > setCoinsRet;
+    CAmount nValueRet;
+    LOCK(wallet.cs_wallet);
+    while (state.KeepRunning())
+        assert(wallet.SelectCoinsMinConf(nTargetValue, 1, 6, vCoins, setCoinsRet, nValueRet));
+
+    for (const COutput& output : vCoins)
+        delete output.tx;
+}
+
+// A send from a wallet of a few hundred outputs
+static void SelectCoinsSmallWallet(benchmark::State& state)
+{
+    SelectCoins(state, 500, 123 * COIN + 4567);
+}
+
+// A send from a staking wallet of 50k reward outputs, as sendmany and autocombinerewards do
+static void SelectCoinsLargeWallet(benchmark::State& state)
+{
+    SelectCoins(state, 50000, 5000 * COIN + 4567);
+}
+
+typedef void (*SubsetSolver)(const std::vector<std::pair<CAmount, std::pair<const CWalletTx*, unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue);
+
+static void SolveBnB(const std::vector<std::pair<CAmount, std::pair<const CWalletTx*, unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue)
+{
+    std::vector<char> vfBest;
+    CAmount nBest;
+    SelectCoinsBnB(vValue, nTotalLower, nTargetValue, vfBest, nBest);
+}
+
+static void SolveApproximate(const std::vector<std::pair<CAmount, std::pair<const CWalletTx*, unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue)
+{
+    std::vector<char> vfBest;
+    CAmount nBest;
+    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest);
+}
+
+// The subset sum alone, over the candidates SelectCoinsMinConf hands to its solver
+static void SolveSubset(benchmark::State& state, SubsetSolver solver, int nOutputs, const CAmount& nTargetValue)
+{
+    CWallet wallet;
+    std::vector<COutput> vCoins;
+    AddStakingOutputs(wallet, vCoins, nOutputs);
+
+    std::vector<std::pair<CAmount, std::pair<const CWalletTx*, unsigned int> > > vValue;
+    CAmount nTotalLower = 0;
+    for (const COutput& output : vCoins) {
+        const CAmount nValue = output.tx->vout[output.i].nValue;
+        vValue.push_back(std::make_pair(nValue, std::make_pair(output.tx, output.i)));
+        nTotalLower += nValue;
+    }
+    std::sort(vValue.rbegin(), vValue.rend());
+
+    while (state.KeepRunning())
+        solver(vValue, nTotalLower, nTargetValue);
+
+    for (const COutput& output : vCoins)
+        delete output.tx;
+}
+
+static void CoinSubsetBnBSmallWallet(benchmark::State& state)
+{
+    SolveSubset(state, SolveBnB, 500, 123 * COIN + 4567);
+}
+
+static void CoinSubsetApproximateSmallWallet(benchmark::State& state)
+{
+    SolveSubset(state, SolveApproximate, 500, 123 * COIN + 4567);
+}
+
+static void CoinSubsetBnBLargeWallet(benchmark::State& state)
+{
+    SolveSubset(state, SolveBnB, 50000, 5000 * COIN + 4567);
+}
+
+static void CoinSubsetApproximateLargeWallet(benchmark::State& state)
+{
+    SolveSubset(state, SolveApproximate, 50000, 5000 * COIN + 4567);
+}
+
+BENCHMARK(SelectCoinsSmallWallet);
+BENCHMARK(SelectCoinsLargeWallet);
+BENCHMARK(CoinSubsetBnBSmallWallet);
+BENCHMARK(CoinSubsetApproximateSmallWallet);
+BENCHMARK(CoinSubsetBnBLargeWallet);
+BENCHMARK(CoinSubsetApproximateLargeWallet);
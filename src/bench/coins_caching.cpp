@@ -0,0 +1,67 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "data.h"
+
+#include "coins.h"
+#include "keystore.h"
+#include "random.h"
+
+// Number of transactions whose outputs are held by the tip cache
+static const int CACHED_TXS = 10000;
+
+// A lookup that hits the tip cache, as done for every input of a new block
+static void CoinsCacheHit(benchmark::State& state)
+{
+    CBasicKeyStore keystore;
+    CCoinsView viewDummy;
+    CCoinsViewCache coinsTip(&viewDummy);
+    std::vector<CTransaction> vtx = benchmark::data::CreateSignedSpends(keystore, coinsTip, CACHED_TXS, 1);
+
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const CTransaction& tx = vtx[i++ % vtx.size()];
+        CCoinsViewCache view(&coinsTip);
+        view.HaveInputs(tx);
+        view.AccessCoin(tx.vin[0].prevout);
+    }
+}
+
+// A lookup of a missing output, falling through both caches to the backing view
+static void CoinsCacheMiss(benchmark::State& state)
+{
+    CBasicKeyStore keystore;
+    CCoinsView viewDummy;
+    CCoinsViewCache coinsTip(&viewDummy);
+    benchmark::data::CreateSignedSpends(keystore, coinsTip, CACHED_TXS, 1);
+
+    const COutPoint outpoint(GetRandHash(), 0);
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&coinsTip);
+        view.HaveCoin(outpoint);
+    }
+}
+
+// Spend the input of a transaction in a child cache, copying the coin from the tip cache
+static void CoinsCacheSpend(benchmark::State& state)
+{
+    CBasicKeyStore keystore;
+    CCoinsView viewDummy;
+    CCoinsViewCache coinsTip(&viewDummy);
+    std::vector<CTransaction> vtx = benchmark::data::CreateSignedSpends(keystore, coinsTip, CACHED_TXS, 1);
+
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const CTransaction& tx = vtx[i++ % vtx.size()];
+        CCoinsViewCache view(&coinsTip);
+        Coin coin;
+        view.SpendCoin(tx.vin[0].prevout, &coin);
+    }
+}
+
+BENCHMARK(CoinsCacheHit);
+BENCHMARK(CoinsCacheMiss);
+BENCHMARK(CoinsCacheSpend);
@@ -0,0 +1,105 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "consensus/merkle.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "utilstrencodings.h"
+#include "version.h"
+
+#include <vector>
+
+/* Number of bytes to hash per iteration */
+static const uint64_t BUFFER_SIZE = 1000*1000;
+
+static CBlockHeader RandomHeader()
+{
+    CBlockHeader header;
+    header.nVersion = 3;
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = 1500000000;
+    header.nBits = 0x1e0ffff0;
+    header.nNonce = 0;
+    return header;
+}
+
+// Proof of work header hash, 80 bytes
+static void HashQuarkHeader(benchmark::State& state)
+{
+    CBlockHeader header = RandomHeader();
+    while (state.KeepRunning()) {
+        header.nNonce++;
+        HashQuark(BEGIN(header.nVersion), END(header.nNonce));
+    }
+}
+
+static void HashQuark1MB(benchmark::State& state)
+{
+    std::vector<unsigned char> in(BUFFER_SIZE, 0);
+    while (state.KeepRunning())
+        HashQuark(in.begin(), in.end());
+}
+
+static void SHA256_1MB(benchmark::State& state)
+{
+    uint8_t hash[CSHA256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(BUFFER_SIZE, 0);
+    while (state.KeepRunning())
+        CSHA256().Write(in.data(), in.size()).Finalize(hash);
+}
+
+// Double SHA-256 of a 64 byte message, as in every merkle tree node
+static void SHA256D64_Single(benchmark::State& state)
+{
+    uint256 left = GetRandHash();
+    uint256 right = GetRandHash();
+    while (state.KeepRunning())
+        left = Hash(left.begin(), left.end(), right.begin(), right.end());
+}
+
+// Double SHA-256 of 1024 64 byte messages at once, dispatched over the SIMD lanes
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning())
+        SHA256D64(in.data(), in.data(), 1024);
+}
+
+// Merkle root of a block with 1000 transactions
+static void MerkleRoot(benchmark::State& state)
+{
+    std::vector<uint256> leaves(1000);
+    for (uint256& leaf : leaves)
+        leaf = GetRandHash();
+    while (state.KeepRunning()) {
+        bool mutation = false;
+        uint256 root = ComputeMerkleRoot(leaves, &mutation);
+        leaves[mutation] = root;
+    }
+}
+
+static void HashWriterHeader(benchmark::State& state)
+{
+    CBlockHeader header = RandomHeader();
+    while (state.KeepRunning()) {
+        header.nNonce++;
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << header;
+        ss.GetHash();
+    }
+}
+
+BENCHMARK(HashQuarkHeader);
+BENCHMARK(HashQuark1MB);
+BENCHMARK(SHA256_1MB);
+BENCHMARK(SHA256D64_Single);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(MerkleRoot);
+BENCHMARK(HashWriterHeader);
@@ -0,0 +1,49 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "data.h"
+
+#include "coins.h"
+#include "key.h"
+#include "keystore.h"
+#include "random.h"
+#include "script/sign.h"
+#include "script/standard.h"
+
+namespace benchmark {
+namespace data {
+
+std::vector<CTransaction> CreateSignedSpends(CBasicKeyStore& keystore, CCoinsViewCache& coins, int nTxs, int nHeight)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    std::vector<CTransaction> vtx;
+    vtx.reserve(nTxs);
+    for (int i = 0; i < nTxs; i++) {
+        CMutableTransaction txFrom;
+        txFrom.vin.resize(1);
+        txFrom.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        txFrom.vout.resize(1);
+        txFrom.vout[0].nValue = 50 * COIN;
+        txFrom.vout[0].scriptPubKey = scriptPubKey;
+        const CTransaction txPrev(txFrom);
+        AddCoins(coins, txPrev, nHeight);
+
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 50 * COIN - SPEND_FEE;
+        tx.vout[0].scriptPubKey = scriptPubKey;
+        SignSignature(keystore, txPrev, tx, 0);
+        vtx.push_back(CTransaction(tx));
+    }
+    return vtx;
+}
+
+} // namespace data
+} // namespace benchmark
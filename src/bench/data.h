@@ -0,0 +1,31 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef DIGIWAGE_BENCH_DATA_H
+#define DIGIWAGE_BENCH_DATA_H
+
+#include "amount.h"
+#include "primitives/transaction.h"
+
+#include <vector>
+
+class CBasicKeyStore;
+class CCoinsViewCache;
+
+namespace benchmark {
+namespace data {
+
+/** Fee paid by the transactions of CreateSignedSpends */
+static const CAmount SPEND_FEE = COIN / 1000;
+
+/**
+ * Add nTxs P2PKH outputs paying to a new key of keystore to coins, created at nHeight,
+ * and return one signed transaction spending each of them, paying SPEND_FEE.
+ */
+std::vector<CTransaction> CreateSignedSpends(CBasicKeyStore& keystore, CCoinsViewCache& coins, int nTxs, int nHeight);
+
+} // namespace data
+} // namespace benchmark
+
+#endif // DIGIWAGE_BENCH_DATA_H
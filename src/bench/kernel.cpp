@@ -0,0 +1,80 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "kernel.h"
+#include "random.h"
+
+// Stake input with a fixed uniqueness and value, standing in for a wallet utxo
+class CBenchStake : public CStakeInput
+{
+private:
+    COutPoint prevout;
+    CAmount nValue;
+
+public:
+    CBenchStake(CBlockIndex* pindexFromIn, const COutPoint& prevoutIn, CAmount nValueIn) : prevout(prevoutIn), nValue(nValueIn)
+    {
+        pindexFrom = pindexFromIn;
+    }
+
+    bool InitFromTxIn(const CTxIn& txin) override { return false; }
+    CBlockIndex* GetIndexFrom() override { return pindexFrom; }
+    bool CreateTxIn(CWallet* pwallet, CTxIn& txIn, uint256 hashTxOut = UINT256_ZERO) override { return false; }
+    bool GetTxFrom(CTransaction& tx) const override { return false; }
+    CAmount GetValue() const override { return nValue; }
+    bool CreateTxOuts(CWallet* pwallet, std::vector<CTxOut>& vout, CAmount nTotal) override { return false; }
+    bool ContextCheck(int nHeight, uint32_t nTime) override { return true; }
+
+    CDataStream GetUniqueness() const override
+    {
+        CDataStream ss(SER_GETHASH, 0);
+        ss << prevout.n << prevout.hash;
+        return ss;
+    }
+};
+
+// A tip past the stake modifier v2 activation, and the block of the staked utxo
+struct KernelSetup
+{
+    CBlockIndex indexFrom;
+    CBlockIndex indexPrev;
+    CBenchStake stake;
+
+    KernelSetup() : stake(&indexFrom, COutPoint(GetRandHash(), 1), 10000 * COIN)
+    {
+        const int nHeight = Params().GetConsensus().height_start_StakeModifierV2 + 1000;
+        indexFrom.nHeight = nHeight - 600;
+        indexFrom.nTime = 1580000000;
+        indexPrev.nHeight = nHeight;
+        indexPrev.nTime = indexFrom.nTime + 36000;
+        indexPrev.SetStakeModifier(GetRandHash());
+    }
+};
+
+static void StakeKernelHash(benchmark::State& state)
+{
+    KernelSetup setup;
+    int nTime = setup.indexPrev.nTime;
+    while (state.KeepRunning()) {
+        CStakeKernel kernel(&setup.indexPrev, &setup.stake, 0x1e0ffff0, ++nTime);
+        kernel.GetHash();
+    }
+}
+
+// One step of the staker: build the kernel for the next time slot and check it against the target
+static void StakeKernelCheck(benchmark::State& state)
+{
+    KernelSetup setup;
+    int nTime = setup.indexPrev.nTime;
+    while (state.KeepRunning()) {
+        CStakeKernel kernel(&setup.indexPrev, &setup.stake, 0x1c0ffff0, ++nTime);
+        kernel.CheckKernelHash(true);
+    }
+}
+
+BENCHMARK(StakeKernelHash);
+BENCHMARK(StakeKernelCheck);
@@ -0,0 +1,70 @@
+// Copyright (c) 2011-2016 The Bitcoin Core developers
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "data.h"
+
+#include "coins.h"
+#include "keystore.h"
+#include "main.h"
+#include "txmempool.h"
+
+#include <list>
+
+// Number of independent transactions added to and removed from the pool per iteration
+static const int POOL_TXS = 1000;
+// Length of the chain of unconfirmed transactions spending each other
+static const int CHAIN_TXS = 25;
+
+static void AddTx(const CTransaction& tx, const CAmount& nFee, CTxMemPool& pool)
+{
+    pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, 1580000000, 0.0, 1));
+}
+
+// Fill the pool as relayed transactions arrive, then empty it as a block confirms them
+static void MempoolAddRemoveForBlock(benchmark::State& state)
+{
+    CBasicKeyStore keystore;
+    CCoinsView viewDummy;
+    CCoinsViewCache coins(&viewDummy);
+    std::vector<CTransaction> vtx = benchmark::data::CreateSignedSpends(keystore, coins, POOL_TXS, 1);
+
+    CTxMemPool pool(::minRelayTxFee);
+    while (state.KeepRunning()) {
+        for (const CTransaction& tx : vtx)
+            AddTx(tx, benchmark::data::SPEND_FEE, pool);
+        std::list<CTransaction> conflicts;
+        pool.removeForBlock(vtx, 2, conflicts);
+    }
+}
+
+// A chain of unconfirmed transactions, evicted recursively from its root
+static void MempoolRemoveRecursive(benchmark::State& state)
+{
+    std::vector<CTransaction> vtx;
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(uint256S("0x1"), 0);
+    mtx.vin[0].scriptSig = CScript() << OP_TRUE;
+    mtx.vout.resize(1);
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    mtx.vout[0].nValue = 50 * COIN;
+    for (int i = 0; i < CHAIN_TXS; i++) {
+        vtx.push_back(CTransaction(mtx));
+        mtx.vin[0].prevout = COutPoint(vtx.back().GetHash(), 0);
+        mtx.vout[0].nValue -= benchmark::data::SPEND_FEE;
+    }
+
+    CTxMemPool pool(::minRelayTxFee);
+    while (state.KeepRunning()) {
+        for (const CTransaction& tx : vtx)
+            AddTx(tx, benchmark::data::SPEND_FEE, pool);
+        std::list<CTransaction> removed;
+        pool.remove(vtx.front(), removed, true);
+    }
+}
+
+BENCHMARK(MempoolAddRemoveForBlock);
+BENCHMARK(MempoolRemoveRecursive);
@@ -0,0 +1,65 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "key.h"
+#include "masternode.h"
+#include "messageverifier.h"
+#include "random.h"
+#include "util.h"
+#include "utiltime.h"
+#include "version.h"
+
+#include <boost/thread.hpp>
+
+// Messages per iteration, roughly a dseg answer from one peer
+static const int MESSAGES_PER_BATCH = 1000;
+
+static std::vector<std::shared_ptr<CMessageVerifyJob> > SignedPings()
+{
+    // every iteration has to recover the keys again
+    mapArgs["-maxsigcachesize"] = "0";
+
+    CKey key;
+    key.MakeNewKey(true);
+    std::vector<std::shared_ptr<CMessageVerifyJob> > vJobs;
+    for (int i = 0; i < MESSAGES_PER_BATCH; i++) {
+        CMasternodePing mnp;
+        mnp.vin = CTxIn(GetRandHash(), 0);
+        mnp.blockHash = GetRandHash();
+        mnp.sigTime = GetTime();
+        mnp.Sign(key, key.GetPubKey(), true);
+
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << mnp;
+        vJobs.push_back(std::make_shared<CMessageVerifyJob>("mnp", ss));
+    }
+    return vJobs;
+}
+
+// What the message handler thread did for every message before the verification threads
+static void VerifyMessagesSerial(benchmark::State& state)
+{
+    std::vector<std::shared_ptr<CMessageVerifyJob> > vJobs = SignedPings();
+    while (state.KeepRunning()) {
+        for (const std::shared_ptr<CMessageVerifyJob>& job : vJobs)
+            CMessageVerifier::Verify(*job);
+    }
+}
+
+static void VerifyMessagesBatched(benchmark::State& state)
+{
+    std::vector<std::shared_ptr<CMessageVerifyJob> > vJobs = SignedPings();
+    boost::thread_group threadGroup;
+    messageVerifier.Start(threadGroup, std::max(2, (int)boost::thread::hardware_concurrency()));
+    while (state.KeepRunning()) {
+        messageVerifier.VerifyBatch(vJobs);
+    }
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BENCHMARK(VerifyMessagesSerial);
+BENCHMARK(VerifyMessagesBatched);
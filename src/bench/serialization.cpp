@@ -0,0 +1,65 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "data.h"
+
+#include "coins.h"
+#include "keystore.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "version.h"
+
+// Number of transactions in the serialized block
+static const int BLOCK_TXS = 1000;
+
+static CBlock BlockOfSpends()
+{
+    CBasicKeyStore keystore;
+    CCoinsView viewDummy;
+    CCoinsViewCache coins(&viewDummy);
+    CBlock block;
+    block.nVersion = 5;
+    block.vtx = benchmark::data::CreateSignedSpends(keystore, coins, BLOCK_TXS, 1);
+    return block;
+}
+
+static void SerializeBlock(benchmark::State& state)
+{
+    const CBlock block = BlockOfSpends();
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    while (state.KeepRunning()) {
+        stream.clear();
+        stream << block;
+    }
+}
+
+static void DeserializeBlock(benchmark::State& state)
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << BlockOfSpends();
+    while (state.KeepRunning()) {
+        CDataStream ss(stream);
+        CBlock block;
+        ss >> block;
+    }
+}
+
+// Deserialize a transaction and compute its hash, as done for every relayed transaction
+static void DeserializeAndHashTransaction(benchmark::State& state)
+{
+    const CBlock block = BlockOfSpends();
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block.vtx[0];
+    while (state.KeepRunning()) {
+        CDataStream ss(stream);
+        CTransaction tx;
+        ss >> tx;
+        tx.GetHash();
+    }
+}
+
+BENCHMARK(SerializeBlock);
+BENCHMARK(DeserializeBlock);
+BENCHMARK(DeserializeAndHashTransaction);
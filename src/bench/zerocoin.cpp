@@ -0,0 +1,45 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "libzerocoin/Params.h"
+#include "libzerocoin/bignum.h"
+
+// Arithmetic modulo the coin commitment group of the chain, as used to verify legacy zerocoin spends
+static const libzerocoin::IntegerGroupParams& CommitmentGroup()
+{
+    return Params().GetConsensus().Zerocoin_Params(false)->coinCommitmentGroup;
+}
+
+static void BignumPowMod(benchmark::State& state)
+{
+    const libzerocoin::IntegerGroupParams& group = CommitmentGroup();
+    const CBigNum exponent = CBigNum::randBignum(group.groupOrder);
+    CBigNum base = group.g;
+    while (state.KeepRunning())
+        base = base.pow_mod(exponent, group.modulus);
+}
+
+static void BignumMulMod(benchmark::State& state)
+{
+    const libzerocoin::IntegerGroupParams& group = CommitmentGroup();
+    CBigNum a = CBigNum::randBignum(group.modulus);
+    const CBigNum b = CBigNum::randBignum(group.modulus);
+    while (state.KeepRunning())
+        a = a.mul_mod(b, group.modulus);
+}
+
+static void BignumInverse(benchmark::State& state)
+{
+    const libzerocoin::IntegerGroupParams& group = CommitmentGroup();
+    CBigNum a = CBigNum::randBignum(group.modulus);
+    while (state.KeepRunning())
+        a = a.inverse(group.modulus);
+}
+
+BENCHMARK(BignumPowMod);
+BENCHMARK(BignumMulMod);
+BENCHMARK(BignumInverse);
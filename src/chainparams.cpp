@@ -201,6 +201,7 @@ public:
         pchMessageStart[2] = 0xa7;
         pchMessageStart[3] = 0xd6;
         nDefaultPort = 46003;
+        fHeadersFirstSyncingActive = false;
 
         // Note that of those with the service bits flag, most only support a subset of possible options
         vSeeds.push_back(CDNSSeedData("158.101.29.112", "158.101.29.112"));
@@ -305,6 +306,7 @@ public:
         pchMessageStart[2] = 0x65;
         pchMessageStart[3] = 0xba;
         nDefaultPort = 46005;
+        fHeadersFirstSyncingActive = true;
         vFixedSeeds.clear();
         vSeeds.clear();
         // nodes with support for servicebits filtering should be at the top
@@ -61,8 +61,8 @@ public:
 
     /** Make miner wait to have peers to avoid wasting work */
     bool MiningRequiresPeers() const { return !IsRegTestNet(); }
-    /** Headers first syncing is disabled */
-    bool HeadersFirstSyncingActive() const { return false; };
+    /** Download and validate the header chain before requesting blocks in parallel from several peers */
+    bool HeadersFirstSyncingActive() const { return fHeadersFirstSyncingActive; };
     /** Default value for -checkmempool and -checkblockindex argument */
     bool DefaultConsistencyChecks() const { return IsRegTestNet(); }
 
@@ -86,6 +86,7 @@ protected:
     Consensus::Params consensus;
     MessageStartChars pchMessageStart;
     int nDefaultPort;
+    bool fHeadersFirstSyncingActive;
     std::vector<CDNSSeedData> vSeeds;
     std::vector<unsigned char> base58Prefixes[MAX_BASE58_TYPES];
     int nExtCoinType;
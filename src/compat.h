@@ -46,6 +46,15 @@
 #include <unistd.h>
 #endif
 
+#if !defined(WIN32) && defined(HAVE_POLL_H)
+#define USE_POLL
+#include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#define USE_EPOLL
+#endif
+
 #ifdef WIN32
 #define MSG_DONTWAIT 0
 #else
@@ -95,7 +104,7 @@ size_t strnlen( const char *start, size_t max_len);
 
 bool static inline IsSelectableSocket(SOCKET s)
 {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_POLL)
     return true;
 #else
     return (s < FD_SETSIZE);
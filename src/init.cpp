@@ -20,8 +20,10 @@
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/zerocoin_verify.h"
+#include "crypto/sha256.h"
 #include "httpserver.h"
 #include "httprpc.h"
+#include "kernel.h"
 #include "key.h"
 #include "main.h"
 #include "masternode-budget.h"
@@ -30,6 +32,7 @@
 #include "forgeman.h"
 #include "masternodeman.h"
 #include "messagesigner.h"
+#include "messageverifier.h"
 #include "miner.h"
 #include "net.h"
 #include "rpc/server.h"
@@ -149,10 +152,10 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch (const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -166,7 +169,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB* pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher* pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -393,7 +395,12 @@ std::string HelpMessage(HelpMessageMode mode)
 #endif
     }
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
+    strUsage += HelpMessageOpt("-dbblocksize=<n>", strprintf(_("Set the size of the blocks of the databases in kilobytes (1 to 1024, default: %d)"), DEFAULT_DB_BLOCK_SIZE));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dbcompression", strprintf(_("Compress the blocks of the databases with snappy (default: %u)"), DEFAULT_DB_COMPRESSION));
+    strUsage += HelpMessageOpt("-dbmaxopenfiles=<n>", strprintf(_("Keep at most <n> table files of each database open (default: %d)"), GetDefaultDBMaxOpenFiles()));
+    strUsage += HelpMessageOpt("-dbwritebuffer=<n>", strprintf(_("Set the size of the write buffer of each database in megabytes (%d to %d, default: a quarter of its cache)"), MIN_DB_CACHE, MAX_DB_WRITE_BUFFER));
+    strUsage += HelpMessageOpt("-<db>.<option>", _("Set a database option for one of the chainstate, blockindex, zerocoin or sporks databases, or its cache size in megabytes with -<db>.dbcache=<n>"));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-maxreorg=<n>", strprintf(_("Set the Maximum reorg depth (default: %u)"), DEFAULT_MAX_REORG_DEPTH));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
@@ -462,6 +469,8 @@ std::string HelpMessage(HelpMessageMode mode)
             FormatMoney(CWallet::minTxFee.GetFeePerK())));
     strUsage += HelpMessageOpt("-paytxfee=<amt>", strprintf(_("Fee (in WAGE/kB) to add to transactions you send (default: %s)"), FormatMoney(payTxFee.GetFeePerK())));
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-rescanthreads=<n>", strprintf(_("Set the number of threads reading and matching blocks during a rescan (0 to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), MAX_RESCAN_THREADS, DEFAULT_RESCAN_THREADS));
+    strUsage += HelpMessageOpt("-walletloadthreads=<n>", strprintf(_("Set the number of threads reading wallet transactions on startup (0 to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), MAX_WALLET_LOAD_THREADS, DEFAULT_WALLET_LOAD_THREADS));
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet.dat") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-sendfreetransactions", strprintf(_("Send transactions as zero-fee transactions if possible (default: %u)"), 0));
     strUsage += HelpMessageOpt("-spendzeroconfchange", strprintf(_("Spend unconfirmed change when sending transactions (default: %u)"), 1));
@@ -546,6 +555,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-coldstaking=<n>", strprintf(_("Enable cold staking functionality (0-1, default: %u). Disabled if staking=0"), 1));
     strUsage += HelpMessageOpt("-WAGEstake=<n>", strprintf(_("Enable or disable staking functionality for WAGE inputs (0-1, default: %u)"), 1));
     strUsage += HelpMessageOpt("-reservebalance=<amt>", _("Keep the specified amount available for spending at all times (default: 0)"));
+    strUsage += HelpMessageOpt("-stakingthreads=<n>", strprintf(_("Set the number of threads hashing stake kernels (0 to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), MAX_STAKING_THREADS, DEFAULT_STAKING_THREADS));
     if (GetBoolArg("-help-debug", false)) {
         strUsage += HelpMessageOpt("-printstakemodifier", _("Display the stake modifier calculations in the debug.log file."));
         strUsage += HelpMessageOpt("-printcoinstake", _("Display verbose coin stake messages in the debug.log file."));
@@ -559,6 +569,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-masternodeprivkey=<n>", _("Set the masternode private key"));
     strUsage += HelpMessageOpt("-masternodeaddr=<n>", strprintf(_("Set external address:port to get to this masternode (example: %s)"), "128.127.106.235:46003"));
     strUsage += HelpMessageOpt("-budgetvotemode=<mode>", _("Change automatic finalized budget voting behavior. mode=auto: Vote for only exact finalized budget match to my generated budget. (string, default: auto)"));
+    strUsage += HelpMessageOpt("-msgverifythreads=<n>", strprintf(_("Set the number of threads verifying masternode, budget and SwiftX message signatures (0 to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), MAX_MSGVERIFY_THREADS, DEFAULT_MSGVERIFY_THREADS));
 
     strUsage += HelpMessageGroup(_("Zerocoin options:"));
     strUsage += HelpMessageOpt("-reindexzerocoin=<n>", strprintf(_("Delete all zerocoin spends and mints that have been recorded to the blockchain database and reindex them (0-1, default: %u)"), 0));
@@ -588,6 +599,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), 46002, 46006));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
+    strUsage += HelpMessageOpt("-deprecatedrpc=<method>", _("Allows the deprecated behaviour of the given RPC method. This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
     if (GetBoolArg("-help-debug", false)) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
@@ -938,11 +950,19 @@ bool AppInit2(const std::vector<std::string>& words)
     if (!AppInitBasicSetup())
         return false;
 
+    std::string sha256_algo = SHA256AutoDetect();
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+
     // ********************************************************* Step 2: parameter interactions
     // Make sure enough file descriptors are available
-    int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
+#ifdef USE_POLL
+    nMaxConnections = std::max(nMaxConnections, 0);
+#else
+    // select() can only wait on descriptors below FD_SETSIZE
+    int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+#endif
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -969,6 +989,9 @@ bool AppInit2(const std::vector<std::string>& words)
     // Check level must be 4 for zerocoin checks
     if (mapArgs.count("-checklevel"))
         return InitError(_("Error: Unsupported argument -checklevel found. Checklevel must be level 4."));
+    std::string strDBError;
+    if (!CheckDBArgs(strDBError))
+        return InitError(strDBError);
 
     if (GetBoolArg("-benchmark", false))
         InitWarning(_("Warning: Unsupported argument -benchmark ignored, use -debug=bench."));
@@ -1448,7 +1471,8 @@ bool AppInit2(const std::vector<std::string>& words)
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache;
+    LogPrintf("Using %.1fMiB for the in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
     while (!fLoaded && !ShutdownRequested()) {
@@ -1478,6 +1502,12 @@ bool AppInit2(const std::vector<std::string>& words)
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
+                // Convert the per-transaction coin records of older versions
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
                 if (fReindex)
                     pblocktree->WriteReindexing(true);
 
@@ -1731,6 +1761,14 @@ bool AppInit2(const std::vector<std::string>& words)
                 pindexRescan = FindForkInGlobalIndex(chainActive, locator);
             else
                 pindexRescan = chainActive.Genesis();
+            // resume a rescan interrupted by the shutdown
+            if (walletdb.ReadRescanProgress(locator)) {
+                CBlockIndex* pindexProgress = FindForkInGlobalIndex(chainActive, locator);
+                if (pindexProgress && pindexRescan && pindexProgress->nHeight < pindexRescan->nHeight) {
+                    LogPrintf("Resuming the rescan from block %d\n", pindexProgress->nHeight);
+                    pindexRescan = pindexProgress;
+                }
+            }
         }
         if (chainActive.Tip() && chainActive.Tip() != pindexRescan) {
             uiInterface.InitMessage(_("Rescanning..."));
@@ -1812,6 +1850,8 @@ bool AppInit2(const std::vector<std::string>& words)
 
     // ********************************************************* Step 10: setup ObfuScation
 
+    RegisterValidationInterface(&mnCollaterals);
+
     uiInterface.InitMessage(_("Loading masternode cache..."));
 
     CMasternodeDB mndb;
@@ -1902,6 +1942,12 @@ bool AppInit2(const std::vector<std::string>& words)
     //get the mode of budget voting for this masternode
     strBudgetMode = GetArg("-budgetvotemode", "auto");
 
+    // -msgverifythreads=0 means autodetect, keeping one core for the message handler
+    int nMsgVerifyThreads = GetArg("-msgverifythreads", DEFAULT_MSGVERIFY_THREADS);
+    if (nMsgVerifyThreads <= 0)
+        nMsgVerifyThreads += boost::thread::hardware_concurrency() - 1;
+    messageVerifier.Start(threadGroup, std::max(0, std::min(nMsgVerifyThreads, MAX_MSGVERIFY_THREADS)));
+
     if (GetBoolArg("-mnconflock", true) && pwalletMain) {
         LOCK(pwalletMain->cs_wallet);
         LogPrintf("Locking Masternodes:\n");
@@ -2013,6 +2059,11 @@ bool AppInit2(const std::vector<std::string>& words)
 
         // StakeMiner thread disabled by default on regtest
         if (GetBoolArg("-staking", !Params().IsRegTestNet())) {
+            // -stakingthreads=0 means autodetect
+            int nStakingThreads = GetArg("-stakingthreads", DEFAULT_STAKING_THREADS);
+            if (nStakingThreads <= 0)
+                nStakingThreads += boost::thread::hardware_concurrency();
+            StartStakeSearchThreads(threadGroup, std::max(1, std::min(nStakingThreads, MAX_STAKING_THREADS)));
             threadGroup.create_thread(boost::bind(&ThreadStakeMinter));
         }
     }
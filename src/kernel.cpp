@@ -5,8 +5,13 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
 #include <boost/assign/list_of.hpp>
 
+#include "checkqueue.h"
 #include "db.h"
 #include "kernel.h"
 #include "legacy/stakemodifier.h"
@@ -114,22 +119,151 @@ bool LoadStakeInput(const CBlock& block, const CBlockIndex* pindexPrev, std::uni
  * @param[in]   nTimeTx         new blocktime
  * @return      bool            true if stake kernel hash meets target protocol
  */
-bool Stake(const CBlockIndex* pindexPrev, CStakeInput* stakeInput, unsigned int nBits, int64_t& nTimeTx)
+// The part of Stake that doesn't read the chain, once the kernel of the input is built
+static bool StakeKernel(const CBlockIndex* pindexPrev, CStakeKernel& stakeKernel, int64_t& nTimeTx)
 {
-    // Double check stake input contextual checks
-    const int nHeightTx = pindexPrev->nHeight + 1;
-    if (!stakeInput || !stakeInput->ContextCheck(nHeightTx, nTimeTx)) return false;
-
     // Get the new time slot (and verify it's not the same as previous block)
     const bool fRegTest = Params().IsRegTestNet();
     nTimeTx = (fRegTest ? GetAdjustedTime() : GetCurrentTimeSlot());
     if (nTimeTx <= pindexPrev->nTime && !fRegTest) return false;
 
     // Verify Proof Of Stake
-    CStakeKernel stakeKernel(pindexPrev, stakeInput, nBits, nTimeTx);
+    stakeKernel.SetTime(nTimeTx);
     return stakeKernel.CheckKernelHash(true);
 }
 
+bool Stake(const CBlockIndex* pindexPrev, CStakeInput* stakeInput, unsigned int nBits, int64_t& nTimeTx)
+{
+    // Double check stake input contextual checks
+    const int nHeightTx = pindexPrev->nHeight + 1;
+    if (!stakeInput || !stakeInput->ContextCheck(nHeightTx, nTimeTx)) return false;
+
+    CStakeKernel stakeKernel(pindexPrev, stakeInput, nBits, nTimeTx);
+    return StakeKernel(pindexPrev, stakeKernel, nTimeTx);
+}
+
+namespace {
+
+/** State shared by the checks of one kernel search */
+struct CStakeSearch
+{
+    const CBlockIndex* pindexPrev;
+    unsigned int nBits;
+    int64_t nTimeStart;
+    std::vector<std::unique_ptr<CStakeKernel> > vKernels; // kernel of each input, built under cs_main, null if it can't stake
+    std::vector<int64_t> vTimes;        // kernel time of each input, written by the check of that input only
+    std::atomic<size_t> nFound;         // lowest index of an input meeting the target
+    std::atomic<int64_t> nTimeLast;
+    std::atomic<int> nHashes;
+    std::atomic<bool> fInterrupted;
+
+    CStakeSearch(const CBlockIndex* pindexPrevIn, unsigned int nBitsIn, int64_t nTimeTx, size_t nInputs) :
+        pindexPrev(pindexPrevIn), nBits(nBitsIn), nTimeStart(nTimeTx), vKernels(nInputs), vTimes(nInputs, 0),
+        nFound(nInputs), nTimeLast(nTimeTx), nHashes(0), fInterrupted(false) {}
+};
+
+/** Kernel hash of one input, as run by CCheckQueue */
+class CStakeCheck
+{
+private:
+    CStakeSearch* search{nullptr};
+    size_t nIndex{0};
+
+public:
+    CStakeCheck() {}
+    CStakeCheck(CStakeSearch* searchIn, size_t nIndexIn) : search(searchIn), nIndex(nIndexIn) {}
+
+    bool operator()()
+    {
+        // A kernel was already found at a lower index, or a new block came in. The height is
+        // read without cs_main, like the staking loop does, a search on a stale tip only
+        // wastes hashes.
+        if (nIndex > search->nFound || search->fInterrupted)
+            return true;
+        if (chainActive.Height() != search->pindexPrev->nHeight) {
+            search->fInterrupted = true;
+            return true;
+        }
+
+        int64_t nTimeTx = search->nTimeStart;
+        search->nHashes++;
+        CStakeKernel* stakeKernel = search->vKernels[nIndex].get();
+        if (stakeKernel && StakeKernel(search->pindexPrev, *stakeKernel, nTimeTx)) {
+            search->vTimes[nIndex] = nTimeTx;
+            size_t nFound = search->nFound;
+            while (nIndex < nFound && !search->nFound.compare_exchange_weak(nFound, nIndex)) {}
+        }
+        search->nTimeLast = nTimeTx;
+        return true;
+    }
+
+    void swap(CStakeCheck& check)
+    {
+        std::swap(search, check.search);
+        std::swap(nIndex, check.nIndex);
+    }
+};
+
+CCheckQueue<CStakeCheck> stakeCheckQueue(128);
+std::atomic<int> nStakeSearchThreads(0);
+
+void ThreadStakeSearch()
+{
+    util::ThreadRename("digiwage-stakesearch");
+    stakeCheckQueue.Thread();
+}
+
+} // namespace
+
+size_t FindStake(const CBlockIndex* pindexPrev, const std::vector<CStakeInput*>& vInputs, size_t nStart, unsigned int nBits, int64_t& nTimeTx, int& nHashes)
+{
+    CStakeSearch search(pindexPrev, nBits, nTimeTx, vInputs.size());
+    {
+        // the stake modifiers and the blocks the inputs are from are looked up in the chain,
+        // the hashing below only reads the kernels
+        LOCK(cs_main);
+        const int nHeightTx = pindexPrev->nHeight + 1;
+        for (size_t i = nStart; i < vInputs.size(); i++) {
+            if (vInputs[i] && vInputs[i]->ContextCheck(nHeightTx, nTimeTx))
+                search.vKernels[i].reset(new CStakeKernel(pindexPrev, vInputs[i], nBits, nTimeTx));
+        }
+    }
+
+    std::vector<CStakeCheck> vChecks;
+    vChecks.reserve(vInputs.size() - std::min(nStart, vInputs.size()));
+    for (size_t i = nStart; i < vInputs.size(); i++)
+        vChecks.emplace_back(&search, i);
+
+    if (nStakeSearchThreads > 0) {
+        // the check queue hands out its checks from the back, the lowest indexes go first so
+        // that the checks above a kernel found can be skipped
+        std::reverse(vChecks.begin(), vChecks.end());
+        CCheckQueueControl<CStakeCheck> control(&stakeCheckQueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        for (CStakeCheck& check : vChecks) {
+            check();
+            if (search.nFound < vInputs.size() || search.fInterrupted) break;
+        }
+    }
+
+    // The input found is the one a sequential search would have picked
+    nHashes = search.nHashes;
+    const size_t nFound = search.fInterrupted ? vInputs.size() : search.nFound.load();
+    nTimeTx = nFound < vInputs.size() ? search.vTimes[nFound] : search.nTimeLast.load();
+    return nFound;
+}
+
+void StartStakeSearchThreads(boost::thread_group& threadGroup, int nThreads)
+{
+    LogPrintf("Using %d threads for the stake kernel search\n", nThreads);
+    // the staking thread joins the check queue as its last worker
+    nStakeSearchThreads = nThreads - 1;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(&ThreadStakeSearch);
+}
+
 
 /*
  * CheckProofOfStake    Check if block has valid proof of stake
@@ -11,6 +11,13 @@
 #include "main.h"
 #include "stakeinput.h"
 
+#include <boost/thread/thread.hpp>
+
+/** -stakingthreads default (number of kernel search threads, 0 = auto) */
+static const int DEFAULT_STAKING_THREADS = 0;
+/** Maximum number of kernel search threads */
+static const int MAX_STAKING_THREADS = 16;
+
 class CStakeKernel {
 public:
     /**
@@ -29,6 +36,9 @@ public:
     // Check that the kernel hash meets the target required
     bool CheckKernelHash(bool fSkipLog = false) const;
 
+    // Set the time of the kernel block
+    void SetTime(int nTimeTx) { nTime = nTimeTx; }
+
 private:
     // kernel message hashed
     CDataStream stakeModifier{CDataStream(SER_GETHASH, 0)};
@@ -53,6 +63,25 @@ private:
  */
 bool Stake(const CBlockIndex* pindexPrev, CStakeInput* stakeInput, unsigned int nBits, int64_t& nTimeTx);
 
+/*
+ * FindStake            Find the first of the inputs able to stake a block on top of pindexPrev,
+ *                      splitting the kernel hashes over the staking threads. The stake modifiers
+ *                      and block times of the inputs are read under cs_main first, the hashing then
+ *                      runs without it and stops when the chain moves past pindexPrev.
+ *
+ * @param[in]   pindexPrev      index of the parent block of the block being staked
+ * @param[in]   vInputs         inputs for the coinstake, in order of preference
+ * @param[in]   nStart          index of the first input to check
+ * @param[in]   nBits           target difficulty bits
+ * @param[in]   nTimeTx         new blocktime (set to the time of the kernel found, or of the last one hashed)
+ * @param[out]  nHashes         number of inputs checked
+ * @return      size_t          index of the first input meeting the target, vInputs.size() if none
+ */
+size_t FindStake(const CBlockIndex* pindexPrev, const std::vector<CStakeInput*>& vInputs, size_t nStart, unsigned int nBits, int64_t& nTimeTx, int& nHashes);
+
+/* Start nThreads kernel search threads, kernels are hashed by the staking thread when there are none */
+void StartStakeSearchThreads(boost::thread_group& threadGroup, int nThreads);
+
 /*
  * CheckProofOfStake    Check if block has valid proof of stake
  *
@@ -87,10 +87,102 @@ static bool SelectBlockFromCandidates(
     return fSelected;
 }
 
+// Index of the old modifier selections on the active chain: for each height below the
+// modifier v2 upgrade, the height of the block whose modifier a kernel from that height
+// hashes with, or -1 while no block far enough in the future generated a modifier yet.
+static RecursiveMutex cs_oldModifierIndex;
+static std::vector<int> vOldModifierHeights;
+static std::vector<int> vOldModifierPending;
+// the heights selected by each block, by the height of the selecting block
+static std::map<int, std::vector<int> > mapOldModifierSelections;
+// the highest block processed, nothing to do past the modifier v2 upgrade
+static int nOldModifierProcessed = -1;
+static const CBlockIndex* pindexOldModifierSynced = nullptr;
+
+// Forget the selections made by blocks above nHeight, and the entries of those blocks
+static void RewindOldModifierIndex(int nHeight)
+{
+    nOldModifierProcessed = std::min(nOldModifierProcessed, nHeight);
+    if ((int)vOldModifierHeights.size() > nHeight + 1)
+        vOldModifierHeights.resize(nHeight + 1);
+    vOldModifierPending.erase(std::remove_if(vOldModifierPending.begin(), vOldModifierPending.end(),
+                                             [nHeight](int h) { return h > nHeight; }),
+                              vOldModifierPending.end());
+    auto itFirst = mapOldModifierSelections.upper_bound(nHeight);
+    for (auto it = itFirst; it != mapOldModifierSelections.end(); it++) {
+        for (int h : it->second) {
+            if (h > nHeight) continue;
+            vOldModifierHeights[h] = -1;
+            vOldModifierPending.push_back(h);
+        }
+    }
+    mapOldModifierSelections.erase(itFirst, mapOldModifierSelections.end());
+}
+
+void UpdateOldModifierIndex(const CBlockIndex* pindexTip)
+{
+    LOCK(cs_oldModifierIndex);
+    if (!pindexTip) {
+        vOldModifierHeights.clear();
+        vOldModifierPending.clear();
+        mapOldModifierSelections.clear();
+        nOldModifierProcessed = -1;
+        pindexOldModifierSynced = nullptr;
+        return;
+    }
+
+    if (pindexOldModifierSynced && !chainActive.Contains(pindexOldModifierSynced)) {
+        const CBlockIndex* pindexFork = chainActive.FindFork(pindexOldModifierSynced);
+        RewindOldModifierIndex(pindexFork ? pindexFork->nHeight : -1);
+    }
+
+    const int nHeightV2 = Params().GetConsensus().height_start_StakeModifierV2;
+    const int nHeightEnd = std::min(pindexTip->nHeight, nHeightV2);
+    for (int nHeight = nOldModifierProcessed + 1; nHeight <= nHeightEnd; nHeight++) {
+        const CBlockIndex* pindex = chainActive[nHeight];
+        if (!pindex) break;
+        // A generated modifier is selected by the pending heights at least a selection interval older
+        if (pindex->GeneratedStakeModifier()) {
+            const int64_t nTime = pindex->GetBlockTime();
+            std::vector<int> vSelected;
+            auto it = std::remove_if(vOldModifierPending.begin(), vOldModifierPending.end(), [&](int h) {
+                if (chainActive[h]->GetBlockTime() + OLD_MODIFIER_INTERVAL > nTime)
+                    return false;
+                vOldModifierHeights[h] = nHeight;
+                vSelected.push_back(h);
+                return true;
+            });
+            vOldModifierPending.erase(it, vOldModifierPending.end());
+            if (!vSelected.empty())
+                mapOldModifierSelections[nHeight].swap(vSelected);
+        }
+        if (nHeight < nHeightV2) {
+            vOldModifierHeights.push_back(-1);
+            vOldModifierPending.push_back(nHeight);
+        }
+        nOldModifierProcessed = nHeight;
+    }
+    pindexOldModifierSynced = pindexTip;
+}
+
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
 bool GetOldModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier)
 {
+    {
+        LOCK(cs_oldModifierIndex);
+        const int nHeightFrom = pindexFrom->nHeight;
+        if (nHeightFrom < (int)vOldModifierHeights.size() && vOldModifierHeights[nHeightFrom] >= 0 &&
+                chainActive.Contains(pindexFrom)) {
+            const CBlockIndex* pindex = chainActive[vOldModifierHeights[nHeightFrom]];
+            if (pindex) {
+                nStakeModifier = pindex->GetStakeModifierV1();
+                return true;
+            }
+        }
+    }
+
+    // Not indexed (yet): walk the chain forward
     int64_t nStakeModifierTime = pindexFrom->GetBlockTime();
     const CBlockIndex* pindex = pindexFrom;
     CBlockIndex* pindexNext = chainActive[pindex->nHeight + 1];
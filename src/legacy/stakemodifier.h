@@ -13,6 +13,8 @@
 
 // Old Modifier - Only for IBD
 bool GetOldStakeModifier(CStakeInput* stake, uint64_t& nStakeModifier);
+/** Keep the old modifier selections in sync with the active chain ending at pindexTip (NULL to clear them) */
+void UpdateOldModifierIndex(const CBlockIndex* pindexTip);
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 
 #endif // DIGIWAGE_LEGACY_MODIFIER_H
@@ -4,8 +4,16 @@
 
 #include "leveldbwrapper.h"
 
+#include "guiinterface.h"
+#include "sync.h"
 #include "util.h"
+#include "utilstrencodings.h"
 
+#include <set>
+#include <sstream>
+#include <stdio.h>
+
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem.hpp>
 
 #include <leveldb/cache.h>
@@ -27,14 +35,76 @@ void HandleError(const leveldb::Status& status)
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+//! The databases open on disk, for their statistics
+static RecursiveMutex cs_openDBs;
+static std::set<const CLevelDBWrapper*> setOpenDBs;
+
+//! The value of a database option: -<name>.<option> for this database, or -<option> for all
+static int64_t GetDBArg(const std::string& strName, const std::string& strOption, int64_t nDefault)
+{
+    return GetArg("-" + strName + "." + strOption, GetArg("-" + strOption, nDefault));
+}
+
+static bool GetDBBoolArg(const std::string& strName, const std::string& strOption, bool fDefault)
+{
+    return GetBoolArg("-" + strName + "." + strOption, GetBoolArg("-" + strOption, fDefault));
+}
+
+int GetDefaultDBMaxOpenFiles()
+{
+#if defined(WIN32)
+    // Windows handles don't count against the descriptors select() can wait on
+    return 1000;
+#else
+    // On 64-bit LevelDB maps up to 1000 tables in memory and closes their descriptors.
+    // Elsewhere every open table holds a descriptor, which the connections need.
+    return sizeof(void*) >= 8 ? 1000 : 64;
+#endif
+}
+
+bool CheckDBArgs(std::string& strErrorRet)
+{
+    for (const auto& arg : mapArgs) {
+        const std::string& strArg = arg.first;
+        int64_t nMax;
+        if (strArg == "-dbwritebuffer" || boost::algorithm::ends_with(strArg, ".dbwritebuffer"))
+            nMax = MAX_DB_WRITE_BUFFER;
+        else if (boost::algorithm::ends_with(strArg, ".dbcache"))
+            nMax = MAX_DB_CACHE;
+        else
+            continue;
+        const int64_t nValue = GetArg(strArg, 0);
+        if (nValue < MIN_DB_CACHE || nValue > nMax) {
+            strErrorRet = strprintf(_("Invalid value for %s=<n>: '%s' (must be %d to %d megabytes)"), strArg, arg.second, MIN_DB_CACHE, nMax);
+            return false;
+        }
+    }
+    return true;
+}
+
+static leveldb::Options GetOptions(const std::string& strName, size_t nCacheSize, size_t& nBlockCacheSize)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    if (mapArgs.count("-" + strName + ".dbcache"))
+        nCacheSize = std::min(std::max(GetArg("-" + strName + ".dbcache", 0), MIN_DB_CACHE), MAX_DB_CACHE) << 20;
+    // databases without a share of -dbcache, like the zerocoin and spork ones, still get a minimal cache
+    nBlockCacheSize = std::max(nCacheSize / 2, (size_t)MIN_DB_CACHE << 20);
+    options.block_cache = leveldb::NewLRUCache(nBlockCacheSize);
+    // up to two write buffers may be held in memory simultaneously
+    options.write_buffer_size = std::max(nCacheSize / 4, (size_t)MIN_DB_CACHE << 20);
+    if (mapArgs.count("-dbwritebuffer") || mapArgs.count("-" + strName + ".dbwritebuffer"))
+        options.write_buffer_size = std::min(std::max(GetDBArg(strName, "dbwritebuffer", 0), MIN_DB_CACHE), MAX_DB_WRITE_BUFFER) << 20;
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.block_size = std::min(std::max(GetDBArg(strName, "dbblocksize", DEFAULT_DB_BLOCK_SIZE), (int64_t)1), (int64_t)1024) << 10;
     options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    if (GetDBBoolArg(strName, "dbcompression", DEFAULT_DB_COMPRESSION)) {
+#ifdef HAVE_SNAPPY
+        options.compression = leveldb::kSnappyCompression;
+#else
+        LogPrintf("%s : compression of the %s database requested, but built without snappy\n", __func__, strName);
+#endif
+    }
+    options.max_open_files = GetDBArg(strName, "dbmaxopenfiles", GetDefaultDBMaxOpenFiles());
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -43,14 +113,14 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+CLevelDBWrapper::CLevelDBWrapper(const std::string& strNameIn, const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe) : strName(strNameIn)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(strName, nCacheSize, nBlockCacheSize);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -65,11 +135,21 @@ CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCa
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     HandleError(status);
-    LogPrintf("Opened LevelDB successfully\n");
+    if (!fMemory) {
+        LogPrintf("Opened LevelDB %s: %.1fMiB cache, %.1fMiB write buffer, %d open files, %uKiB blocks, %s\n", strName,
+            nBlockCacheSize * (1.0 / (1 << 20)), options.write_buffer_size * (1.0 / (1 << 20)), options.max_open_files,
+            (unsigned int)(options.block_size >> 10), options.compression == leveldb::kSnappyCompression ? "snappy compression" : "no compression");
+        LOCK(cs_openDBs);
+        setOpenDBs.insert(this);
+    }
 }
 
 CLevelDBWrapper::~CLevelDBWrapper()
 {
+    {
+        LOCK(cs_openDBs);
+        setOpenDBs.erase(this);
+    }
     delete pdb;
     pdb = NULL;
     delete options.filter_policy;
@@ -80,6 +160,41 @@ CLevelDBWrapper::~CLevelDBWrapper()
     options.env = NULL;
 }
 
+CLevelDBInfo CLevelDBWrapper::GetInfo() const
+{
+    CLevelDBInfo info;
+    info.strName = strName;
+    info.nCacheSize = nBlockCacheSize;
+    info.nWriteBufferSize = options.write_buffer_size;
+    info.nBlockSize = options.block_size;
+    info.nMaxOpenFiles = options.max_open_files;
+    info.fCompression = options.compression == leveldb::kSnappyCompression;
+    std::string strValue;
+    info.nMemoryUsage = pdb->GetProperty("leveldb.approximate-memory-usage", &strValue) ? atoi64(strValue) : 0;
+
+    // a table of the levels with files or compactions, after a header of three lines
+    if (pdb->GetProperty("leveldb.stats", &strValue)) {
+        std::istringstream ss(strValue);
+        std::string strLine;
+        for (int i = 0; i < 3 && std::getline(ss, strLine); i++) {}
+        while (std::getline(ss, strLine)) {
+            CLevelDBLevelStats level;
+            if (sscanf(strLine.c_str(), "%d %d %lf %lf %lf %lf", &level.nLevel, &level.nFiles, &level.nSizeMB, &level.nTimeSec, &level.nReadMB, &level.nWriteMB) == 6)
+                info.vLevels.push_back(level);
+        }
+    }
+    return info;
+}
+
+std::vector<CLevelDBInfo> CLevelDBWrapper::GetOpenDBInfo()
+{
+    std::vector<CLevelDBInfo> vInfo;
+    LOCK(cs_openDBs);
+    for (const CLevelDBWrapper* pdbWrapper : setOpenDBs)
+        vInfo.push_back(pdbWrapper->GetInfo());
+    return vInfo;
+}
+
 bool CLevelDBWrapper::WriteBatch(CLevelDBBatch& batch, bool fSync)
 {
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
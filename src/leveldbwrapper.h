@@ -22,8 +22,47 @@ public:
     leveldb_error(const std::string& msg) : std::runtime_error(msg) {}
 };
 
+//! Minimal block cache and write buffer of a database (MiB)
+static const int64_t MIN_DB_CACHE = 1;
+//! max. -<name>.dbcache (MiB), the same as the one of -dbcache
+static const int64_t MAX_DB_CACHE = sizeof(void*) > 4 ? 4096 : 1024;
+//! max. -dbwritebuffer (MiB), the largest write buffer LevelDB accepts
+static const int64_t MAX_DB_WRITE_BUFFER = 1024;
+//! -dbblocksize default (KiB)
+static const int64_t DEFAULT_DB_BLOCK_SIZE = 4;
+//! -dbcompression default
+static const bool DEFAULT_DB_COMPRESSION = false;
+
 void HandleError(const leveldb::Status& status);
 
+//! -dbmaxopenfiles default, which depends on the platform
+int GetDefaultDBMaxOpenFiles();
+
+//! Check the values of -dbwritebuffer and of the -<name>.dbcache and -<name>.dbwritebuffer options
+bool CheckDBArgs(std::string& strErrorRet);
+
+/** Compaction statistics of a level of a database, as reported by LevelDB */
+struct CLevelDBLevelStats {
+    int nLevel;
+    int nFiles;
+    double nSizeMB;
+    double nTimeSec;
+    double nReadMB;
+    double nWriteMB;
+};
+
+/** Effective configuration and statistics of an open database */
+struct CLevelDBInfo {
+    std::string strName;
+    size_t nCacheSize;
+    size_t nWriteBufferSize;
+    size_t nBlockSize;
+    int nMaxOpenFiles;
+    bool fCompression;
+    uint64_t nMemoryUsage;
+    std::vector<CLevelDBLevelStats> vLevels;
+};
+
 /** Batch of changes queued to be written to a CLevelDBWrapper */
 class CLevelDBBatch
 {
@@ -59,17 +98,28 @@ public:
 
         batch.Delete(slKey);
     }
+
+    void Clear()
+    {
+        batch.Clear();
+    }
 };
 
 class CLevelDBWrapper
 {
 private:
+    //! name of the database, for its options and in statistics
+    std::string strName;
+
     //! custom environment this database is using (may be NULL in case of default environment)
     leveldb::Env* penv;
 
     //! database options used
     leveldb::Options options;
 
+    //! size of the block cache in options
+    size_t nBlockCacheSize;
+
     //! options used when reading from the database
     leveldb::ReadOptions readoptions;
 
@@ -86,9 +136,20 @@ private:
     leveldb::DB* pdb;
 
 public:
-    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    /**
+     * Open the database of the given name at path. nCacheSize is its share of -dbcache,
+     * which the options -<name>.dbcache, -dbwritebuffer, -dbmaxopenfiles, -dbblocksize and
+     * -dbcompression, or their -<name>. forms for this database only, can override.
+     */
+    CLevelDBWrapper(const std::string& strName, const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
     ~CLevelDBWrapper();
 
+    //! Configuration and compaction statistics of this database
+    CLevelDBInfo GetInfo() const;
+
+    //! Configuration and compaction statistics of the databases open on disk
+    static std::vector<CLevelDBInfo> GetOpenDBInfo();
+
     template <typename K, typename V>
     bool Read(const K& key, V& value) const
     {
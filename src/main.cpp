@@ -12,6 +12,7 @@
 
 #include "addrman.h"
 #include "amount.h"
+#include "blockencodings.h"
 #include "blocksignature.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -22,7 +23,7 @@
 #include "consensus/zerocoin_verify.h"
 #include "init.h"
 #include "kernel.h"
-#include "legacy/stakemodifier.h"  // for ComputeNextStakeModifier
+#include "legacy/stakemodifier.h"  // for ComputeNextStakeModifier, UpdateOldModifierIndex
 #include "masternode-budget.h"
 #include "masternode-payments.h"
 #include "masternodeman.h"
@@ -94,7 +95,7 @@ bool fTxIndex = true;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fVerifyingBlocks = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 
 /* If the tip is older than this (in seconds), the node is considered to be in initial block download. */
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
@@ -194,6 +195,9 @@ int nQueuedValidatedHeaders = 0;
 /** Number of preferable block download peers. */
 int nPreferredDownload = 0;
 
+/** Peers asked to push new blocks as compact blocks, oldest first, at most MAX_CMPCTBLOCK_HB_PEERS. */
+std::list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
 /** Dirty block index entries. */
 std::set<CBlockIndex*> setDirtyBlockIndex;
 
@@ -201,6 +205,64 @@ std::set<CBlockIndex*> setDirtyBlockIndex;
 std::set<int> setDirtyFileInfo;
 } // anon namespace
 
+/** A block downloaded ahead of its parent during headers-first sync. */
+struct CBlockAwaitingParent {
+    NodeId nodeid;              //! Peer the block was received from.
+    int64_t nTime;              //! Time of arrival in microseconds.
+    CBlock block;
+};
+/**
+ * Blocks downloaded ahead of their parent, keyed by the parent hash. A proof-of-stake block can
+ * only be checked on top of its parent's data, so they wait here until the parent is accepted,
+ * their peer disconnects or they time out. Protected by cs_main.
+ */
+std::multimap<uint256, CBlockAwaitingParent> mapBlocksAwaitingParent;
+/** Hashes of the blocks in mapBlocksAwaitingParent. Protected by cs_main. */
+std::set<uint256> setBlocksAwaitingParent;
+
+// Requires cs_main.
+bool AddBlockAwaitingParent(NodeId nodeid, const CBlock& block, int64_t nTime)
+{
+    if (setBlocksAwaitingParent.size() >= BLOCK_DOWNLOAD_WINDOW || !setBlocksAwaitingParent.insert(block.GetHash()).second)
+        return false;
+
+    CBlockAwaitingParent entry;
+    entry.nodeid = nodeid;
+    entry.nTime = nTime;
+    entry.block = block;
+    mapBlocksAwaitingParent.insert(std::make_pair(block.hashPrevBlock, entry));
+    return true;
+}
+
+// Requires cs_main.
+void EraseBlocksAwaitingParentFrom(NodeId nodeid)
+{
+    std::multimap<uint256, CBlockAwaitingParent>::iterator it = mapBlocksAwaitingParent.begin();
+    while (it != mapBlocksAwaitingParent.end()) {
+        if (it->second.nodeid == nodeid) {
+            setBlocksAwaitingParent.erase(it->second.block.GetHash());
+            mapBlocksAwaitingParent.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Requires cs_main. Blocks dropped here are downloaded again once their parent is accepted.
+void ExpireBlocksAwaitingParent(int64_t nTimeBefore)
+{
+    std::multimap<uint256, CBlockAwaitingParent>::iterator it = mapBlocksAwaitingParent.begin();
+    while (it != mapBlocksAwaitingParent.end()) {
+        if (it->second.nTime < nTimeBefore) {
+            LogPrint("net", "%s : block %s waited too long for its parent %s\n", __func__, it->second.block.GetHash().GetHex(), it->first.GetHex());
+            setBlocksAwaitingParent.erase(it->second.block.GetHash());
+            mapBlocksAwaitingParent.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Registration of network node signals.
@@ -322,6 +384,8 @@ struct CNodeState {
     int64_t nStallingSince;
     std::list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
+    //! Compact block from this peer waiting for the "blocktxn" answer with its missing transactions.
+    std::shared_ptr<PartiallyDownloadedBlock> partialBlock;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
 
@@ -399,7 +463,9 @@ void FinalizeNode(NodeId nodeid)
     for (const QueuedBlock& entry : state->vBlocksInFlight)
         mapBlocksInFlight.erase(entry.hash);
     EraseOrphansFor(nodeid);
+    EraseBlocksAwaitingParentFrom(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
 
     mapNodeState.erase(nodeid);
 }
@@ -535,7 +601,8 @@ void FindNextBlocksToDownload(CNode* pnode, unsigned int count, std::vector<CBlo
             }
 
             if (!(pIndexWalk->nStatus & BLOCK_HAVE_DATA) &&
-                (mapBlocksInFlight.find(pIndexWalk->GetBlockHash()) == mapBlocksInFlight.end())
+                (mapBlocksInFlight.find(pIndexWalk->GetBlockHash()) == mapBlocksInFlight.end()) &&
+                !setBlocksAwaitingParent.count(pIndexWalk->GetBlockHash())
             ) {
                 if (to_fetch.size() >= count) {
                     to_fetch.pop_front();
@@ -597,6 +664,9 @@ void FindNextBlocksToDownload(CNode* pnode, unsigned int count, std::vector<CBlo
             if (pindex->nStatus & BLOCK_HAVE_DATA) {
                 if (pindex->nChainTx)
                     state->pindexLastCommonBlock = pindex;
+            } else if (setBlocksAwaitingParent.count(pindex->GetBlockHash())) {
+                // Already downloaded, waiting for its parent to be accepted.
+                continue;
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
                 // The block is not already downloaded, and not yet in flight.
                 if (pindex->nHeight > nWindowEnd) {
@@ -670,6 +740,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache* pcoinsTip = NULL;
+CCoinsViewDB* pcoinsdbview = NULL;
 CBlockTreeDB* pblocktree = NULL;
 CZerocoinDB* zerocoinDB = NULL;
 CSporkDB* pSporkDB = NULL;
@@ -916,11 +987,11 @@ int GetInputAge(CTxIn& vin)
         CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
-        const CCoins* coins = view.AccessCoins(vin.prevout.hash);
+        const Coin& coin = view.AccessCoin(vin.prevout);
 
-        if (coins) {
-            if (coins->nHeight < 0) return 0;
-            return (chainActive.Tip()->nHeight + 1) - coins->nHeight;
+        if (!coin.IsSpent()) {
+            if (coin.nHeight < 0) return 0;
+            return (chainActive.Tip()->nHeight + 1) - coin.nHeight;
         } else
             return -1;
     }
@@ -1079,14 +1150,16 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         view.SetBackend(viewMemPool);
 
         // do we already have it?
-        if (view.HaveCoins(hash))
-            return false;
+        for (size_t out = 0; out < tx.vout.size(); out++) {
+            if (view.HaveCoin(COutPoint(hash, out)))
+                return false;
+        }
 
         // do all inputs exist?
         // Note that this does not check for the presence of actual outputs (see the next check for that),
         // only helps filling in pfMissingInputs (to determine missing vs spent).
         for (const CTxIn& txin : tx.vin) {
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!view.HaveCoin(txin.prevout)) {
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false;
@@ -1275,14 +1348,16 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
             view.SetBackend(viewMemPool);
 
             // do we already have it?
-            if (view.HaveCoins(hash))
-                return false;
+            for (size_t out = 0; out < tx.vout.size(); out++) {
+                if (view.HaveCoin(COutPoint(hash, out)))
+                    return false;
+            }
 
             // do all inputs exist?
             // Note that this does not check for the presence of actual outputs (see the next check for that),
             // only helps filling in pfMissingInputs (to determine missing vs spent).
             for (const CTxIn& txin : tx.vin) {
-                if (!view.HaveCoins(txin.prevout.hash)) {
+                if (!view.HaveCoin(txin.prevout)) {
                     if (pfMissingInputs)
                         *pfMissingInputs = true;
                     return false;
@@ -1457,9 +1532,9 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
             int nHeight = -1;
             {
                 CCoinsViewCache& view = *pcoinsTip;
-                const CCoins* coins = view.AccessCoins(hash);
-                if (coins)
-                    nHeight = coins->nHeight;
+                const Coin& coin = AccessByTxid(view, hash);
+                if (!coin.IsSpent())
+                    nHeight = coin.nHeight;
             }
             if (nHeight > 0)
                 pindexSlow = chainActive[nHeight];
@@ -1764,14 +1839,15 @@ void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCach
     if (!tx.IsCoinBase() && !tx.HasZerocoinSpendInputs()) {
         txundo.vprevout.reserve(tx.vin.size());
         for (const CTxIn& txin : tx.vin) {
-            txundo.vprevout.push_back(CTxInUndo());
-            bool ret = inputs.ModifyCoins(txin.prevout.hash)->Spend(txin.prevout, txundo.vprevout.back());
+            Coin coin;
+            bool ret = inputs.SpendCoin(txin.prevout, &coin);
             assert(ret);
+            txundo.vprevout.emplace_back(coin.out, coin.fCoinBase, coin.fCoinStake, coin.nHeight);
         }
     }
 
     // add outputs
-    inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 bool CScriptCheck::operator()()
@@ -1803,20 +1879,20 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
         CAmount nFees = 0;
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             const COutPoint& prevout = tx.vin[i].prevout;
-            const CCoins* coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase() || coins->IsCoinStake()) {
-                if (nSpendHeight - coins->nHeight < Params().GetConsensus().nCoinbaseMaturity)
+            if (coin.IsCoinBase() || coin.IsCoinStake()) {
+                if (nSpendHeight - coin.nHeight < Params().GetConsensus().nCoinbaseMaturity)
                     return state.Invalid(
-                        error("CheckInputs() : tried to spend coinbase at depth %d, coinstake=%d", nSpendHeight - coins->nHeight, coins->IsCoinStake()),
+                        error("CheckInputs() : tried to spend coinbase at depth %d, coinstake=%d", nSpendHeight - coin.nHeight, coin.IsCoinStake()),
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!consensus.MoneyRange(coins->vout[prevout.n].nValue) || !consensus.MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!consensus.MoneyRange(coin.out.nValue) || !consensus.MoneyRange(nValueIn))
                 return state.DoS(100, error("CheckInputs() : txin values out of range"),
                     REJECT_INVALID, "bad-txns-inputvalues-outofrange");
         }
@@ -1847,11 +1923,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint& prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1863,7 +1939,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check(*coins, tx, i,
+                        CScriptCheck check(coin.out, tx, i,
                             flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1949,6 +2025,9 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock() : block and undo data inconsistent");
 
+    // changes of the set statistics, the reverse of the block's
+    CCoinsStats statsBlock;
+
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction& tx = block.vtx[i];
@@ -1992,25 +2071,18 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         uint256 hash = tx.GetHash();
 
         // Check that all outputs are available and match the outputs in the block itself
-        // exactly. Note that transactions with only provably unspendable outputs won't
-        // have outputs available even in the block itself, so we handle that case
-        // specially with outsEmpty.
-        {
-            CCoins outsEmpty;
-            CCoinsModifier outs = view.ModifyCoins(hash);
-            outs->ClearUnspendable();
-
-            CCoins outsBlock(tx, pindex->nHeight);
-            // The CCoins serialization does not serialize negative numbers.
-            // No network rules currently depend on the version here, so an inconsistency is harmless
-            // but it must be corrected before txout nversion ever influences a network rule.
-            if (outsBlock.nVersion < 0)
-                outs->nVersion = outsBlock.nVersion;
-            if (*outs != outsBlock)
+        // exactly. Provably unspendable outputs were never added to the set.
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (tx.vout[o].scriptPubKey.IsUnspendable())
+                continue;
+            COutPoint out(hash, o);
+            Coin coin;
+            bool is_spent = view.SpendCoin(out, &coin);
+            if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != coin.nHeight ||
+                tx.IsCoinBase() != coin.fCoinBase || tx.IsCoinStake() != coin.fCoinStake)
                 fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
-
-            // remove outputs
-            outs->Clear();
+            if (is_spent)
+                statsBlock.SpendCoin(out, coin);
         }
 
         // restore inputs
@@ -2021,29 +2093,27 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint& out = tx.vin[j].prevout;
                 const CTxInUndo& undo = txundo.vprevout[j];
-                CCoinsModifier coins = view.ModifyCoins(out.hash);
-                if (undo.nHeight != 0) {
-                    // undo data contains height: this is the last output of the prevout tx being spent
-                    if (!coins->IsPruned())
-                        fClean = fClean && error("DisconnectBlock() : undo data overwriting existing transaction");
-                    coins->Clear();
-                    coins->fCoinBase = undo.fCoinBase;
-                    coins->nHeight = undo.nHeight;
-                    coins->nVersion = undo.nVersion;
-                } else {
-                    if (coins->IsPruned())
+                Coin coin(undo.txout, undo.nHeight, undo.fCoinBase, undo.fCoinStake);
+                if (undo.nHeight == 0) {
+                    // Undo data written before the set was kept per output only has the metadata
+                    // for the last output of a transaction: take it from any other unspent one.
+                    const Coin& alternate = AccessByTxid(view, out.hash);
+                    if (alternate.IsSpent())
                         fClean = fClean && error("DisconnectBlock() : undo data adding output to missing transaction");
+                    coin.nHeight = alternate.nHeight;
+                    coin.fCoinBase = alternate.fCoinBase;
+                    coin.fCoinStake = alternate.fCoinStake;
                 }
-                if (coins->IsAvailable(out.n))
+                if (view.HaveCoin(out))
                     fClean = fClean && error("DisconnectBlock() : undo data overwriting existing output");
-                if (coins->vout.size() < out.n + 1)
-                    coins->vout.resize(out.n + 1);
-                coins->vout[out.n] = undo.txout;
+                statsBlock.AddCoin(out, coin);
+                view.AddCoin(out, std::move(coin), !fClean);
             }
         }
     }
 
     // move best block pointer to prevout block
+    view.UpdateStats(statsBlock);
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
     const Consensus::Params& consensus = Params().GetConsensus();
@@ -2178,10 +2248,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         // See BIP30 and http://r6.ca/blog/20120206T005236Z.html for more information.
         // This logic is not necessary for memory pool transactions, as AcceptToMemoryPool
         // already refuses previously-known transaction ids entirely.
-        const CCoins* coins = view.AccessCoins(tx.GetHash());
-        if (coins && !coins->IsPruned())
-            return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
-                             REJECT_INVALID, "bad-txns-BIP30");
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (view.HaveCoin(COutPoint(tx.GetHash(), o)))
+                return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
+                                 REJECT_INVALID, "bad-txns-BIP30");
+        }
 
         nInputs += tx.vin.size();
         nSigOps += GetLegacySigOpCount(tx);
@@ -2341,6 +2412,24 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
+    // Account for the outputs spent and added by the block in the statistics of the set
+    CCoinsStats statsBlock;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        if (!tx.IsCoinBase() && !tx.HasZerocoinSpendInputs()) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                const CTxInUndo& undo = txundo.vprevout[j];
+                statsBlock.SpendCoin(tx.vin[j].prevout, Coin(undo.txout, undo.nHeight, undo.fCoinBase, undo.fCoinStake));
+            }
+        }
+        for (unsigned int o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable())
+                statsBlock.AddCoin(COutPoint(tx.GetHash(), o), Coin(tx.vout[o], pindex->nHeight, tx.IsCoinBase(), tx.IsCoinStake()));
+        }
+    }
+    view.UpdateStats(statsBlock);
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2385,15 +2474,18 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
     try {
-        if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+        // the coins of a write still in flight are in memory as well
+        const size_t nPendingUsage = pcoinsdbview->PendingMemoryUsage();
+        const size_t nCacheLimit = nCoinCacheUsage > nPendingUsage ? nCoinCacheUsage - nPendingUsage : 0;
+        const bool fCacheLarge = (mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCacheLimit;
+        if ((mode == FLUSH_STATE_ALWAYS) || fCacheLarge ||
             (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
-            // Typical CCoins structures on disk are around 100 bytes in size.
+            // Typical unspent output records on disk are around 50 bytes in size.
             // Pushing a new one to the database can cause it to be written
             // twice (once in the log, and once in the tables). This is already
             // an overestimation, as most will delete an existing entry or
             // overwrite one. Still, use a conservative safety factor of 2.
-            if (!CheckDiskSpace(100 * 2 * 2 * pcoinsTip->GetCacheSize()))
+            if (!CheckDiskSpace(50 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // First make sure all block and undo data is flushed to disk.
             FlushBlockFile();
@@ -2416,10 +2508,19 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
                 }
             }
             // Finally flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // The coin database takes the dirty coins over and writes them behind,
+            // with the best block, so this only waits for a previous flush.
+            // The cache keeps the coins; one grown beyond its limit is trimmed to half of it,
+            // to the coins used recently, so that the next blocks don't run against a cold cache.
+            const unsigned int nCacheEntries = pcoinsTip->GetCacheSize();
+            if (!pcoinsTip->PartialFlush(fCacheLarge ? nCacheLimit / 2 : nCacheLimit))
                 return AbortNode(state, "Failed to write to coin database");
+            LogPrint("coindb", "Flushed the coins cache, %u of %u entries kept (%.1fMiB)\n", pcoinsTip->GetCacheSize(), nCacheEntries, pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)));
             // Update best block in wallet (so we can detect restored wallets).
+            // The wallet locator must not get ahead of the coins on disk, so wait for them first.
             if (mode != FLUSH_STATE_IF_NEEDED) {
+                if (!pcoinsdbview->Sync())
+                    return AbortNode(state, "Failed to write to coin database");
                 GetMainSignals().SetBestChain(chainActive.GetLocator());
             }
             nLastWrite = GetTimeMicros();
@@ -2440,6 +2541,7 @@ void FlushStateToDisk()
 void static UpdateTip(CBlockIndex* pindexNew)
 {
     chainActive.SetTip(pindexNew);
+    UpdateOldModifierIndex(pindexNew);
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -2452,10 +2554,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
     }
 
     const CBlockIndex* pChainTip = chainActive.Tip();
-    LogPrintf("UpdateTip: new best=%s  height=%d version=%d  log2_work=%.16f  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d version=%d  log2_work=%.16f  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utxo)\n",
             pChainTip->GetBlockHash().GetHex(), pChainTip->nHeight, pChainTip->nVersion, log(pChainTip->nChainWork.getdouble()) / log(2.0), (unsigned long)pChainTip->nChainTx,
               DateTimeStrFormat("%Y-%m-%d %H:%M:%S", pChainTip->GetBlockTime()),
-              Checkpoints::GuessVerificationProgress(pChainTip), (unsigned int)pcoinsTip->GetCacheSize());
+              Checkpoints::GuessVerificationProgress(pChainTip), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     // Check the version of the last 100 blocks to see if we need to upgrade:
     static bool fWarned = false;
@@ -2514,9 +2616,7 @@ bool static DisconnectTip(CValidationState& state)
     UpdateTip(pindexDelete->pprev);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
-    for (const CTransaction& tx : block.vtx) {
-        SyncWithWallets(tx, NULL);
-    }
+    SyncWithWallets(block.vtx, NULL);
     return true;
 }
 
@@ -2588,14 +2688,11 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
     // Tell wallet about transactions that went from mempool
-    // to conflicted:
-    for (const CTransaction& tx : txConflicted) {
-        SyncWithWallets(tx, NULL);
-    }
+    // to conflicted, in one batch:
+    if (!txConflicted.empty())
+        SyncWithWallets(std::vector<CTransaction>(txConflicted.begin(), txConflicted.end()), NULL);
     // ... and about transactions that got confirmed:
-    for (const CTransaction& tx : pblock->vtx) {
-        SyncWithWallets(tx, pblock);
-    }
+    SyncWithWallets(pblock->vtx, pblock);
 
     int64_t nTime6 = GetTimeMicros();
     nTimePostConnect += nTime6 - nTime5;
@@ -2923,11 +3020,23 @@ bool ActivateBestChain(CValidationState& state, CBlock* pblock, bool fAlreadyChe
                 // Relay inventory, but don't relay old inventory during initial block download.
                 int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
                 {
+                    // Peers that asked for it get the new tip pushed as a compact block right away
+                    const bool fCompactRelay = pblock && pblock->GetHash() == hashNewTip;
+                    std::unique_ptr<CBlockHeaderAndShortTxIDs> pcmpctblock;
                     LOCK(cs_vNodes);
-                    for (CNode *pnode : vNodes)
-                        if (chainActive.Height() >
+                    for (CNode *pnode : vNodes) {
+                        if (chainActive.Height() <=
                             (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                            continue;
+                        if (fCompactRelay && pnode->fPreferCompactBlocks) {
+                            if (!pcmpctblock)
+                                pcmpctblock.reset(new CBlockHeaderAndShortTxIDs(*pblock));
+                            pnode->AddInventoryKnown(CInv(MSG_BLOCK, hashNewTip));
+                            pnode->PushMessage("cmpctblock", *pcmpctblock);
+                        } else {
                             pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                        }
+                    }
                 }
                 // Notify external listeners about the new tip.
                 GetMainSignals().UpdatedBlockTip(pindexNewTip);
@@ -3022,6 +3131,35 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex* pindex)
     return true;
 }
 
+/** Compute the stake modifier of a new block index entry. The v2 modifier is derived from the coinstake
+ *  and the v1 modifier from the proof-of-stake flags of the ancestors, so the block data is needed. */
+static void SetBlockIndexStakeModifier(CBlockIndex* pindexNew, const CBlock& block)
+{
+    if (!Params().GetConsensus().IsStakeModifierV2(pindexNew->nHeight)) {
+        uint64_t nStakeModifier = 0;
+        bool fGeneratedStakeModifier = false;
+        if (!ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
+            LogPrintf("AddToBlockIndex() : ComputeNextStakeModifier() failed \n");
+        pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
+    } else {
+        // compute new v2 stake modifier
+        pindexNew->SetNewStakeModifier(block.vtx[1].vin[0].prevout.hash);
+    }
+}
+
+/** A header past the PoW phase carries no proof of its stake, so it only counts towards
+ *  pindexBestHeader once its block passed CheckProofOfStake and was stored. */
+static bool IsHeaderProven(const CBlockIndex* pindex)
+{
+    return pindex->nHeight <= Params().GetConsensus().height_last_PoW || (pindex->nStatus & BLOCK_HAVE_DATA);
+}
+
+static void UpdateBestHeader(CBlockIndex* pindex)
+{
+    if (IsHeaderProven(pindex) && (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindex->nChainWork))
+        pindexBestHeader = pindex;
+}
+
 CBlockIndex* AddToBlockIndex(const CBlock& block)
 {
     // Check for duplicate
@@ -3050,21 +3188,13 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         if (!pindexNew->SetStakeEntropyBit(pindexNew->GetStakeEntropyBit()))
             LogPrintf("AddToBlockIndex() : SetStakeEntropyBit() failed \n");
 
-        if (!Params().GetConsensus().IsStakeModifierV2(pindexNew->nHeight)) {
-            uint64_t nStakeModifier = 0;
-            bool fGeneratedStakeModifier = false;
-            if (!ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
-                LogPrintf("AddToBlockIndex() : ComputeNextStakeModifier() failed \n");
-            pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
-        } else {
-            // compute new v2 stake modifier
-            pindexNew->SetNewStakeModifier(block.vtx[1].vin[0].prevout.hash);
-        }
+        // A bare header (headers-first sync) gets its stake modifier in AcceptBlock
+        if (!block.vtx.empty())
+            SetBlockIndexStakeModifier(pindexNew, block);
     }
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
-    if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
-        pindexBestHeader = pindexNew;
+    UpdateBestHeader(pindexNew);
 
     setDirtyBlockIndex.insert(pindexNew);
 
@@ -3084,6 +3214,7 @@ bool ReceivedBlockTransactions(const CBlock& block, CValidationState& state, CBl
     pindexNew->nStatus |= BLOCK_HAVE_DATA;
     pindexNew->RaiseValidity(BLOCK_VALID_TRANSACTIONS);
     setDirtyBlockIndex.insert(pindexNew);
+    UpdateBestHeader(pindexNew);
 
     if (pindexNew->pprev == NULL || pindexNew->pprev->nChainTx) {
         // If pindexNew is the genesis block or all parents are BLOCK_VALID_TRANSACTIONS.
@@ -3203,7 +3334,7 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
         return state.DoS(50, error("CheckBlockHeader() : proof of work failed"),
             REJECT_INVALID, "high-hash");
 
-    if (Params().IsRegTestNet()) return true;
+    return true;
 }
 
 bool CheckColdStakeFreeOutput(const CTransaction& tx, const int nHeight)
@@ -3553,11 +3684,6 @@ bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex
         return true;
     }
 
-    if (!CheckBlockHeader(block, state, false)) {
-        LogPrintf("AcceptBlockHeader(): CheckBlockHeader failed \n");
-        return false;
-    }
-
     // Get prev block index
     CBlockIndex* pindexPrev = NULL;
     if (hash != Params().GetConsensus().hashGenesisBlock) {
@@ -3583,6 +3709,15 @@ bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex
 
     }
 
+    // A header carries no coinstake, so only the proof of work of PoW-era blocks can be checked here.
+    // The proof of stake is checked in AcceptBlock once the block data arrives, until then the header
+    // does not become pindexBestHeader.
+    const bool fCheckPOW = pindexPrev && pindexPrev->nHeight + 1 <= Params().GetConsensus().height_last_PoW;
+    if (!CheckBlockHeader(block, state, fCheckPOW)) {
+        LogPrintf("AcceptBlockHeader(): CheckBlockHeader failed \n");
+        return false;
+    }
+
     if (!ContextualCheckBlockHeader(block, state, pindexPrev))
         return false;
 
@@ -3633,6 +3768,9 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
             return state.DoS(100, error("%s: proof of stake check failed (%s)", __func__, strError));
     }
 
+    // Entries added from a bare header during headers-first sync still lack their stake modifier
+    const bool fKnownHeader = mapBlockIndex.count(block.GetHash()) > 0;
+
     if (!AcceptBlockHeader(block, state, &pindex))
         return false;
 
@@ -3651,6 +3789,9 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         return false;
     }
 
+    if (fKnownHeader && pindex->pprev)
+        SetBlockIndexStakeModifier(pindex, block);
+
     int nHeight = pindex->nHeight;
     int splitHeight = -1;
 
@@ -3743,18 +3884,10 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         // Check if the inputs were spent on the main chain
         const CCoinsViewCache coins(pcoinsTip);
         for (const CTxIn& in: stakeTxIn.vin) {
-            const CCoins* coin = coins.AccessCoins(in.prevout.hash);
-
-            if(!coin && !isBlockFromFork){
-                // No coins on the main chain
+            if(!coins.AccessCoin(in.prevout).IsAvailable() && !isBlockFromFork){
+                // No coins on the main chain, or already spent there
                 return error("%s: coin stake inputs not available on main chain, received height %d vs current %d", __func__, nHeight, chainActive.Height());
             }
-            if(coin && !coin->IsAvailable(in.prevout.n)){
-                if(!isBlockFromFork){
-                    // Coins not available
-                    return error("%s: coin stake inputs already spent in main chain", __func__);
-                }
-            }
         }
 
     }
@@ -3853,6 +3986,19 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     {
         LOCK(cs_main);
 
+        if (checked && pfrom && Params().HeadersFirstSyncingActive()) {
+            BlockMap::iterator mi = mapBlockIndex.find(pblock->hashPrevBlock);
+            if (mi != mapBlockIndex.end() && !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                // Downloaded ahead of its parent: keep requested blocks until the parent is accepted,
+                // anything else is fetched again later.
+                const uint256 hash = pblock->GetHash();
+                if (mapBlocksInFlight.count(hash) && AddBlockAwaitingParent(pfrom->GetId(), *pblock, GetTimeMicros()))
+                    LogPrint("net", "%s : block %s waits for its parent %s\n", __func__, hash.GetHex(), pblock->hashPrevBlock.GetHex());
+                MarkBlockAsReceived(hash);
+                return true;
+            }
+        }
+
         MarkBlockAsReceived(pblock->GetHash());
         if (!checked) {
             return error ("%s : CheckBlock FAILED for block %s", __func__, pblock->GetHash().GetHex());
@@ -3915,6 +4061,117 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     return true;
 }
 
+/** Process the blocks that were downloaded ahead of hashParent, and then their own descendants. */
+void ProcessBlocksAwaitingParent(const uint256& hashParent)
+{
+    std::deque<uint256> queue;
+    queue.push_back(hashParent);
+
+    while (!queue.empty()) {
+        std::vector<CBlockAwaitingParent> vChildren;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(queue.front());
+            const bool fParentAccepted = mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA);
+            std::pair<std::multimap<uint256, CBlockAwaitingParent>::iterator, std::multimap<uint256, CBlockAwaitingParent>::iterator> range = mapBlocksAwaitingParent.equal_range(queue.front());
+            for (std::multimap<uint256, CBlockAwaitingParent>::iterator it = range.first; it != range.second; ++it) {
+                setBlocksAwaitingParent.erase(it->second.block.GetHash());
+                // Children of a rejected parent are dropped, they will be downloaded again if still wanted
+                if (fParentAccepted)
+                    vChildren.push_back(it->second);
+            }
+            mapBlocksAwaitingParent.erase(range.first, range.second);
+        }
+        queue.pop_front();
+
+        for (CBlockAwaitingParent& child : vChildren) {
+            const uint256 hash = child.block.GetHash();
+            {
+                LOCK(cs_main);
+                mapBlockSource[hash] = child.nodeid;
+            }
+            CValidationState state;
+            ProcessNewBlock(state, NULL, &child.block);
+            int nDoS;
+            if (state.IsInvalid(nDoS) && nDoS > 0) {
+                LOCK(cs_main);
+                Misbehaving(child.nodeid, nDoS);
+            }
+            queue.push_back(hash);
+        }
+    }
+}
+
+/**
+ * Ask pfrom, which just gave us a new tip, to push its next blocks as compact blocks. The peer
+ * asked the longest ago is told to only announce them again, so that at most
+ * MAX_CMPCTBLOCK_HB_PEERS peers push blocks to us. Requires cs_main.
+ */
+static void MaybeSetPeerAsAnnouncingHeaderAndIDs(CNode* pfrom)
+{
+    AssertLockHeld(cs_main);
+    if (pfrom->fInbound || pfrom->nVersion < COMPACT_BLOCKS_VERSION)
+        return;
+    const NodeId nodeid = pfrom->GetId();
+    if (std::find(lNodesAnnouncingHeaderAndIDs.begin(), lNodesAnnouncingHeaderAndIDs.end(), nodeid) != lNodesAnnouncingHeaderAndIDs.end())
+        return;
+
+    uint64_t nCmpctBlockVersion = 1;
+    if (lNodesAnnouncingHeaderAndIDs.size() >= MAX_CMPCTBLOCK_HB_PEERS) {
+        const NodeId nodeidOldest = lNodesAnnouncingHeaderAndIDs.front();
+        lNodesAnnouncingHeaderAndIDs.pop_front();
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes) {
+            if (pnode->GetId() == nodeidOldest) {
+                pnode->PushMessage("sendcmpct", false, nCmpctBlockVersion);
+                break;
+            }
+        }
+    }
+    pfrom->PushMessage("sendcmpct", true, nCmpctBlockVersion);
+    lNodesAnnouncingHeaderAndIDs.push_back(nodeid);
+}
+
+/** Hand a block received from pfrom, in full or rebuilt from a compact block, to validation. */
+static void ProcessReceivedBlock(CNode* pfrom, CBlock& block, const std::string& strCommand)
+{
+    const uint256 hashBlock = block.GetHash();
+    CInv inv(MSG_BLOCK, hashBlock);
+    pfrom->AddInventoryKnown(inv);
+
+    CValidationState state;
+    bool fHaveData;
+    {
+        // With headers-first sync the header is usually known before the block arrives
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+        fHaveData = mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA);
+    }
+    if (!fHaveData) {
+        ProcessNewBlock(state, pfrom, &block);
+        int nDoS;
+        if(state.IsInvalid(nDoS)) {
+            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
+                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+            if(nDoS > 0) {
+                TRY_LOCK(cs_main, lockMain);
+                if(lockMain) Misbehaving(pfrom->GetId(), nDoS);
+            }
+        }
+        if (state.IsValid() && !IsInitialBlockDownload()) {
+            LOCK(cs_main);
+            if (chainActive.Tip()->GetBlockHash() == hashBlock)
+                MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom);
+        }
+        //disconnect this node if its old protocol version
+        pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
+        if (Params().HeadersFirstSyncingActive())
+            ProcessBlocksAwaitingParent(hashBlock);
+    } else {
+        LogPrint("net", "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, hashBlock.GetHex());
+    }
+}
+
 bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex* const pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     AssertLockHeld(cs_main);
@@ -4053,7 +4310,7 @@ bool static LoadBlockIndexDB(std::string& strError)
             pindexBestInvalid = pindex;
         if (pindex->pprev)
             pindex->BuildSkip();
-        if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex))) {
+        if (pindex->IsValid(BLOCK_VALID_TREE) && IsHeaderProven(pindex) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex))) {
             pindexBestHeader = pindex;
 
             // Ensure every 25000-block interval is a valid checkpoint, otherwise our block database is an invalid fork
@@ -4136,6 +4393,7 @@ bool static LoadBlockIndexDB(std::string& strError)
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    UpdateOldModifierIndex(it->second);
 
     PruneBlockIndexCandidates();
 
@@ -4199,7 +4457,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -4241,6 +4499,7 @@ void UnloadBlockIndex()
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    UpdateOldModifierIndex(NULL);
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
@@ -4253,8 +4512,11 @@ void UnloadBlockIndex()
     nBlockSequenceId = 1;
     mapBlockSource.clear();
     mapBlocksInFlight.clear();
+    mapBlocksAwaitingParent.clear();
+    setBlocksAwaitingParent.clear();
     nQueuedValidatedHeaders = 0;
     nPreferredDownload = 0;
+    lNodesAnnouncingHeaderAndIDs.clear();
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
     mapNodeState.clear();
@@ -4601,8 +4863,11 @@ bool static AlreadyHave(const CInv& inv)
     case MSG_TX: {
         bool txInMap = false;
         txInMap = mempool.exists(inv.hash);
+        // The first outputs in the coins cache are a quick approximation of the
+        // transaction being in a recent block, without a database lookup per output.
         return txInMap || mapOrphanTransactions.count(inv.hash) ||
-               pcoinsTip->HaveCoins(inv.hash);
+               pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) ||
+               pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
     }
     case MSG_DSTX:
         return mapObfuscationBroadcastTxes.count(inv.hash);
@@ -4677,7 +4942,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end()) {
@@ -4702,7 +4967,13 @@ void static ProcessGetData(CNode* pfrom)
                         assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
                         pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    else if (inv.type == MSG_CMPCT_BLOCK) {
+                        // Older blocks are unlikely to be in the peer's mempool anymore
+                        if (mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH)
+                            pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+                        else
+                            pfrom->PushMessage("block", block);
+                    } else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
@@ -5036,6 +5307,33 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        if (pfrom->nVersion >= COMPACT_BLOCKS_VERSION) {
+            // Ask up to MAX_CMPCTBLOCK_HB_PEERS outbound peers to push new blocks as compact blocks,
+            // the others only announce them. Peers that give us new tips later take over the
+            // oldest slots. Version 1 of the encoding is the only one.
+            bool fAnnounceUsingCmpctBlock = false;
+            if (!pfrom->fInbound) {
+                LOCK(cs_main);
+                if (lNodesAnnouncingHeaderAndIDs.size() < MAX_CMPCTBLOCK_HB_PEERS) {
+                    lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
+                    fAnnounceUsingCmpctBlock = true;
+                }
+            }
+            uint64_t nCmpctBlockVersion = 1;
+            pfrom->PushMessage("sendcmpct", fAnnounceUsingCmpctBlock, nCmpctBlockVersion);
+        }
+    }
+
+
+    else if (strCommand == "sendcmpct") {
+        bool fAnnounceUsingCmpctBlock = false;
+        uint64_t nCmpctBlockVersion = 0;
+        vRecv >> fAnnounceUsingCmpctBlock >> nCmpctBlockVersion;
+        if (nCmpctBlockVersion == 1) {
+            pfrom->fSupportsCompactBlocks = true;
+            pfrom->fPreferCompactBlocks = fAnnounceUsingCmpctBlock;
+        }
     }
 
 
@@ -5132,9 +5430,19 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
                 if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // Add this to the list of blocks to request
-                    vToFetch.push_back(inv);
-                    LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    if (Params().HeadersFirstSyncingActive() && pfrom->nVersion >= HEADERS_FIRST_VERSION) {
+                        // Fetch the headers leading to the announced block first, the block download
+                        // itself is then scheduled by SendMessages.
+                        pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
+                        LogPrint("net", "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    } else if (pfrom->fSupportsCompactBlocks && !IsInitialBlockDownload()) {
+                        // Near the tip most of the block is already in our mempool
+                        vToFetch.push_back(CInv(MSG_CMPCT_BLOCK, inv.hash));
+                    } else {
+                        // Add this to the list of blocks to request
+                        vToFetch.push_back(inv);
+                        LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    }
                 }
             }
 
@@ -5169,51 +5477,14 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     }
 
 
-    else if (strCommand == "getblocks" || strCommand == "getheaders") {
+    // Peers that sync headers-first expect a "headers" answer, older ones get block invs below
+    else if (strCommand == "getheaders" && pfrom->nVersion >= HEADERS_FIRST_VERSION) {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
 
         if (locator.vHave.size() > MAX_LOCATOR_SZ) {
-            LogPrint("net", "getblocks locator size %lld > %d, disconnect peer=%d\n", locator.vHave.size(), MAX_LOCATOR_SZ, pfrom->GetId());
-            pfrom->fDisconnect = true;
-            return true;
-        }
-
-        LOCK(cs_main);
-
-        // Find the last block the caller has in the main chain
-        CBlockIndex* pindex = FindForkInGlobalIndex(chainActive, locator);
-
-        // Send the rest of the chain
-        if (pindex)
-            pindex = chainActive.Next(pindex);
-        int nLimit = 500;
-        LogPrint("net", "getblocks %d to %s limit %d from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.IsNull() ? "end" : hashStop.ToString(), nLimit, pfrom->id);
-        for (; pindex; pindex = chainActive.Next(pindex)) {
-            if (pindex->GetBlockHash() == hashStop) {
-                LogPrint("net", "  getblocks stopping at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-                break;
-            }
-            pfrom->PushInventory(CInv(MSG_BLOCK, pindex->GetBlockHash()));
-            if (--nLimit <= 0) {
-                // When this block is requested, we'll send an inv that'll make them
-                // getblocks the next batch of inventory.
-                LogPrint("net", "  getblocks stopping at limit %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-                pfrom->hashContinue = pindex->GetBlockHash();
-                break;
-            }
-        }
-    }
-
-
-    else if (strCommand == "headers" && Params().HeadersFirstSyncingActive()) {
-        CBlockLocator locator;
-        uint256 hashStop;
-        vRecv >> locator >> hashStop;
-
-        if (locator.vHave.size() > MAX_LOCATOR_SZ) {
-            LogPrint("net", "getblocks locator size %lld > %d, disconnect peer=%d\n", locator.vHave.size(), MAX_LOCATOR_SZ, pfrom->GetId());
+            LogPrint("net", "getheaders locator size %lld > %d, disconnect peer=%d\n", locator.vHave.size(), MAX_LOCATOR_SZ, pfrom->GetId());
             pfrom->fDisconnect = true;
             return true;
         }
@@ -5251,6 +5522,44 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     }
 
 
+    else if (strCommand == "getblocks" || strCommand == "getheaders") {
+        CBlockLocator locator;
+        uint256 hashStop;
+        vRecv >> locator >> hashStop;
+
+        if (locator.vHave.size() > MAX_LOCATOR_SZ) {
+            LogPrint("net", "getblocks locator size %lld > %d, disconnect peer=%d\n", locator.vHave.size(), MAX_LOCATOR_SZ, pfrom->GetId());
+            pfrom->fDisconnect = true;
+            return true;
+        }
+
+        LOCK(cs_main);
+
+        // Find the last block the caller has in the main chain
+        CBlockIndex* pindex = FindForkInGlobalIndex(chainActive, locator);
+
+        // Send the rest of the chain
+        if (pindex)
+            pindex = chainActive.Next(pindex);
+        int nLimit = 500;
+        LogPrint("net", "getblocks %d to %s limit %d from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.IsNull() ? "end" : hashStop.ToString(), nLimit, pfrom->id);
+        for (; pindex; pindex = chainActive.Next(pindex)) {
+            if (pindex->GetBlockHash() == hashStop) {
+                LogPrint("net", "  getblocks stopping at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+                break;
+            }
+            pfrom->PushInventory(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+            if (--nLimit <= 0) {
+                // When this block is requested, we'll send an inv that'll make them
+                // getblocks the next batch of inventory.
+                LogPrint("net", "  getblocks stopping at limit %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+                pfrom->hashContinue = pindex->GetBlockHash();
+                break;
+            }
+        }
+    }
+
+
     else if (strCommand == "tx" || strCommand == "dstx") {
         std::vector<uint256> vWorkQueue;
         std::vector<uint256> vEraseQueue;
@@ -5482,26 +5791,148 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                 pfrom->vBlockRequested.push_back(hashBlock);
             }
         } else {
-            pfrom->AddInventoryKnown(inv);
+            ProcessReceivedBlock(pfrom, block, strCommand);
+        }
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        const uint256 hashBlock = cmpctblock.header.GetHash();
+        LogPrint("net", "received cmpctblock %s peer=%d\n", hashBlock.ToString(), pfrom->id);
+
+        CBlock block;
+        {
+            LOCK(cs_main);
 
+            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+            if (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hashBlock));
+                return true;
+            }
+
+            if (!mapBlockIndex.count(cmpctblock.header.hashPrevBlock)) {
+                // We are behind, catch up the way an announced unknown block does
+                if (Params().HeadersFirstSyncingActive() && pfrom->nVersion >= HEADERS_FIRST_VERSION)
+                    pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), hashBlock);
+                else
+                    pfrom->PushMessage("getblocks", chainActive.GetLocator(), hashBlock);
+                return true;
+            }
+
+            // Only rebuild from the mempool once the header is known to be valid and connect
+            CBlockIndex* pindex = NULL;
             CValidationState state;
-            if (!mapBlockIndex.count(block.GetHash())) {
-                ProcessNewBlock(state, pfrom, &block);
+            if (!AcceptBlockHeader(CBlock(cmpctblock.header), state, &pindex)) {
                 int nDoS;
-                if(state.IsInvalid(nDoS)) {
-                    pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                                       state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-                    if(nDoS > 0) {
-                        TRY_LOCK(cs_main, lockMain);
-                        if(lockMain) Misbehaving(pfrom->GetId(), nDoS);
-                    }
+                if (state.IsInvalid(nDoS)) {
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS);
+                    return error("invalid cmpctblock header %s from peer=%d", hashBlock.ToString(), pfrom->id);
                 }
-                //disconnect this node if its old protocol version
-                pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
-            } else {
-                LogPrint("net", "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
+                return true;
+            }
+            UpdateBlockAvailability(pfrom->GetId(), hashBlock);
+
+            std::shared_ptr<PartiallyDownloadedBlock> partialBlock = std::make_shared<PartiallyDownloadedBlock>(&mempool);
+            ReadStatus status = partialBlock->InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("invalid cmpctblock %s from peer=%d", hashBlock.ToString(), pfrom->id);
+            }
+
+            BlockTransactionsRequest req;
+            req.blockhash = hashBlock;
+            if (status == READ_STATUS_OK)
+                req.indexes = partialBlock->GetMissingIndexes();
+
+            if (status == READ_STATUS_OK && !req.indexes.empty()) {
+                State(pfrom->GetId())->partialBlock = partialBlock;
+                MarkBlockAsInFlight(pfrom->GetId(), hashBlock, pindex);
+                pfrom->PushMessage("getblocktxn", req);
+                return true;
+            }
+
+            if (status == READ_STATUS_OK)
+                status = partialBlock->FillBlock(block, std::vector<CTransaction>());
+            if (status != READ_STATUS_OK) {
+                // Short ID collision, fall back to the full block
+                std::vector<CInv> vInv(1, CInv(MSG_BLOCK, hashBlock));
+                pfrom->PushMessage("getdata", vInv);
+                return true;
+            }
+        }
+
+        ProcessReceivedBlock(pfrom, block, "block");
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+
+            CNodeState* nodestate = State(pfrom->GetId());
+            if (!nodestate->partialBlock || nodestate->partialBlock->header.GetHash() != resp.blockhash) {
+                LogPrint("net", "peer=%d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+
+            ReadStatus status = nodestate->partialBlock->FillBlock(block, resp.txn);
+            nodestate->partialBlock.reset();
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("invalid blocktxn %s from peer=%d", resp.blockhash.ToString(), pfrom->id);
+            }
+            if (status == READ_STATUS_FAILED) {
+                // Short ID collision, fall back to the full block
+                std::vector<CInv> vInv(1, CInv(MSG_BLOCK, resp.blockhash));
+                pfrom->PushMessage("getdata", vInv);
+                return true;
+            }
+        }
+
+        ProcessReceivedBlock(pfrom, block, "block");
+    }
+
+
+    else if (strCommand == "getblocktxn") {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA) || !chainActive.Contains(mi->second)) {
+            LogPrint("net", "peer=%d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, mi->second))
+            return error("cannot load block %s from disk", req.blockhash.ToString());
+
+        if (mi->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // We never announce blocks this old as compact blocks
+            pfrom->PushMessage("block", block);
+            return true;
+        }
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
             }
+            resp.txn[i] = block.vtx[req.indexes[i]];
         }
+        pfrom->PushMessage("blocktxn", resp);
     }
 
     // This asymmetric behavior for inbound and outbound connections was introduced
@@ -5744,6 +6175,10 @@ bool ProcessMessages(CNode* pfrom)
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
 
+    // Recover the signatures of masternode, budget and SwiftX messages on the verification
+    // threads, the messages themselves are still processed below in the order they came in
+    messageVerifier.Queue(pfrom);
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -5762,6 +6197,10 @@ bool ProcessMessages(CNode* pfrom)
         if (!msg.complete())
             break;
 
+        // leave this peer alone until the signatures of its next message are recovered
+        if (msg.verifying())
+            break;
+
         // at this point, any failure means we can delete the current message
         it++;
 
@@ -5938,10 +6377,13 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             if (nSyncStarted == 0 || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
                 state.fSyncStarted = true;
                 nSyncStarted++;
-                //CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
-                //LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-                //pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), UINT256_ZERO);
-                pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), UINT256_ZERO);
+                if (Params().HeadersFirstSyncingActive() && pto->nVersion >= HEADERS_FIRST_VERSION) {
+                    CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+                    LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
+                    pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), UINT256_ZERO);
+                } else {
+                    pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), UINT256_ZERO);
+                }
             }
         }
 
@@ -6013,6 +6455,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             LogPrintf("Timeout downloading block %s from peer=%d, disconnecting\n", state.vBlocksInFlight.front().hash.ToString(), pto->id);
             pto->fDisconnect = true;
         }
+        // Blocks downloaded ahead of a parent that does not arrive within the same timeout are dropped
+        if (!mapBlocksAwaitingParent.empty())
+            ExpireBlocksAwaitingParent(nNow - 500000 * Params().GetConsensus().nTargetSpacing * (4 + nQueuedValidatedHeaders));
 
         //
         // Message: getdata (blocks)
@@ -6023,7 +6468,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             NodeId staller = -1;
             FindNextBlocksToDownload(pto, MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
             for (CBlockIndex* pindex : vToDownload) {
-                vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+                // A block on top of our tip is likely made of transactions we already have
+                const bool fCompact = pto->fSupportsCompactBlocks && pindex->pprev == chainActive.Tip() && !IsInitialBlockDownload();
+                vGetData.push_back(CInv(fCompact ? MSG_CMPCT_BLOCK : MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
                 LogPrintf("Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
                     pindex->nHeight, pto->id);
@@ -564,13 +564,67 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
             CMasternodeBlockPayees blockPayees(winnerIn.nBlockHeight);
             mapMasternodeBlocks[winnerIn.nBlockHeight] = blockPayees;
         }
-    }
 
-    mapMasternodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+        CMasternodeBlockPayees& blockPayees = mapMasternodeBlocks[winnerIn.nBlockHeight];
+        blockPayees.AddPayee(winnerIn.payee, 1);
+        if (blockPayees.HasPayeeWithVotes(winnerIn.payee, MNPAYMENTS_LASTPAID_VOTES_REQUIRED))
+            AddPayeeVoteHeight(winnerIn.payee, winnerIn.nBlockHeight);
+    }
 
     return true;
 }
 
+void CMasternodePayments::AddPayeeVoteHeight(const CScript& payee, int nBlockHeight)
+{
+    LOCK(cs_mapMasternodeBlocks);
+    mapPayeeVoteHeights[payee].insert(nBlockHeight);
+}
+
+void CMasternodePayments::EraseBlockPayees(int nBlockHeight)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.find(nBlockHeight);
+    if (it == mapMasternodeBlocks.end()) return;
+
+    for (const CMasternodePayee& payee : it->second.vecPayments) {
+        std::map<CScript, std::set<int> >::iterator itHeights = mapPayeeVoteHeights.find(payee.scriptPubKey);
+        if (itHeights == mapPayeeVoteHeights.end()) continue;
+        itHeights->second.erase(nBlockHeight);
+        if (itHeights->second.empty()) mapPayeeVoteHeights.erase(itHeights);
+    }
+    mapMasternodeBlocks.erase(it);
+}
+
+void CMasternodePayments::RebuildPayeeVoteHeights()
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    mapPayeeVoteHeights.clear();
+    for (const auto& it : mapMasternodeBlocks) {
+        for (const CMasternodePayee& payee : it.second.vecPayments) {
+            if (payee.nVotes >= MNPAYMENTS_LASTPAID_VOTES_REQUIRED)
+                mapPayeeVoteHeights[payee.scriptPubKey].insert(it.first);
+        }
+    }
+}
+
+int CMasternodePayments::GetLastPaidHeight(const CScript& payee, int nHeight, int nBlocks)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    std::map<CScript, std::set<int> >::const_iterator it = mapPayeeVoteHeights.find(payee);
+    if (it == mapPayeeVoteHeights.end()) return 0;
+
+    // newest voted height not above nHeight, accepted if it lies in (nHeight - nBlocks, nHeight]
+    std::set<int>::const_iterator itHeight = it->second.upper_bound(nHeight);
+    if (itHeight == it->second.begin()) return 0;
+    --itHeight;
+
+    if (*itHeight <= 0 || *itHeight <= nHeight - nBlocks) return 0;
+    return *itHeight;
+}
+
 bool CMasternodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
 {
     LOCK(cs_vecPayments);
@@ -700,7 +754,7 @@ void CMasternodePayments::CleanPaymentList()
             LogPrint("mnpayments", "CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", winner.nBlockHeight);
             masternodeSync.mapSeenSyncMNW.erase((*it).first);
             mapMasternodePayeeVotes.erase(it++);
-            mapMasternodeBlocks.erase(winner.nBlockHeight);
+            EraseBlockPayees(winner.nBlockHeight);
         } else {
             ++it;
         }
@@ -23,6 +23,7 @@ extern CMasternodePayments masternodePayments;
 
 #define MNPAYMENTS_SIGNATURES_REQUIRED 6
 #define MNPAYMENTS_SIGNATURES_TOTAL 10
+#define MNPAYMENTS_LASTPAID_VOTES_REQUIRED 2
 
 void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 bool IsBlockPayeeValid(const CBlock& block, int nBlockHeight);
@@ -232,6 +233,13 @@ private:
     int nSyncedFromPeer;
     int nLastBlockHeight;
 
+    // heights at which each payee gathered enough votes to count as paid (guarded by cs_mapMasternodeBlocks)
+    std::map<CScript, std::set<int> > mapPayeeVoteHeights;
+
+    void AddPayeeVoteHeight(const CScript& payee, int nBlockHeight);
+    void EraseBlockPayees(int nBlockHeight);
+    void RebuildPayeeVoteHeights();
+
 public:
     std::map<uint256, CMasternodePaymentWinner> mapMasternodePayeeVotes;
     std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
@@ -248,6 +256,7 @@ public:
         LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePayeeVotes);
         mapMasternodeBlocks.clear();
         mapMasternodePayeeVotes.clear();
+        mapPayeeVoteHeights.clear();
     }
 
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
@@ -257,6 +266,9 @@ public:
     void CleanPaymentList();
     int LastPayment(CMasternode& mn);
 
+    /// Most recent height within the nBlocks up to nHeight at which payee was voted paid, 0 if none
+    int GetLastPaidHeight(const CScript& payee, int nHeight, int nBlocks);
+
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
     bool IsScheduled(CMasternode& mn, int nNotBlockHeight);
@@ -291,6 +303,8 @@ public:
     {
         READWRITE(mapMasternodePayeeVotes);
         READWRITE(mapMasternodeBlocks);
+        if (ser_action.ForRead())
+            RebuildPayeeVoteHeights();
     }
 };
 
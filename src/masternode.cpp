@@ -23,9 +23,14 @@ bool GetBlockHash(uint256& hash, int nBlockHeight)
     if (nBlockHeight == 0)
         nBlockHeight = chainActive.Tip()->nHeight;
 
-    if (mapCacheBlockHashes.count(nBlockHeight)) {
-        hash = mapCacheBlockHashes[nBlockHeight];
-        return true;
+    // the cached hash is only valid while its block is still on the active chain
+    std::map<int64_t, uint256>::const_iterator it = mapCacheBlockHashes.find(nBlockHeight);
+    if (it != mapCacheBlockHashes.end()) {
+        const CBlockIndex* pindex = chainActive[nBlockHeight - 1];
+        if (pindex && pindex->GetBlockHash() == it->second) {
+            hash = it->second;
+            return true;
+        }
     }
 
     const CBlockIndex* BlockLastSolved = chainActive.Tip();
@@ -203,13 +208,20 @@ void CMasternode::Check(bool forceCheck)
     }
 
     if (!unitTest) {
-        CValidationState state;
-        CMutableTransaction tx = CMutableTransaction();
-        CTxOut vout = CTxOut(11999.99 * COIN, obfuScationPool.collateralPubKey);
-        tx.vin.push_back(vin);
-        tx.vout.push_back(vout);
+        int nCollateralStatus = mnCollaterals.GetStatus(vin.prevout);
+        if (nCollateralStatus == CMasternodeCollaterals::COLLATERAL_SPENT) {
+            activeState = MASTERNODE_VIN_SPENT;
+            return;
+        }
+
+        // check the collateral in full only once, spends after that are reported to mnCollaterals
+        if (nCollateralStatus == CMasternodeCollaterals::COLLATERAL_UNVERIFIED) {
+            CValidationState state;
+            CMutableTransaction tx = CMutableTransaction();
+            CTxOut vout = CTxOut(11999.99 * COIN, obfuScationPool.collateralPubKey);
+            tx.vin.push_back(vin);
+            tx.vout.push_back(vout);
 
-        {
             TRY_LOCK(cs_main, lockMain);
             if (!lockMain) return;
 
@@ -217,18 +229,16 @@ void CMasternode::Check(bool forceCheck)
                 activeState = MASTERNODE_VIN_SPENT;
                 return;
             }
+            mnCollaterals.SetVerified(vin.prevout);
         }
     }
 
     activeState = MASTERNODE_ENABLED; // OK
 }
 
-int64_t CMasternode::SecondsSincePayment()
+int64_t CMasternode::SecondsSincePayment(int nMnCount)
 {
-    CScript pubkeyScript;
-    pubkeyScript = GetScriptForDestination(pubKeyCollateralAddress.GetID());
-
-    int64_t sec = (GetAdjustedTime() - GetLastPaid());
+    int64_t sec = (GetAdjustedTime() - GetLastPaid(nMnCount));
     int64_t month = 60 * 60 * 24 * 30;
     if (sec < month) return sec; //if it's less than 30 days, give seconds
 
@@ -241,7 +251,7 @@ int64_t CMasternode::SecondsSincePayment()
     return month + hash.GetCompact(false);
 }
 
-int64_t CMasternode::GetLastPaid()
+int64_t CMasternode::GetLastPaid(int nMnCount)
 {
     CBlockIndex* pindexPrev = chainActive.Tip();
     if (pindexPrev == NULL) return false;
@@ -257,36 +267,21 @@ int64_t CMasternode::GetLastPaid()
     // use a deterministic offset to break a tie -- 2.5 minutes
     int64_t nOffset = hash.GetCompact(false) % 150;
 
-    if (chainActive.Tip() == NULL) return false;
-
-    const CBlockIndex* BlockReading = chainActive.Tip();
+    // only look back as far as one and a quarter payment cycles
+    if (nMnCount == -1) nMnCount = mnodeman.CountEnabled();
+    int nBlocks = nMnCount * 1.25;
 
-    int nMnCount = mnodeman.CountEnabled() * 1.25;
-    int n = 0;
-    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
-        if (n >= nMnCount) {
-            return 0;
-        }
-        n++;
+    /*
+        Search for this payee, with at least 2 votes. This will aid in consensus allowing the network
+        to converge on the same payees quickly, then keep the same schedule.
+    */
+    int nPaidHeight = masternodePayments.GetLastPaidHeight(mnpayee, pindexPrev->nHeight, nBlocks);
+    if (nPaidHeight == 0) return 0;
 
-        if (masternodePayments.mapMasternodeBlocks.count(BlockReading->nHeight)) {
-            /*
-                Search for this payee, with at least 2 votes. This will aid in consensus allowing the network
-                to converge on the same payees quickly, then keep the same schedule.
-            */
-            if (masternodePayments.mapMasternodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(mnpayee, 2)) {
-                return BlockReading->nTime + nOffset;
-            }
-        }
+    const CBlockIndex* pindexPaid = chainActive[nPaidHeight];
+    if (pindexPaid == NULL) return 0;
 
-        if (BlockReading->pprev == NULL) {
-            assert(BlockReading);
-            break;
-        }
-        BlockReading = BlockReading->pprev;
-    }
-
-    return 0;
+    return pindexPaid->nTime + nOffset;
 }
 
 std::string CMasternode::GetStatus()
@@ -487,6 +482,22 @@ bool CMasternodeBroadcast::CheckSignature() const
     return true;
 }
 
+bool CMasternodeBroadcast::RecoverSigner(CKeyID& keyIDRet) const
+{
+    std::string strMessage = (
+                            nMessVersion == MessageVersion::MESS_VER_HASH ?
+                            GetSignatureHash().GetHex() :
+                            GetStrMessage()
+                            );
+
+    if (CHashSigner::RecoverKeyID(CMessageSigner::GetMessageHash(strMessage), vchSig, keyIDRet) &&
+        keyIDRet == pubKeyCollateralAddress.GetID())
+        return true;
+
+    // the same fallback to the old signature message format as CheckSignature
+    return CHashSigner::RecoverKeyID(CMessageSigner::GetMessageHash(GetOldStrMessage()), vchSig, keyIDRet);
+}
+
 std::string CMasternodeBroadcast::GetOldStrMessage() const
 {
     std::string strMessage;
@@ -590,6 +601,7 @@ bool CMasternodeBroadcast::CheckAndUpdate(int& nDos)
         //take the newest entry
         LogPrint("masternode","mnb - Got updated entry for %s\n", vin.prevout.hash.ToString());
         if (pmn->UpdateFromNewBroadcast((*this))) {
+            mnodeman.InvalidateRankings();
             pmn->Check();
             if (pmn->IsEnabled()) Relay();
         }
@@ -222,7 +222,7 @@ public:
         READWRITE(nLastScanningErrorBlockHeight);
     }
 
-    int64_t SecondsSincePayment();
+    int64_t SecondsSincePayment(int nMnCount = -1);
 
     bool UpdateFromNewBroadcast(CMasternodeBroadcast& mnb);
 
@@ -286,7 +286,7 @@ public:
         return strStatus;
     }
 
-    int64_t GetLastPaid();
+    int64_t GetLastPaid(int nMnCount = -1);
     bool IsValidNetAddr();
 
     /// Is the input associated with collateral public key? (and there is 12000 WAGE - checking if valid masternode)
@@ -316,6 +316,7 @@ public:
     bool Sign(const CKey& key, const CPubKey& pubKey, const bool fNewSigs);
     bool Sign(const std::string strSignKey, const bool fNewSigs);
     bool CheckSignature() const;
+    bool RecoverSigner(CKeyID& keyIDRet) const override;
     // for compatibility with pre-v2.0 masternode messages
     std::string GetOldStrMessage() const;
 
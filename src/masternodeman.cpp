@@ -17,10 +17,12 @@
 
 /** Masternode manager */
 CMasternodeMan mnodeman;
+/** Masternode collateral status */
+CMasternodeCollaterals mnCollaterals;
 
 struct CompareLastPaid {
-    bool operator()(const std::pair<int64_t, CTxIn>& t1,
-        const std::pair<int64_t, CTxIn>& t2) const
+    bool operator()(const std::pair<int64_t, CMasternode*>& t1,
+        const std::pair<int64_t, CMasternode*>& t2) const
     {
         return t1.first < t2.first;
     }
@@ -42,6 +44,67 @@ struct CompareScoreMN {
     }
 };
 
+//
+// CMasternodeCollaterals
+//
+
+void CMasternodeCollaterals::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    LOCK(cs);
+
+    if (mapStatus.empty()) return;
+
+    // only a connected block spends a collateral for good; a spend that is unconfirmed, conflicted
+    // or disconnected may never make it into the chain, so check those collaterals in full again
+    for (const CTxIn& txin : tx.vin) {
+        std::map<COutPoint, int>::iterator it = mapStatus.find(txin.prevout);
+        if (it != mapStatus.end()) it->second = pblock ? COLLATERAL_SPENT : COLLATERAL_UNVERIFIED;
+    }
+
+    // the transaction creating a collateral left the chain (or is unconfirmed), check those in full again
+    if (pblock == NULL) {
+        const uint256& hash = tx.GetHash();
+        std::map<COutPoint, int>::iterator it = mapStatus.lower_bound(COutPoint(hash, 0));
+        for (; it != mapStatus.end() && it->first.hash == hash; ++it) {
+            if (it->second == COLLATERAL_UNSPENT) it->second = COLLATERAL_UNVERIFIED;
+        }
+    }
+}
+
+int CMasternodeCollaterals::GetStatus(const COutPoint& outpoint)
+{
+    LOCK(cs);
+
+    std::map<COutPoint, int>::iterator it = mapStatus.find(outpoint);
+    if (it == mapStatus.end()) {
+        mapStatus.insert(std::make_pair(outpoint, (int)COLLATERAL_UNVERIFIED));
+        return COLLATERAL_UNVERIFIED;
+    }
+
+    return it->second;
+}
+
+void CMasternodeCollaterals::SetVerified(const COutPoint& outpoint)
+{
+    LOCK(cs);
+
+    std::map<COutPoint, int>::iterator it = mapStatus.find(outpoint);
+    if (it != mapStatus.end() && it->second == COLLATERAL_UNVERIFIED)
+        it->second = COLLATERAL_UNSPENT;
+}
+
+void CMasternodeCollaterals::Forget(const COutPoint& outpoint)
+{
+    LOCK(cs);
+    mapStatus.erase(outpoint);
+}
+
+void CMasternodeCollaterals::Clear()
+{
+    LOCK(cs);
+    mapStatus.clear();
+}
+
 //
 // CMasternodeDB
 //
@@ -209,6 +272,7 @@ bool CMasternodeMan::Add(CMasternode& mn)
     if (pmn == NULL) {
         LogPrint("masternode", "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
         vMasternodes.push_back(mn);
+        InvalidateRankings();
         return true;
     }
 
@@ -278,7 +342,9 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
                 }
             }
 
+            mnCollaterals.Forget((*it).vin.prevout);
             it = vMasternodes.erase(it);
+            InvalidateRankings();
         } else {
             ++it;
         }
@@ -345,7 +411,15 @@ void CMasternodeMan::Clear()
     mWeAskedForMasternodeListEntry.clear();
     mapSeenMasternodeBroadcast.clear();
     mapSeenMasternodePing.clear();
+    mapRankings.clear();
     nDsqCount = 0;
+    mnCollaterals.Clear();
+}
+
+void CMasternodeMan::InvalidateRankings()
+{
+    LOCK(cs);
+    mapRankings.clear();
 }
 
 int CMasternodeMan::stable_size ()
@@ -479,7 +553,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     LOCK(cs);
 
     CMasternode* pBestMasternode = NULL;
-    std::vector<std::pair<int64_t, CTxIn> > vecMasternodeLastPaid;
+    std::vector<std::pair<int64_t, CMasternode*> > vecMasternodeLastPaid;
 
     /*
         Make a vector with all of the last paid times
@@ -502,7 +576,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
         //make sure it has as many confirmations as there are masternodes
         if (mn.GetMasternodeInputAge() < nMnCount) continue;
 
-        vecMasternodeLastPaid.push_back(std::make_pair(mn.SecondsSincePayment(), mn.vin));
+        vecMasternodeLastPaid.push_back(std::make_pair(mn.SecondsSincePayment(nMnCount), &mn));
     }
 
     nCount = (int)vecMasternodeLastPaid.size();
@@ -517,12 +591,11 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
     //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
     //  -- (chance per block * chances before IsScheduled will fire)
-    int nTenthNetwork = CountEnabled() / 10;
+    int nTenthNetwork = nMnCount / 10;
     int nCountTenth = 0;
     uint256 nHigh;
-    for (PAIRTYPE(int64_t, CTxIn) & s : vecMasternodeLastPaid) {
-        CMasternode* pmn = Find(s.second);
-        if (!pmn) break;
+    for (PAIRTYPE(int64_t, CMasternode*) & s : vecMasternodeLastPaid) {
+        CMasternode* pmn = s.second;
 
         uint256 n = pmn->CalculateScore(1, nBlockHeight - 100);
         if (n > nHigh) {
@@ -591,15 +664,25 @@ CMasternode* CMasternodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight,
     return winner;
 }
 
-int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+const CMasternodeMan::CMasternodeRanking& CMasternodeMan::GetRanking(int64_t nBlockHeight, int minProtocol, bool fOnlyActive, bool fFilterAge)
 {
+    LOCK(cs);
+
+    // scores are derived from this block, which changes when the chain reorganizes
+    uint256 hashBlock;
+    GetBlockHash(hashBlock, nBlockHeight);
+
+    // masternode states are re-evaluated at most every MASTERNODE_CHECK_SECONDS, so reuse rankings that recent
+    const std::tuple<int64_t, int, bool, bool> key = std::make_tuple(nBlockHeight, minProtocol, fOnlyActive, fFilterAge);
+    std::map<std::tuple<int64_t, int, bool, bool>, CMasternodeRanking>::iterator it = mapRankings.find(key);
+    if (it != mapRankings.end() && it->second.hashBlock == hashBlock &&
+        GetTime() - it->second.nTimeComputed < MASTERNODE_CHECK_SECONDS)
+        return it->second;
+
     std::vector<std::pair<int64_t, CTxIn> > vecMasternodeScores;
     int64_t nMasternode_Min_Age = MN_WINNER_MINIMUM_AGE;
     int64_t nMasternode_Age = 0;
-
-    //make sure we know about this block
-    uint256 hash;
-    if (!GetBlockHash(hash, nBlockHeight)) return -1;
+    bool fAgeEnforced = fFilterAge && sporkManager.IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT);
 
     // scan for winner
     for (CMasternode& mn : vMasternodes) {
@@ -608,7 +691,7 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
             continue;                                                       // Skip obsolete versions
         }
 
-        if (sporkManager.IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT)) {
+        if (fAgeEnforced) {
             nMasternode_Age = GetAdjustedTime() - mn.sigTime;
             if ((nMasternode_Age) < nMasternode_Min_Age) {
                 if (fDebug) LogPrint("masternode","Skipping just activated Masternode. Age: %ld\n", nMasternode_Age);
@@ -627,15 +710,39 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
 
     sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
 
+    // keep the cache bounded, forgetting the lowest heights first
+    if (it == mapRankings.end() && mapRankings.size() >= MASTERNODES_RANKINGS_CACHED)
+        mapRankings.erase(mapRankings.begin());
+
+    CMasternodeRanking& ranking = mapRankings[key];
+    ranking.hashBlock = hashBlock;
+    ranking.nTimeComputed = GetTime();
+    ranking.vecRanked.clear();
+    ranking.mapRank.clear();
+
     int rank = 0;
     for (PAIRTYPE(int64_t, CTxIn) & s : vecMasternodeScores) {
         rank++;
-        if (s.second.prevout == vin.prevout) {
-            return rank;
-        }
+        ranking.vecRanked.push_back(s.second);
+        ranking.mapRank.insert(std::make_pair(s.second.prevout, rank));
     }
 
-    return -1;
+    return ranking;
+}
+
+int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+{
+    //make sure we know about this block
+    uint256 hash;
+    if (!GetBlockHash(hash, nBlockHeight)) return -1;
+
+    LOCK(cs);
+
+    const CMasternodeRanking& ranking = GetRanking(nBlockHeight, minProtocol, fOnlyActive, true);
+    std::map<COutPoint, int>::const_iterator it = ranking.mapRank.find(vin.prevout);
+    if (it == ranking.mapRank.end()) return -1;
+
+    return it->second;
 }
 
 std::vector<std::pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
@@ -677,33 +784,12 @@ std::vector<std::pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int
 
 CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<std::pair<int64_t, CTxIn> > vecMasternodeScores;
-
-    // scan for winner
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.protocolVersion < minProtocol) continue;
-        if (fOnlyActive) {
-            mn.Check();
-            if (!mn.IsEnabled()) continue;
-        }
-
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(n2, mn.vin));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
+    LOCK(cs);
 
-    int rank = 0;
-    for (PAIRTYPE(int64_t, CTxIn) & s : vecMasternodeScores) {
-        rank++;
-        if (rank == nRank) {
-            return Find(s.second);
-        }
-    }
+    const CMasternodeRanking& ranking = GetRanking(nBlockHeight, minProtocol, fOnlyActive, false);
+    if (nRank < 1 || nRank > (int)ranking.vecRanked.size()) return NULL;
 
-    return NULL;
+    return Find(ranking.vecRanked[nRank - 1]);
 }
 
 void CMasternodeMan::ProcessMasternodeConnections()
@@ -859,7 +945,9 @@ void CMasternodeMan::Remove(CTxIn vin)
     while (it != vMasternodes.end()) {
         if ((*it).vin == vin) {
             LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
+            mnCollaterals.Forget((*it).vin.prevout);
             vMasternodes.erase(it);
+            InvalidateRankings();
             break;
         }
         ++it;
@@ -880,6 +968,7 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
         Add(mn);
     } else {
         pmn->UpdateFromNewBroadcast(mnb);
+        InvalidateRankings();
     }
 }
 
@@ -13,14 +13,20 @@
 #include "net.h"
 #include "sync.h"
 #include "util.h"
+#include "validationinterface.h"
+
+#include <tuple>
 
 #define MASTERNODES_DUMP_SECONDS (15 * 60)
 #define MASTERNODES_DSEG_SECONDS (3 * 60 * 60)
+#define MASTERNODES_RANKINGS_CACHED 64
 
 
 class CMasternodeMan;
+class CMasternodeCollaterals;
 
 extern CMasternodeMan mnodeman;
+extern CMasternodeCollaterals mnCollaterals;
 void DumpMasternodes();
 
 /** Access to the MN database (mncache.dat)
@@ -47,6 +53,42 @@ public:
     ReadResult Read(CMasternodeMan& mnodemanToLoad, bool fDryRun = false);
 };
 
+/** Keeps track of whether Masternode collateral outpoints are still unspent.
+ * A collateral is verified against the chain and mempool once, after that a
+ * connected block spending it (seen through the validation interface) marks it
+ * spent. Unconfirmed or disconnected spends only send it back to a full check.
+ */
+class CMasternodeCollaterals : public CValidationInterface
+{
+private:
+    mutable RecursiveMutex cs;
+
+    // collateral outpoint -> status
+    std::map<COutPoint, int> mapStatus;
+
+protected:
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock) override;
+
+public:
+    enum Status {
+        COLLATERAL_UNVERIFIED,
+        COLLATERAL_UNSPENT,
+        COLLATERAL_SPENT
+    };
+
+    /// Get the status of a collateral, starting to watch it if unknown
+    int GetStatus(const COutPoint& outpoint);
+
+    /// Record that a watched collateral was found unspent by a full check
+    void SetVerified(const COutPoint& outpoint);
+
+    /// Stop watching a collateral
+    void Forget(const COutPoint& outpoint);
+
+    /// Stop watching all collaterals
+    void Clear();
+};
+
 class CMasternodeMan
 {
 private:
@@ -65,6 +107,19 @@ private:
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
 
+    // Masternodes sorted by score for one (block height, min protocol, only active, age filtered) query
+    struct CMasternodeRanking {
+        uint256 hashBlock;
+        int64_t nTimeComputed;
+        std::vector<CTxIn> vecRanked;
+        std::map<COutPoint, int> mapRank;
+    };
+    // rankings already computed, dropped whenever the Masternode list changes and
+    // recomputed when the block they were scored on left the active chain
+    std::map<std::tuple<int64_t, int, bool, bool>, CMasternodeRanking> mapRankings;
+
+    const CMasternodeRanking& GetRanking(int64_t nBlockHeight, int minProtocol, bool fOnlyActive, bool fFilterAge);
+
 public:
     // Keep track of all broadcasts I've seen
     std::map<uint256, CMasternodeBroadcast> mapSeenMasternodeBroadcast;
@@ -108,6 +163,9 @@ public:
     /// Clear Masternode vector
     void Clear();
 
+    /// Drop cached rankings after an entry was added, removed or updated
+    void InvalidateRankings();
+
     int CountEnabled(int protocolVersion = -1);
 
     void CountNetworks(int protocolVersion, int& ipv4, int& ipv6, int& onion);
@@ -8,9 +8,75 @@
 #include "main.h" // For strMessageMagic
 #include "messagesigner.h"
 #include "masternodeman.h"  // For GetPublicKey (of MN from its vin)
+#include "random.h"
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+namespace {
+
+/**
+ * Keys recovered from compact signatures, filled ahead of the message handler by the
+ * message verification threads so that the handlers only have to compare key IDs.
+ * Signatures no key could be recovered from are kept with a null key ID, so that the
+ * handler rejects them without trying the recovery again.
+ */
+class CRecoveredKeyCache
+{
+private:
+    //! Entries are indexed by the hash of the signed hash and the signature
+    std::map<uint256, CKeyID> mapRecovered;
+    boost::shared_mutex cs_keycache;
+
+    static uint256 GetEntryHash(const uint256& hash, const std::vector<unsigned char>& vchSig)
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << hash << vchSig;
+        return ss.GetHash();
+    }
+
+public:
+    bool Get(const uint256& hash, const std::vector<unsigned char>& vchSig, CKeyID& keyIDRet)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_keycache);
+
+        std::map<uint256, CKeyID>::const_iterator mi = mapRecovered.find(GetEntryHash(hash, vchSig));
+        if (mi == mapRecovered.end())
+            return false;
+        keyIDRet = mi->second;
+        return true;
+    }
+
+    void Set(const uint256& hash, const std::vector<unsigned char>& vchSig, const CKeyID& keyID)
+    {
+        // Enough for a full masternode list sync, about 100 bytes per entry
+        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_keycache);
+
+        while (static_cast<int64_t>(mapRecovered.size()) > nMaxCacheSize) {
+            // Evict a random entry, see CSignatureCache
+            std::map<uint256, CKeyID>::iterator it = mapRecovered.lower_bound(GetRandHash());
+            if (it == mapRecovered.end())
+                it = mapRecovered.begin();
+            mapRecovered.erase(it);
+        }
+
+        mapRecovered[GetEntryHash(hash, vchSig)] = keyID;
+    }
+};
+
+CRecoveredKeyCache recoveredKeyCache;
+
+std::atomic<uint64_t> nKeyRecoveries(0);
+
+}
+
 bool CMessageSigner::GetKeysFromSecret(const std::string& strSecret, CKey& keyRet, CPubKey& pubkeyRet)
 {
     CBitcoinSecret vchSecret;
@@ -58,15 +124,15 @@ bool CHashSigner::VerifyHash(const uint256& hash, const CPubKey& pubkey, const s
 
 bool CHashSigner::VerifyHash(const uint256& hash, const CKeyID& keyID, const std::vector<unsigned char>& vchSig, std::string& strErrorRet)
 {
-    CPubKey pubkeyFromSig;
-    if(!pubkeyFromSig.RecoverCompact(hash, vchSig)) {
+    CKeyID keyIDFromSig;
+    if(!RecoverKeyID(hash, vchSig, keyIDFromSig)) {
         strErrorRet = "Error recovering public key.";
         return false;
     }
 
-    if(pubkeyFromSig.GetID() != keyID) {
+    if(keyIDFromSig != keyID) {
         strErrorRet = strprintf("Keys don't match: pubkey=%s, pubkeyFromSig=%s, hash=%s, vchSig=%s",
-                CBitcoinAddress(keyID).ToString(), CBitcoinAddress(pubkeyFromSig.GetID()).ToString(),
+                CBitcoinAddress(keyID).ToString(), CBitcoinAddress(keyIDFromSig).ToString(),
                 hash.ToString(), EncodeBase64(&vchSig[0], vchSig.size()));
         return false;
     }
@@ -74,6 +140,29 @@ bool CHashSigner::VerifyHash(const uint256& hash, const CKeyID& keyID, const std
     return true;
 }
 
+bool CHashSigner::RecoverKeyID(const uint256& hash, const std::vector<unsigned char>& vchSig, CKeyID& keyIDRet)
+{
+    if (recoveredKeyCache.Get(hash, vchSig, keyIDRet))
+        return !keyIDRet.IsNull();
+
+    nKeyRecoveries++;
+    CPubKey pubkeyFromSig;
+    if (!pubkeyFromSig.RecoverCompact(hash, vchSig)) {
+        keyIDRet.SetNull();
+        recoveredKeyCache.Set(hash, vchSig, keyIDRet);
+        return false;
+    }
+
+    keyIDRet = pubkeyFromSig.GetID();
+    recoveredKeyCache.Set(hash, vchSig, keyIDRet);
+    return true;
+}
+
+uint64_t CHashSigner::GetKeyRecoveries()
+{
+    return nKeyRecoveries;
+}
+
 /** CSignedMessage Class
  *  Functions inherited by network signed-messages
  */
@@ -146,6 +235,14 @@ bool CSignedMessage::CheckSignature() const
     return CheckSignature(pubkey);
 }
 
+bool CSignedMessage::RecoverSigner(CKeyID& keyIDRet) const
+{
+    if (nMessVersion == MessageVersion::MESS_VER_HASH)
+        return CHashSigner::RecoverKeyID(GetSignatureHash(), vchSig, keyIDRet);
+
+    return CHashSigner::RecoverKeyID(CMessageSigner::GetMessageHash(GetStrMessage()), vchSig, keyIDRet);
+}
+
 const CPubKey CSignedMessage::GetPublicKey(std::string& strErrorRet) const
 {
     const CTxIn vin = GetVin();
@@ -42,6 +42,10 @@ public:
     static bool VerifyHash(const uint256& hash, const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, std::string& strErrorRet);
     /// Verify the hash signature, returns true if successful
     static bool VerifyHash(const uint256& hash, const CKeyID& keyID, const std::vector<unsigned char>& vchSig, std::string& strErrorRet);
+    /// Recover the key that signed the hash, returns true if successful. Results are cached, failures included.
+    static bool RecoverKeyID(const uint256& hash, const std::vector<unsigned char>& vchSig, CKeyID& keyIDRet);
+    /// Number of public key recoveries done so far, answers from the cache are not counted
+    static uint64_t GetKeyRecoveries();
 };
 
 /** Base Class for all signed messages on the network
@@ -71,6 +75,9 @@ public:
     bool Sign(const std::string strSignKey, const bool fNewSigs);
     bool CheckSignature(const CPubKey& pubKey) const;
     bool CheckSignature() const;
+    // Recover the key of the signer without looking up the masternode, so that the
+    // following CheckSignature only compares keys
+    virtual bool RecoverSigner(CKeyID& keyIDRet) const;
 
     // Pure virtual functions (used in Sign-Verify functions)
     // Must be implemented in child classes
@@ -0,0 +1,165 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "messageverifier.h"
+
+#include "masternode.h"
+#include "masternode-budget.h"
+#include "masternode-payments.h"
+#include "messagesigner.h"
+#include "net.h"
+#include "swifttx.h"
+#include "util.h"
+
+#include <boost/bind.hpp>
+
+CMessageVerifier messageVerifier;
+
+template <typename T>
+static bool RecoverSigner(CDataStream& vRecv)
+{
+    T msg;
+    vRecv >> msg;
+    CKeyID keyID;
+    return msg.RecoverSigner(keyID);
+}
+
+bool CMessageVerifier::IsVerifiedCommand(const std::string& strCommand)
+{
+    return strCommand == "mnb" || strCommand == "mnp" || strCommand == "mnw" ||
+           strCommand == "mvote" || strCommand == "fbvote" || strCommand == "txlvote";
+}
+
+bool CMessageVerifier::Verify(const CMessageVerifyJob& job)
+{
+    CDataStream vRecv(job.vRecv);
+    try {
+        if (job.strCommand == "mnb") {
+            CMasternodeBroadcast mnb;
+            vRecv >> mnb;
+            CKeyID keyID;
+            bool fRecovered = mnb.RecoverSigner(keyID);
+            return mnb.lastPing.RecoverSigner(keyID) && fRecovered;
+        } else if (job.strCommand == "mnp") {
+            return RecoverSigner<CMasternodePing>(vRecv);
+        } else if (job.strCommand == "mnw") {
+            return RecoverSigner<CMasternodePaymentWinner>(vRecv);
+        } else if (job.strCommand == "mvote") {
+            return RecoverSigner<CBudgetVote>(vRecv);
+        } else if (job.strCommand == "fbvote") {
+            return RecoverSigner<CFinalizedBudgetVote>(vRecv);
+        } else if (job.strCommand == "txlvote") {
+            return RecoverSigner<CConsensusVote>(vRecv);
+        }
+    } catch (const std::exception& e) {
+        // malformed messages are rejected by their handler
+    }
+    return false;
+}
+
+bool CMessageVerifyCheck::operator()()
+{
+    // a failed recovery must not stop the check queue from verifying the rest of the batch
+    job->fValid = CMessageVerifier::Verify(*job);
+    return true;
+}
+
+void CMessageVerifier::Start(boost::thread_group& threadGroup, int nThreadsIn)
+{
+    LogPrintf("Using %d threads for message signature verification\n", nThreadsIn);
+    nThreads = nThreadsIn;
+    if (nThreadsIn <= 0)
+        return;
+
+    // the dispatcher joins the check queue as its last worker
+    threadGroup.create_thread(boost::bind(&ThreadMessageVerify, this));
+    for (int i = 0; i < nThreadsIn - 1; i++)
+        threadGroup.create_thread(boost::bind(&ThreadMessageVerifyCheck, this));
+}
+
+void CMessageVerifier::Queue(CNode* pfrom)
+{
+    if (!IsEnabled())
+        return;
+
+    std::vector<std::shared_ptr<CMessageVerifyJob> > vJobs;
+    unsigned int nScanned = 0;
+    for (CNetMessage& msg : pfrom->vRecvMsg) {
+        if (!msg.complete() || nScanned++ >= MAX_MSGVERIFY_LOOKAHEAD)
+            break;
+        if (msg.verifyJob)
+            continue;
+        std::string strCommand = msg.hdr.GetCommand();
+        if (!IsVerifiedCommand(strCommand))
+            continue;
+        msg.verifyJob = std::make_shared<CMessageVerifyJob>(strCommand, msg.vRecv);
+        vJobs.push_back(msg.verifyJob);
+    }
+    if (vJobs.empty())
+        return;
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        queue.insert(queue.end(), vJobs.begin(), vJobs.end());
+    }
+    condDispatcher.notify_one();
+}
+
+void CMessageVerifier::VerifyBatch(const std::vector<std::shared_ptr<CMessageVerifyJob> >& vJobs)
+{
+    if (nThreads > 1) {
+        std::vector<CMessageVerifyCheck> vChecks;
+        vChecks.reserve(vJobs.size());
+        for (const std::shared_ptr<CMessageVerifyJob>& job : vJobs)
+            vChecks.push_back(CMessageVerifyCheck(job));
+
+        CCheckQueueControl<CMessageVerifyCheck> control(&checkqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        for (const std::shared_ptr<CMessageVerifyJob>& job : vJobs)
+            job->fValid = Verify(*job);
+    }
+
+    for (const std::shared_ptr<CMessageVerifyJob>& job : vJobs)
+        job->fDone = true;
+    messageHandlerCondition.notify_one();
+}
+
+void CMessageVerifier::Thread()
+{
+    std::vector<std::shared_ptr<CMessageVerifyJob> > vJobs;
+    vJobs.reserve(MAX_MSGVERIFY_BATCH);
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (queue.empty())
+                condDispatcher.wait(lock);
+            while (!queue.empty() && vJobs.size() < MAX_MSGVERIFY_BATCH) {
+                vJobs.push_back(queue.front());
+                queue.pop_front();
+            }
+        }
+
+        VerifyBatch(vJobs);
+        vJobs.clear();
+    }
+}
+
+void CMessageVerifier::CheckThread()
+{
+    checkqueue.Thread();
+}
+
+void ThreadMessageVerify(CMessageVerifier* verifier)
+{
+    util::ThreadRename("digiwage-msgverify");
+    verifier->Thread();
+}
+
+void ThreadMessageVerifyCheck(CMessageVerifier* verifier)
+{
+    util::ThreadRename("digiwage-msgcheck");
+    verifier->CheckThread();
+}
@@ -0,0 +1,112 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef MESSAGEVERIFIER_H
+#define MESSAGEVERIFIER_H
+
+#include "checkqueue.h"
+#include "streams.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+class CNode;
+class CMessageVerifier;
+
+/** -msgverifythreads default (number of message signature recovery threads, 0 = auto) */
+static const int DEFAULT_MSGVERIFY_THREADS = 0;
+/** Maximum number of message signature recovery threads */
+static const int MAX_MSGVERIFY_THREADS = 8;
+/** Number of complete messages at the front of a peer's receive queue that are handed to the verifier */
+static const unsigned int MAX_MSGVERIFY_LOOKAHEAD = 1000;
+/** Maximum number of messages verified together in one batch */
+static const unsigned int MAX_MSGVERIFY_BATCH = 256;
+
+extern CMessageVerifier messageVerifier;
+
+/** A received message whose signatures are recovered off the message handler thread */
+class CMessageVerifyJob
+{
+public:
+    std::string strCommand;
+    CDataStream vRecv;
+    //! Whether all signing keys of the message were recovered, set before fDone
+    std::atomic<bool> fValid;
+    std::atomic<bool> fDone;
+
+    CMessageVerifyJob(const std::string& strCommandIn, const CDataStream& vRecvIn) : strCommand(strCommandIn), vRecv(vRecvIn), fValid(false), fDone(false) {}
+};
+
+/** Signature recovery of one message, as run by CCheckQueue */
+class CMessageVerifyCheck
+{
+private:
+    std::shared_ptr<CMessageVerifyJob> job;
+
+public:
+    CMessageVerifyCheck() {}
+    CMessageVerifyCheck(const std::shared_ptr<CMessageVerifyJob>& jobIn) : job(jobIn) {}
+
+    bool operator()();
+
+    void swap(CMessageVerifyCheck& check)
+    {
+        job.swap(check.job);
+    }
+};
+
+/**
+ * Pool of threads recovering the signing keys of masternode, budget and SwiftX messages.
+ *
+ * The handlers of these messages still run on the message handler thread in the order the
+ * peer sent them, but their signature checks hit the recovered key cache of CHashSigner
+ * instead of doing the ECDSA public key recovery inline, for valid and invalid signatures alike. The workers only deserialize the
+ * message and recover keys, they never touch the masternode list or the budget.
+ *
+ * A dispatcher thread collects up to MAX_MSGVERIFY_BATCH queued messages, verifies them
+ * across the workers of a CCheckQueue and then publishes the whole batch in queue order.
+ */
+class CMessageVerifier
+{
+private:
+    //! Mutex to protect the queue
+    boost::mutex mutex;
+    //! The dispatcher blocks on this when out of work
+    boost::condition_variable condDispatcher;
+    std::deque<std::shared_ptr<CMessageVerifyJob> > queue;
+    std::atomic<int> nThreads;
+    CCheckQueue<CMessageVerifyCheck> checkqueue;
+
+public:
+    CMessageVerifier() : nThreads(0), checkqueue(32) {}
+
+    /** Whether strCommand carries a signature that is recovered by the workers */
+    static bool IsVerifiedCommand(const std::string& strCommand);
+    /** Recover the signing keys of the message of job, leaving job.vRecv untouched, false if any could not be recovered */
+    static bool Verify(const CMessageVerifyJob& job);
+
+    /** Start nThreadsIn workers, messages are verified inline by their handlers when there are none */
+    void Start(boost::thread_group& threadGroup, int nThreadsIn);
+    bool IsEnabled() const { return nThreads > 0; }
+
+    /** Hand the complete messages at the front of the receive queue of pfrom to the workers, requires LOCK(pfrom->cs_vRecvMsg) */
+    void Queue(CNode* pfrom);
+
+    /** Verify the jobs across the workers and mark them done in order, only called by one thread at a time */
+    void VerifyBatch(const std::vector<std::shared_ptr<CMessageVerifyJob> >& vJobs);
+
+    void Thread();
+    void CheckThread();
+};
+
+void ThreadMessageVerify(CMessageVerifier* verifier);
+void ThreadMessageVerifyCheck(CMessageVerifier* verifier);
+
+#endif // MESSAGEVERIFIER_H
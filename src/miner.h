@@ -19,11 +19,14 @@ class CScript;
 class CWallet;
 
 struct CBlockTemplate;
+struct CStagedTransactions;
 
 /** Get reliable pointer to current chain tip */
 CBlockIndex* GetChainTip();
-/** Generate a new block, without valid proof-of-work */
-CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet, bool fProofOfStake);
+/** Select the memory pool transactions for a new block on top of pindexPrev */
+void SelectBlockTransactions(CStagedTransactions& selection, const CBlockIndex* pindexPrev);
+/** Generate a new block, without valid proof-of-work. Uses the transactions of pstaged if they were selected on the same tip */
+CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet, bool fProofOfStake, const CStagedTransactions* pstaged = nullptr);
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 /** Check mined block */
@@ -48,4 +51,19 @@ struct CBlockTemplate {
     std::vector<int64_t> vTxSigOps;
 };
 
+/** Memory pool transactions selected ahead of time for a block on top of hashPrevBlock */
+struct CStagedTransactions {
+    uint256 hashPrevBlock;
+    unsigned int nTransactionsUpdated;
+    std::vector<CTransaction> vtx;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+    CAmount nFees;
+
+    CStagedTransactions() { SetNull(); }
+    void SetNull();
+    /** Whether the selection was made on top of pindexPrev and the memory pool hasn't changed since */
+    bool IsCurrent(const CBlockIndex* pindexPrev) const;
+};
+
 #endif // BITCOIN_MINER_H
@@ -33,6 +33,10 @@
 #include <miniupnpc/upnperrors.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -58,6 +62,10 @@
 namespace
 {
 const int MAX_OUTBOUND_CONNECTIONS = 16;
+// Maximum number of readiness notifications fetched by a single epoll_wait call
+const int MAX_SOCKET_EVENTS = 1024;
+// Frequency in milliseconds to poll pnode->vSend when no socket is ready
+const int SOCKET_WAIT_TIMEOUT = 50;
 
 struct ListenSocket {
     SOCKET socket;
@@ -79,6 +87,9 @@ static bool vfLimited[NET_MAX] = {};
 static CNode* pnodeLocalHost = NULL;
 uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
+#ifdef USE_EPOLL
+static int hEpollSocket = -1;
+#endif
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
 bool fAddressesInitialized = false;
@@ -868,9 +879,217 @@ void CheckOffsetDisconnectedPeers(const CNetAddr& ip)
 
 static std::list<CNode*> vNodesDisconnected;
 
+namespace
+{
+/** What ThreadSocketHandler waits for on the socket of a node in one iteration */
+struct SocketInterest {
+    CNode* pnode;
+    SOCKET hSocket;
+    bool fRecv;
+    bool fSend;
+
+    SocketInterest(CNode* pnodeIn) : pnode(pnodeIn), hSocket(pnodeIn->hSocket), fRecv(false), fSend(false) {}
+};
+}
+
+#ifdef USE_EPOLL
+/**
+ * Sockets stay registered with edge-triggered readiness from their first wait until they are
+ * closed, so a wakeup only costs the sockets that became ready since the last one. The
+ * readiness flags are cleared by the receive and send code once the socket would block.
+ */
+static void WaitForSocketEventsEpoll(const std::vector<SocketInterest>& vInterest, std::set<SOCKET>& setListenReady, int nTimeout)
+{
+    for (const SocketInterest& interest : vInterest) {
+        CNode* pnode = interest.pnode;
+        if (pnode->fSocketRegistered)
+            continue;
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = pnode;
+        // the descriptor may have been reused after another thread closed the socket of a
+        // disconnecting node; take over the registration in that case
+        if (epoll_ctl(hEpollSocket, EPOLL_CTL_ADD, interest.hSocket, &event) == SOCKET_ERROR &&
+            (errno != EEXIST || epoll_ctl(hEpollSocket, EPOLL_CTL_MOD, interest.hSocket, &event) == SOCKET_ERROR)) {
+            LogPrintf("socket epoll_ctl error %s, disconnecting peer=%d\n", NetworkErrorString(errno), pnode->id);
+            pnode->CloseSocketDisconnect();
+            continue;
+        }
+        pnode->fSocketRegistered = true;
+    }
+
+    struct epoll_event events[MAX_SOCKET_EVENTS];
+    int nEvents = epoll_wait(hEpollSocket, events, MAX_SOCKET_EVENTS, nTimeout);
+    if (nEvents == SOCKET_ERROR) {
+        if (errno != EINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+            MilliSleep(nTimeout);
+        }
+        return;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        bool fListenSocket = false;
+        for (ListenSocket& hListenSocket : vhListenSocket) {
+            if (events[i].data.ptr == &hListenSocket) {
+                setListenReady.insert(hListenSocket.socket);
+                fListenSocket = true;
+            }
+        }
+        if (fListenSocket)
+            continue;
+
+        // Nodes are only deleted by ThreadSocketHandler after their socket was closed, which
+        // also drops it from the epoll set, so the pointer is still valid here
+        CNode* pnode = static_cast<CNode*>(events[i].data.ptr);
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            pnode->fSocketReadable = true;
+        if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            pnode->fSocketWritable = true;
+    }
+}
+#endif
+
+/** Wait up to nTimeout milliseconds for the sockets of the nodes and the listening sockets to become ready */
+static void WaitForSocketEvents(const std::vector<SocketInterest>& vInterest, std::set<SOCKET>& setListenReady, int nTimeout)
+{
+#ifdef USE_EPOLL
+    if (hEpollSocket != -1) {
+        WaitForSocketEventsEpoll(vInterest, setListenReady, nTimeout);
+        return;
+    }
+#endif
+
+    // The fallbacks are level-triggered and report readiness afresh every time
+    for (const SocketInterest& interest : vInterest) {
+        interest.pnode->fSocketReadable = false;
+        interest.pnode->fSocketWritable = false;
+    }
+
+#ifdef USE_POLL
+    std::vector<struct pollfd> vPollFds;
+    vPollFds.reserve(vhListenSocket.size() + vInterest.size());
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        struct pollfd pollfd = {};
+        pollfd.fd = hListenSocket.socket;
+        pollfd.events = POLLIN;
+        vPollFds.push_back(pollfd);
+    }
+    for (const SocketInterest& interest : vInterest) {
+        struct pollfd pollfd = {};
+        pollfd.fd = interest.hSocket;
+        pollfd.events = (interest.fRecv ? POLLIN : 0) | (interest.fSend ? POLLOUT : 0);
+        vPollFds.push_back(pollfd);
+    }
+
+    if (poll(vPollFds.data(), vPollFds.size(), nTimeout) == SOCKET_ERROR) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket poll error %s\n", NetworkErrorString(nErr));
+            MilliSleep(nTimeout);
+        }
+        return;
+    }
+
+    size_t i = 0;
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        if (vPollFds[i++].revents & POLLIN)
+            setListenReady.insert(hListenSocket.socket);
+    }
+    for (const SocketInterest& interest : vInterest) {
+        short revents = vPollFds[i++].revents;
+        if (revents & (POLLIN | POLLHUP | POLLERR))
+            interest.pnode->fSocketReadable = true;
+        if (revents & (POLLOUT | POLLHUP | POLLERR))
+            interest.pnode->fSocketWritable = true;
+    }
+#else
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = nTimeout * 1000;
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+    for (const SocketInterest& interest : vInterest) {
+        // select() can only wait on descriptors below FD_SETSIZE, which is also what the
+        // connection count was sized against when neither poll() nor epoll is available
+        if (!IsSelectableSocket(interest.hSocket)) {
+            LogPrintf("socket %d not selectable (fd >= FD_SETSIZE ?), disconnecting peer=%d\n", interest.hSocket, interest.pnode->id);
+            interest.pnode->CloseSocketDisconnect();
+            continue;
+        }
+        FD_SET(interest.hSocket, &fdsetError);
+        if (interest.fRecv)
+            FD_SET(interest.hSocket, &fdsetRecv);
+        if (interest.fSend)
+            FD_SET(interest.hSocket, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, interest.hSocket);
+        have_fds = true;
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+        &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        MilliSleep(nTimeout);
+    }
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        if (FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            setListenReady.insert(hListenSocket.socket);
+    }
+    for (const SocketInterest& interest : vInterest) {
+        if (!IsSelectableSocket(interest.hSocket))
+            continue;
+        if (FD_ISSET(interest.hSocket, &fdsetRecv) || FD_ISSET(interest.hSocket, &fdsetError))
+            interest.pnode->fSocketReadable = true;
+        if (FD_ISSET(interest.hSocket, &fdsetSend))
+            interest.pnode->fSocketWritable = true;
+    }
+#endif
+}
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+#ifdef USE_EPOLL
+    hEpollSocket = epoll_create1(EPOLL_CLOEXEC);
+    if (hEpollSocket == -1) {
+#ifdef USE_POLL
+        LogPrintf("socket epoll_create1 error %s, falling back to poll()\n", NetworkErrorString(errno));
+#else
+        LogPrintf("socket epoll_create1 error %s, falling back to select()\n", NetworkErrorString(errno));
+#endif
+    } else {
+        // listening sockets stay level-triggered, one connection is accepted per wakeup
+        for (ListenSocket& hListenSocket : vhListenSocket) {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = &hListenSocket;
+            if (epoll_ctl(hEpollSocket, EPOLL_CTL_ADD, hListenSocket.socket, &event) == SOCKET_ERROR)
+                LogPrintf("socket epoll_ctl error %s on listening socket\n", NetworkErrorString(errno));
+        }
+    }
+#endif
     while (true) {
         //
         // Disconnect nodes
@@ -936,86 +1155,64 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
+        std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes) {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
+            vNodesCopy = vNodes;
+            for (CNode* pnode : vNodesCopy)
+                pnode->AddRef();
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-            &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
+        std::vector<SocketInterest> vInterest;
+        vInterest.reserve(vNodesCopy.size());
+        bool fPending = false;
+        for (CNode* pnode : vNodesCopy) {
+            SocketInterest interest(pnode);
+            if (interest.hSocket == INVALID_SOCKET)
+                continue;
 
-        if (nSelect == SOCKET_ERROR) {
-            if (have_fds) {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
+            // Implement the following logic:
+            // * If there is data to send, wait for the socket to become writable. As this
+            //   only happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is no (complete) message in the receive buffer,
+            //   or there is space left in the buffer, wait for data to receive.
+            // * (if neither of the above applies, there is certainly one message
+            //   in the receiver buffer ready to be processed).
+            // Together, that means that at least one of the following is always possible,
+            // so we don't deadlock:
+            // * We send some data.
+            // * We wait for data to be received (and disconnect after timeout).
+            // * We process a message in the buffer (message handler thread).
+            {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend && !pnode->vSendMsg.empty())
+                    interest.fSend = true;
+            }
+            if (!interest.fSend) {
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                                    pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                    interest.fRecv = true;
             }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec / 1000);
+
+            // Edge-triggered readiness left over from an earlier wakeup is serviced without waiting
+            if ((interest.fRecv && pnode->fSocketReadable) || (interest.fSend && pnode->fSocketWritable))
+                fPending = true;
+            vInterest.push_back(interest);
         }
 
+        std::set<SOCKET> setListenReady;
+        WaitForSocketEvents(vInterest, setListenReady, fPending ? 0 : SOCKET_WAIT_TIMEOUT);
+        boost::this_thread::interruption_point();
+
         //
         // Accept new connections
         //
         for (const ListenSocket& hListenSocket : vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
+            if (hListenSocket.socket != INVALID_SOCKET && setListenReady.count(hListenSocket.socket)) {
                 struct sockaddr_storage sockaddr;
                 socklen_t len = sizeof(sockaddr);
                 SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
@@ -1063,22 +1260,16 @@ void ThreadSocketHandler()
         //
         // Service each socket
         //
-        std::vector<CNode*> vNodesCopy;
-        {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy)
-                pnode->AddRef();
-        }
-        for (CNode* pnode : vNodesCopy) {
+        for (const SocketInterest& interest : vInterest) {
             boost::this_thread::interruption_point();
+            CNode* pnode = interest.pnode;
 
             //
             // Receive
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
+            if (interest.fRecv && pnode->fSocketReadable) {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv) {
                     {
@@ -1105,6 +1296,9 @@ void ThreadSocketHandler()
                                 pnode->CloseSocketDisconnect();
                             }
                         }
+                        // a short read drained the socket, wait for the next notification
+                        if (nBytes < (int)sizeof(pchBuf))
+                            pnode->fSocketReadable = false;
                     }
                 }
             }
@@ -1114,10 +1308,14 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend)) {
+            if (interest.fSend && pnode->fSocketWritable) {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
+                if (lockSend) {
                     SocketSendData(pnode);
+                    // the socket buffer is full, wait for the next notification
+                    if (!pnode->vSendMsg.empty())
+                        pnode->fSocketWritable = false;
+                }
             }
 
             //
@@ -1569,7 +1767,7 @@ void ThreadMessageHandler()
                         pnode->CloseSocketDisconnect();
 
                     if (pnode->nSendSize < SendBufferSize()) {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete())) {
+                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete() && !pnode->vRecvMsg[0].verifying())) {
                             fSleep = false;
                         }
                     }
@@ -1833,6 +2031,12 @@ public:
             if (hListenSocket.socket != INVALID_SOCKET)
                 if (!CloseSocket(hListenSocket.socket))
                     LogPrintf("CloseSocket(hListenSocket) failed with error %s\n", NetworkErrorString(WSAGetLastError()));
+#ifdef USE_EPOLL
+        if (hEpollSocket != -1) {
+            close(hEpollSocket);
+            hEpollSocket = -1;
+        }
+#endif
 
         // clean up some globals (to help leak detection)
         for (CNode* pnode : vNodes)
@@ -2099,6 +2303,9 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fSocketReadable = false;
+    fSocketWritable = false;
+    fSocketRegistered = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -2106,6 +2313,8 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
+    fSupportsCompactBlocks = false;
+    fPreferCompactBlocks = false;
     setInventoryKnown.max_size(SendBufferSize() / 1000);
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
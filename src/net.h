@@ -11,6 +11,7 @@
 #include "compat.h"
 #include "hash.h"
 #include "limitedmap.h"
+#include "messageverifier.h"
 #include "mruset.h"
 #include "netbase.h"
 #include "protocol.h"
@@ -142,6 +143,7 @@ extern int nMaxConnections;
 
 extern std::vector<CNode*> vNodes;
 extern RecursiveMutex cs_vNodes;
+extern boost::condition_variable messageHandlerCondition;
 extern std::map<CInv, CDataStream> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern RecursiveMutex cs_mapRelay;
@@ -201,6 +203,9 @@ public:
 
     int64_t nTime; // time (in microseconds) of message receipt.
 
+    // signature recovery by the message verification threads, if any
+    std::shared_ptr<CMessageVerifyJob> verifyJob;
+
     CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn)
     {
         hdrbuf.resize(24);
@@ -217,6 +222,11 @@ public:
         return (hdr.nMessageSize == nDataPos);
     }
 
+    bool verifying() const
+    {
+        return verifyJob && !verifyJob->fDone;
+    }
+
     void SetVersion(int nVersionIn)
     {
         hdrbuf.SetVersion(nVersionIn);
@@ -330,11 +340,20 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    // Socket readiness as last reported to ThreadSocketHandler, only touched by that thread.
+    // With epoll these stay set until a read or write on the socket would block.
+    bool fSocketReadable;
+    bool fSocketWritable;
+    bool fSocketRegistered;
     // We use fRelayTxes for two purposes -
     // a) it allows us to not relay tx invs before receiving the peer's version message
     // b) the peer may tell us in their version message that we should not relay tx invs
     //    until they have initialized their bloom filter.
     bool fRelayTxes;
+    // Set when the peer sent "sendcmpct": it can reconstruct compact blocks, and with
+    // fPreferCompactBlocks it wants new blocks pushed as "cmpctblock" without an inv first.
+    bool fSupportsCompactBlocks;
+    bool fPreferCompactBlocks;
     // Should be 'true' only if we connected to this node to actually mix funds.
     // In this case node will be released automatically via CMasternodeMan::ProcessMasternodeConnections().
     // Connecting to verify connectability/status or connecting for sending/relaying single message
@@ -605,18 +605,19 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         throw std::runtime_error(
             "gettxoutsetinfo\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
 
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions, deprecated: only returned with -deprecatedrpc=gettxoutsetinfo\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"muhash\": \"hash\",      (string) The rolling hash of the set of outputs\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
+            "\"hash_serialized\" was replaced by \"muhash\". \"transactions\" needs a scan of the whole set,\n"
+            "it will be removed in a future version.\n"
 
             "\nExamples:\n" +
             HelpExampleCli("gettxoutsetinfo", "") + HelpExampleRpc("gettxoutsetinfo", ""));
@@ -625,20 +626,121 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 
     UniValue ret(UniValue::VOBJ);
 
+    // the statistics are kept up to date with the tip, no need to flush or scan the set
     CCoinsStats stats;
-    FlushStateToDisk();
     if (pcoinsTip->GetStats(stats)) {
-        ret.push_back(Pair("height", (int64_t)stats.nHeight));
-        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
-        ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+        uint256 hashBlock = pcoinsTip->GetBestBlock();
+        BlockMap::const_iterator it = mapBlockIndex.find(hashBlock);
+        uint256 hashMuHash;
+        stats.muhash.Finalize(hashMuHash);
+        ret.push_back(Pair("height", it == mapBlockIndex.end() ? -1 : (int64_t)it->second->nHeight));
+        ret.push_back(Pair("bestblock", hashBlock.GetHex()));
+        if (IsDeprecatedRPCEnabled("gettxoutsetinfo")) {
+            // not kept with the statistics, a spend can't tell whether it was the last output of its transaction
+            uint64_t nTransactions = 0;
+            FlushStateToDisk();
+            if (!pcoinsdbview->CountTransactions(nTransactions))
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read the coin database");
+            ret.push_back(Pair("transactions", (int64_t)nTransactions));
+        }
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
-        ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        ret.push_back(Pair("muhash", hashMuHash.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     }
     return ret;
 }
 
+UniValue getcoinscacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getcoinscacheinfo\n"
+            "\nReturns details on the in-memory cache of the unspent transaction output set.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": n,      (numeric) The number of cached outputs\n"
+            "  \"usage\": n,        (numeric) The memory used by the cache, in bytes\n"
+            "  \"maxusage\": n,     (numeric) The memory the cache may use before it is flushed, in bytes\n"
+            "  \"hits\": n,         (numeric) The lookups served by the cache since startup\n"
+            "  \"misses\": n,       (numeric) The lookups passed on to the coin database since startup\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getcoinscacheinfo", "") + HelpExampleRpc("getcoinscacheinfo", ""));
+
+    LOCK(cs_main);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", (int64_t)pcoinsTip->GetCacheSize()));
+    ret.push_back(Pair("usage", (int64_t)pcoinsTip->DynamicMemoryUsage()));
+    ret.push_back(Pair("maxusage", (int64_t)nCoinCacheUsage));
+    ret.push_back(Pair("hits", (int64_t)pcoinsTip->GetCacheHits()));
+    ret.push_back(Pair("misses", (int64_t)pcoinsTip->GetCacheMisses()));
+    return ret;
+}
+
+UniValue getleveldbinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getleveldbinfo\n"
+            "\nReturns the configuration and compaction statistics of the LevelDB databases.\n"
+
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\": \"name\",        (string) The database: chainstate, blockindex, zerocoin or sporks\n"
+            "    \"cache\": n,            (numeric) The size of the block cache, in bytes\n"
+            "    \"writebuffer\": n,      (numeric) The size of the write buffer, in bytes\n"
+            "    \"maxopenfiles\": n,     (numeric) The number of table files kept open\n"
+            "    \"blocksize\": n,        (numeric) The size of the blocks of the tables, in bytes\n"
+            "    \"compression\": true|false, (boolean) Whether the blocks are compressed with snappy\n"
+            "    \"usage\": n,            (numeric) The approximate memory used by the database, in bytes\n"
+            "    \"levels\": [            (array) The levels with files or compactions\n"
+            "      {\n"
+            "        \"level\": n,        (numeric) The level\n"
+            "        \"files\": n,        (numeric) The number of table files\n"
+            "        \"size\": x.x,       (numeric) The size of the files, in megabytes\n"
+            "        \"time\": x.x,       (numeric) The time spent compacting into the level, in seconds\n"
+            "        \"read\": x.x,       (numeric) The data read by these compactions, in megabytes\n"
+            "        \"written\": x.x     (numeric) The data written by these compactions, in megabytes\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  }, ...\n"
+            "]\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getleveldbinfo", "") + HelpExampleRpc("getleveldbinfo", ""));
+
+    UniValue ret(UniValue::VARR);
+    for (const CLevelDBInfo& info : CLevelDBWrapper::GetOpenDBInfo()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("name", info.strName));
+        obj.push_back(Pair("cache", (int64_t)info.nCacheSize));
+        obj.push_back(Pair("writebuffer", (int64_t)info.nWriteBufferSize));
+        obj.push_back(Pair("maxopenfiles", info.nMaxOpenFiles));
+        obj.push_back(Pair("blocksize", (int64_t)info.nBlockSize));
+        obj.push_back(Pair("compression", info.fCompression));
+        obj.push_back(Pair("usage", (int64_t)info.nMemoryUsage));
+        UniValue levels(UniValue::VARR);
+        for (const CLevelDBLevelStats& level : info.vLevels) {
+            UniValue objLevel(UniValue::VOBJ);
+            objLevel.push_back(Pair("level", level.nLevel));
+            objLevel.push_back(Pair("files", level.nFiles));
+            objLevel.push_back(Pair("size", level.nSizeMB));
+            objLevel.push_back(Pair("time", level.nTimeSec));
+            objLevel.push_back(Pair("read", level.nReadMB));
+            objLevel.push_back(Pair("written", level.nWriteMB));
+            levels.push_back(objLevel);
+        }
+        obj.push_back(Pair("levels", levels));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -666,7 +768,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -689,33 +790,32 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin) || coin.IsSpent())
             return NullUniValue;
     }
-    if (n < 0 || (unsigned int)n >= coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex* pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if ((unsigned int)coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", pindex->nHeight - coin.nHeight + 1));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", coin.fCoinBase));
 
     return ret;
 }
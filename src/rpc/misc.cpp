@@ -608,6 +608,7 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
             "  \"lastattempt_hash\": xxx            (hex string) hash of the block on top of which the last stake attempt was made\n"
             "  \"lastattempt_coins\": n             (numeric) number of stakeable coins available during last stake attempt\n"
             "  \"lastattempt_tries\": n             (numeric) number of stakeable coins checked during last stake attempt\n"
+            "  \"lastattempt_hashrate\": n          (numeric) kernel hashes per second of the last kernel search\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -626,9 +627,9 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
         obj.push_back(Pair("haveconnections", !vNodes.empty()));
         obj.push_back(Pair("mnsync", !masternodeSync.NotCompleted()));
         obj.push_back(Pair("walletunlocked", !pwalletMain->IsLocked()));
-        std::vector<COutput> vCoins;
-        pwalletMain->StakeableCoins(&vCoins);
-        obj.push_back(Pair("stakeablecoins", (int)vCoins.size()));
+        std::vector<CStakeCandidate> vCandidates;
+        pwalletMain->GetStakeCandidates(vCandidates);
+        obj.push_back(Pair("stakeablecoins", (int)vCandidates.size()));
         obj.push_back(Pair("stakingbalance", ValueFromAmount(pwalletMain->GetStakingBalance(fColdStaking))));
         obj.push_back(Pair("stakesplitthreshold", ValueFromAmount(pwalletMain->nStakeSplitThreshold)));
         CStakerStatus* ss = pwalletMain->pStakerStatus;
@@ -638,6 +639,7 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
             obj.push_back(Pair("lastattempt_hash", ss->GetLastHash().GetHex()));
             obj.push_back(Pair("lastattempt_coins", ss->GetLastCoins()));
             obj.push_back(Pair("lastattempt_tries", ss->GetLastTries()));
+            obj.push_back(Pair("lastattempt_hashrate", ss->GetLastHashRate()));
         }
         return obj;
     }
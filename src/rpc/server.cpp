@@ -307,7 +307,9 @@ static const CRPCCommand vRPCCommands[] =
         {"blockchain", "getblockhash", &getblockhash, true, false, false},
         {"blockchain", "getblockheader", &getblockheader, false, false, false},
         {"blockchain", "getchaintips", &getchaintips, true, false, false},
+        {"blockchain", "getcoinscacheinfo", &getcoinscacheinfo, true, false, false},
         {"blockchain", "getdifficulty", &getdifficulty, true, false, false},
+        {"blockchain", "getleveldbinfo", &getleveldbinfo, true, false, false},
         {"blockchain", "getfeeinfo", &getfeeinfo, true, false, false},
         {"blockchain", "getmempoolinfo", &getmempoolinfo, true, true, false},
         {"blockchain", "getrawmempool", &getrawmempool, true, false, false},
@@ -415,6 +417,7 @@ static const CRPCCommand vRPCCommands[] =
         {"wallet", "getstakesplitthreshold", &getstakesplitthreshold, false, false, true},
         {"wallet", "gettransaction", &gettransaction, false, false, true},
         {"wallet", "abandontransaction", &abandontransaction, false, false, true},
+        {"wallet", "abortrescan", &abortrescan, true, false, true},
         {"wallet", "getunconfirmedbalance", &getunconfirmedbalance, false, false, true},
         {"wallet", "getwalletinfo", &getwalletinfo, false, false, true},
         {"wallet", "importprivkey", &importprivkey, true, false, true},
@@ -524,6 +527,12 @@ bool RPCIsInWarmup(std::string* outStatus)
     return fRPCInWarmup;
 }
 
+bool IsDeprecatedRPCEnabled(const std::string& method)
+{
+    const std::vector<std::string>& enabled = mapMultiArgs["-deprecatedrpc"];
+    return std::find(enabled.begin(), enabled.end(), method) != enabled.end();
+}
+
 void JSONRequest::parse(const UniValue& valRequest)
 {
     // Parse request
@@ -9,6 +9,74 @@
 #include "txdb.h"
 #include "wallet/wallet.h"
 
+// Outputs of the coinstake paying back to the script of the kernel, split by the stake split threshold
+static bool CreateStakeTxOuts(CWallet* pwallet, const CScript& scriptPubKeyKernel, std::vector<CTxOut>& vout, CAmount nTotal)
+{
+    std::vector<valtype> vSolutions;
+    txnouttype whichType;
+    if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
+        return error("%s: failed to parse kernel", __func__);
+
+    if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH && whichType != TX_COLDSTAKE)
+        return error("%s: type=%d (%s) not supported for scriptPubKeyKernel", __func__, whichType, GetTxnOutputType(whichType));
+
+    CScript scriptPubKey;
+    CKey key;
+    if (whichType == TX_PUBKEYHASH) {
+        // if P2PKH check that we have the input private key
+        if (!pwallet->GetKey(CKeyID(uint160(vSolutions[0])), key))
+            return error("%s: Unable to get staking private key", __func__);
+
+        // convert to P2PK inputs
+        scriptPubKey << key.GetPubKey() << OP_CHECKSIG;
+
+    } else {
+        // if P2CS, check that we have the coldstaking private key
+        if ( whichType == TX_COLDSTAKE && !pwallet->GetKey(CKeyID(uint160(vSolutions[0])), key) )
+            return error("%s: Unable to get cold staking private key", __func__);
+
+        // keep the same script
+        scriptPubKey = scriptPubKeyKernel;
+    }
+
+    vout.emplace_back(CTxOut(0, scriptPubKey));
+
+    // Calculate if we need to split the output
+    if (pwallet->nStakeSplitThreshold > 0) {
+        int nSplit = static_cast<int>(nTotal / pwallet->nStakeSplitThreshold);
+        if (nSplit > 1) {
+            // if nTotal is twice or more of the threshold; create more outputs
+            int txSizeMax = MAX_STANDARD_TX_SIZE >> 11; // limit splits to <10% of the max TX size (/2048)
+            if (nSplit > txSizeMax)
+                nSplit = txSizeMax;
+            for (int i = nSplit; i > 1; i--) {
+                LogPrintf("%s: StakeSplit: nTotal = %d; adding output %d of %d\n", __func__, nTotal, (nSplit-i)+2, nSplit);
+                vout.emplace_back(CTxOut(0, scriptPubKey));
+            }
+        }
+    }
+
+    return true;
+}
+
+// Stake contextual checks for an input confirmed in pindexFrom
+static bool CheckStakeContext(const CBlockIndex* pindexFrom, int nHeight, uint32_t nTime)
+{
+    const Consensus::Params& consensus = Params().GetConsensus();
+    if (!pindexFrom)
+        return error("%s: unable to get previous index for stake input", __func__);
+    const int nHeightBlockFrom = pindexFrom->nHeight;
+    const uint32_t nTimeBlockFrom = pindexFrom->nTime;
+
+    // Check that the stake has the required depth/age
+    if (nHeight >= consensus.height_RHF - 1 &&
+            !consensus.HasStakeMinAgeOrDepth(nHeight, nTime, nHeightBlockFrom, nTimeBlockFrom))
+        return error("%s : min age violation - height=%d - time=%d, nHeightBlockFrom=%d, nTimeBlockFrom=%d",
+                         __func__, nHeight, nTime, nHeightBlockFrom, nTimeBlockFrom);
+    // All good
+    return true;
+}
+
 bool CPivStake::InitFromTxIn(const CTxIn& txin)
 {
     // Find the previous transaction in database
@@ -59,52 +127,7 @@ CAmount CPivStake::GetValue() const
 
 bool CPivStake::CreateTxOuts(CWallet* pwallet, std::vector<CTxOut>& vout, CAmount nTotal)
 {
-    std::vector<valtype> vSolutions;
-    txnouttype whichType;
-    CScript scriptPubKeyKernel = txFrom.vout[nPosition].scriptPubKey;
-    if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
-        return error("%s: failed to parse kernel", __func__);
-
-    if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH && whichType != TX_COLDSTAKE)
-        return error("%s: type=%d (%s) not supported for scriptPubKeyKernel", __func__, whichType, GetTxnOutputType(whichType));
-
-    CScript scriptPubKey;
-    CKey key;
-    if (whichType == TX_PUBKEYHASH) {
-        // if P2PKH check that we have the input private key
-        if (!pwallet->GetKey(CKeyID(uint160(vSolutions[0])), key))
-            return error("%s: Unable to get staking private key", __func__);
-
-        // convert to P2PK inputs
-        scriptPubKey << key.GetPubKey() << OP_CHECKSIG;
-
-    } else {
-        // if P2CS, check that we have the coldstaking private key
-        if ( whichType == TX_COLDSTAKE && !pwallet->GetKey(CKeyID(uint160(vSolutions[0])), key) )
-            return error("%s: Unable to get cold staking private key", __func__);
-
-        // keep the same script
-        scriptPubKey = scriptPubKeyKernel;
-    }
-
-    vout.emplace_back(CTxOut(0, scriptPubKey));
-
-    // Calculate if we need to split the output
-    if (pwallet->nStakeSplitThreshold > 0) {
-        int nSplit = static_cast<int>(nTotal / pwallet->nStakeSplitThreshold);
-        if (nSplit > 1) {
-            // if nTotal is twice or more of the threshold; create more outputs
-            int txSizeMax = MAX_STANDARD_TX_SIZE >> 11; // limit splits to <10% of the max TX size (/2048)
-            if (nSplit > txSizeMax)
-                nSplit = txSizeMax;
-            for (int i = nSplit; i > 1; i--) {
-                LogPrintf("%s: StakeSplit: nTotal = %d; adding output %d of %d\n", __func__, nTotal, (nSplit-i)+2, nSplit);
-                vout.emplace_back(CTxOut(0, scriptPubKey));
-            }
-        }
-    }
-
-    return true;
+    return CreateStakeTxOuts(pwallet, txFrom.vout[nPosition].scriptPubKey, vout, nTotal);
 }
 
 CDataStream CPivStake::GetUniqueness() const
@@ -139,20 +162,41 @@ CBlockIndex* CPivStake::GetIndexFrom()
 // Verify stake contextual checks
 bool CPivStake::ContextCheck(int nHeight, uint32_t nTime)
 {
-    const Consensus::Params& consensus = Params().GetConsensus();
-    // Get Stake input block time/height
-    CBlockIndex* pindexFrom = GetIndexFrom();
-    if (!pindexFrom)
-        return error("%s: unable to get previous index for stake input");
-    const int nHeightBlockFrom = pindexFrom->nHeight;
-    const uint32_t nTimeBlockFrom = pindexFrom->nTime;
+    return CheckStakeContext(GetIndexFrom(), nHeight, nTime);
+}
 
-    // Check that the stake has the required depth/age
-    if (nHeight >= consensus.height_RHF - 1 &&
-            !consensus.HasStakeMinAgeOrDepth(nHeight, nTime, nHeightBlockFrom, nTimeBlockFrom))
-        return error("%s : min age violation - height=%d - time=%d, nHeightBlockFrom=%d, nTimeBlockFrom=%d",
-                         __func__, nHeight, nTime, nHeightBlockFrom, nTimeBlockFrom);
-    // All good
+CStakeCandidate::CStakeCandidate(const COutPoint& outpointIn, const CTxOut& txOutIn, CBlockIndex* pindexFromIn):
+    outpoint(outpointIn),
+    txOut(txOutIn)
+{
+    pindexFrom = pindexFromIn;
+    // Same identifier as the one of CPivStake
+    uniqueness << outpoint.n << outpoint.hash;
+}
+
+bool CStakeCandidate::InitFromTxIn(const CTxIn& txin)
+{
+    // Candidates are only built from wallet outputs
+    return error("%s : not supported", __func__);
+}
+
+bool CStakeCandidate::GetTxFrom(CTransaction& tx) const
+{
+    return false;
+}
+
+bool CStakeCandidate::CreateTxIn(CWallet* pwallet, CTxIn& txIn, uint256 hashTxOut)
+{
+    txIn = CTxIn(outpoint);
     return true;
 }
 
+bool CStakeCandidate::CreateTxOuts(CWallet* pwallet, std::vector<CTxOut>& vout, CAmount nTotal)
+{
+    return CreateStakeTxOuts(pwallet, txOut.scriptPubKey, vout, nTotal);
+}
+
+bool CStakeCandidate::ContextCheck(int nHeight, uint32_t nTime)
+{
+    return CheckStakeContext(pindexFrom, nHeight, nTime);
+}
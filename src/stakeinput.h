@@ -52,5 +52,34 @@ public:
     bool ContextCheck(int nHeight, uint32_t nTime) override;
 };
 
+/**
+ * A wallet output able to stake, with the outpoint, value, origin block and
+ * kernel uniqueness precomputed, so that the kernel search needs neither the
+ * previous transaction nor a lookup on disk.
+ */
+class CStakeCandidate : public CStakeInput
+{
+private:
+    COutPoint outpoint;
+    CTxOut txOut;
+    CDataStream uniqueness{CDataStream(SER_NETWORK, 0)};
+
+public:
+    CStakeCandidate(const COutPoint& outpointIn, const CTxOut& txOutIn, CBlockIndex* pindexFromIn);
+
+    const COutPoint& GetOutPoint() const { return outpoint; }
+    const CTxOut& GetTxOut() const { return txOut; }
+    void SetIndexFrom(CBlockIndex* pindex) { pindexFrom = pindex; }
+
+    bool InitFromTxIn(const CTxIn& txin) override;
+    CBlockIndex* GetIndexFrom() override { return pindexFrom; }
+    bool GetTxFrom(CTransaction& tx) const override;
+    CAmount GetValue() const override { return txOut.nValue; }
+    CDataStream GetUniqueness() const override { return uniqueness; }
+    bool CreateTxIn(CWallet* pwallet, CTxIn& txIn, uint256 hashTxOut = UINT256_ZERO) override;
+    bool CreateTxOuts(CWallet* pwallet, std::vector<CTxOut>& vout, CAmount nTotal) override;
+    bool ContextCheck(int nHeight, uint32_t nTime) override;
+};
+
 
 #endif //DIGIWAGE_STAKEINPUT_H
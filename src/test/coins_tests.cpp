@@ -5,52 +5,67 @@
 
 #include "coins.h"
 #include "script/standard.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "utilstrencodings.h"
 #include "test/test_digiwage.h"
 
+#include <limits>
 #include <vector>
 #include <map>
 
 #include <boost/test/unit_test.hpp>
 
+bool operator==(const Coin& a, const Coin& b)
+{
+    // Empty Coin objects are always equal.
+    if (a.IsSpent() && b.IsSpent()) return true;
+    return a.fCoinBase == b.fCoinBase &&
+           a.fCoinStake == b.fCoinStake &&
+           a.nHeight == b.nHeight &&
+           a.out == b.out;
+}
+
 namespace
 {
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
 
 public:
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && InsecureRandBool() == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && InsecureRandBool() == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
+    bool HaveCoin(const COutPoint& outpoint) const
     {
-        CCoins coins;
-        return GetCoins(txid, coins);
+        Coin coin;
+        return GetCoin(outpoint, coin);
     }
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, const CCoinsStats& stats)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
-            map_[it->first] = it->second.coins;
-            if (it->second.coins.IsPruned() && InsecureRandRange(3) == 0) {
-                // Randomly delete empty entries on write.
-                map_.erase(it->first);
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                // Same optimization used in CCoinsViewDB is to only write dirty entries.
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && InsecureRandRange(3) == 0) {
+                    // Randomly delete empty entries on write.
+                    map_.erase(it->first);
+                }
             }
             mapCoins.erase(it++);
         }
@@ -61,6 +76,44 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    // The memory accounted for must be that of the cached coins
+    void SelfTest() const
+    {
+        size_t ret = memusage::DynamicUsage(cacheCoins);
+        for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++)
+            ret += it->second.coin.DynamicMemoryUsage();
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
+
+// A coin database in memory, into which the records of older versions can be written
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+
+    void WriteLegacyCoins(const uint256& txid, std::vector<unsigned char> vchCoins)
+    {
+        BOOST_CHECK(db.Write(std::make_pair('c', txid), CFlatData(vchCoins)));
+    }
+
+    bool HaveLegacyCoins(const uint256& txid) const
+    {
+        return db.Exists(std::make_pair('c', txid));
+    }
+
+    void EraseStats()
+    {
+        BOOST_CHECK(Sync());
+        BOOST_CHECK(db.Erase('S'));
+    }
+};
 }
 
 BOOST_FIXTURE_TEST_SUITE(coins_tests, BasicTestingSetup)
@@ -70,9 +123,10 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
+// It will randomly create/update/delete Coin entries to a tip of caches, with
 // txids picked from a limited list of random 256-bit hashes. Occasionally, a
-// new tip is added to the stack of caches, or the tip is flushed and removed.
+// new tip is added to the stack of caches, the tip is flushed and removed, or
+// it is flushed partially and trimmed.
 //
 // During the process, booleans are kept to make sure that the randomized
 // operation hits all branches.
@@ -82,18 +136,20 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool removed_all_caches = false;
     bool reached_4_caches = false;
     bool added_an_entry = false;
+    bool added_an_unspendable_entry = false;
     bool removed_an_entry = false;
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool trimmed_a_cache = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -106,43 +162,59 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         // Do a random modification.
         {
             uint256 txid = txids[InsecureRandRange(txids.size())]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (InsecureRandRange(5) == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
-                    added_an_entry = true;
+            Coin& coin = result[COutPoint(txid, 0)];
+            const Coin& entry = (InsecureRandRange(500) == 0) ? AccessByTxid(*stack.back(), txid) : stack.back()->AccessCoin(COutPoint(txid, 0));
+            BOOST_CHECK(coin == entry);
+
+            if (InsecureRandRange(5) == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.out.nValue = InsecureRand32();
+                newcoin.nHeight = 1;
+                if (InsecureRandRange(16) == 0 && coin.IsSpent()) {
+                    newcoin.out.scriptPubKey.assign(1 + InsecureRandBits(6), OP_RETURN);
+                    BOOST_CHECK(newcoin.out.scriptPubKey.IsUnspendable());
+                    added_an_unspendable_entry = true;
                 } else {
-                    updated_an_entry = true;
+                    newcoin.out.scriptPubKey.assign(InsecureRandBits(6), 0);
+                    (coin.IsSpent() ? added_an_entry : updated_an_entry) = true;
+                    coin = newcoin;
                 }
-                coins.nVersion = InsecureRand32();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = InsecureRand32();
-                *entry = coins;
+                stack.back()->AddCoin(COutPoint(txid, 0), std::move(newcoin), !coin.IsSpent() || InsecureRandBool());
             } else {
-                coins.Clear();
-                entry->Clear();
                 removed_an_entry = true;
+                coin.Clear();
+                stack.back()->SpendCoin(COutPoint(txid, 0));
             }
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (InsecureRandRange(1000) == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (const CCoinsViewCacheTest* test : stack)
+                test->SelfTest();
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    BOOST_CHECK(stack.back()->HaveCoinInCache(it->first));
+                    found_an_entry = true;
                 }
             }
         }
 
         if (InsecureRandRange(100) == 0) {
             // Every 100 iterations, change the cache stack.
-            if (stack.size() > 0 && InsecureRandBool() == 0) {
+            if (stack.size() > 0 && InsecureRandRange(4) == 0) {
+                // keep the tip, without its modifications and trimmed to a random size
+                size_t nUsage = stack.back()->DynamicMemoryUsage();
+                BOOST_CHECK(stack.back()->PartialFlush(InsecureRandRange(nUsage + 1)));
+                if (stack.back()->DynamicMemoryUsage() < nUsage)
+                    trimmed_a_cache = true;
+                stack.back()->SelfTest();
+            } else if (stack.size() > 0 && InsecureRandBool() == 0) {
                 stack.back()->Flush();
                 delete stack.back();
                 stack.pop_back();
@@ -154,7 +226,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -172,62 +244,99 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(removed_all_caches);
     BOOST_CHECK(reached_4_caches);
     BOOST_CHECK(added_an_entry);
+    BOOST_CHECK(added_an_unspendable_entry);
     BOOST_CHECK(removed_an_entry);
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(trimmed_a_cache);
 }
 
-BOOST_AUTO_TEST_CASE(ccoins_serialization)
+// A partial flush writes the modifications and keeps the coins, trimming the cache to those used recently
+BOOST_AUTO_TEST_CASE(coins_cache_partial_flush)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    std::vector<COutPoint> vOutpoints;
+    for (int i = 0; i < 100; i++) {
+        vOutpoints.push_back(COutPoint(InsecureRand256(), 0));
+        cache.AddCoin(vOutpoints.back(), Coin(CTxOut(i + 1, CScript() << OP_TRUE), 1, false, false), false);
+    }
+    BOOST_CHECK(cache.PartialFlush(std::numeric_limits<size_t>::max()));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 100U);
+    for (const COutPoint& outpoint : vOutpoints)
+        BOOST_CHECK(base.HaveCoin(outpoint));
+    cache.SelfTest();
+
+    // all coins were used since the last trim, some have to go anyway
+    BOOST_CHECK(cache.PartialFlush(cache.DynamicMemoryUsage() - 1));
+    BOOST_CHECK(cache.GetCacheSize() < 100U);
+    cache.SelfTest();
+
+    // only the coins used since then are kept
+    uint64_t nLookups = cache.GetCacheHits() + cache.GetCacheMisses();
+    for (int i = 0; i < 10; i++)
+        BOOST_CHECK(!cache.AccessCoin(vOutpoints[i]).IsSpent());
+    BOOST_CHECK_EQUAL(cache.GetCacheHits() + cache.GetCacheMisses(), nLookups + 10);
+    BOOST_CHECK(cache.PartialFlush(cache.DynamicMemoryUsage() - 1));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 10U);
+    for (int i = 0; i < 10; i++)
+        BOOST_CHECK(cache.HaveCoinInCache(vOutpoints[i]));
+    cache.SelfTest();
+
+    // the others are read back from the base
+    uint64_t nMisses = cache.GetCacheMisses();
+    BOOST_CHECK_EQUAL(cache.AccessCoin(vOutpoints[50]).out.nValue, 51);
+    BOOST_CHECK_EQUAL(cache.GetCacheMisses(), nMisses + 1);
+    BOOST_CHECK(cache.SpendCoin(vOutpoints[50]));
+    BOOST_CHECK(cache.PartialFlush(std::numeric_limits<size_t>::max()));
+    Coin coin;
+    BOOST_CHECK(!base.GetCoin(vOutpoints[50], coin) || coin.IsSpent());
+    BOOST_CHECK(!cache.HaveCoinInCache(vOutpoints[50]));
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(coin_serialization)
 {
     // Good example
-    CDataStream ss1(ParseHex("0108835800816115944e077fe7c803cfa57f29b36bf87c1d35b4934b"), SER_DISK, CLIENT_VERSION);
-    CCoins cc1;
+    CDataStream ss1(ParseHex("80d3d12d835800816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    Coin cc1;
     ss1 >> cc1;
-    BOOST_CHECK_EQUAL(cc1.nVersion, 1);
     BOOST_CHECK_EQUAL(cc1.fCoinBase, false);
+    BOOST_CHECK_EQUAL(cc1.fCoinStake, true);
     BOOST_CHECK_EQUAL(cc1.nHeight, 870987);
-    BOOST_CHECK_EQUAL(cc1.vout.size(), 2);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(0), false);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(1), true);
-    BOOST_CHECK_EQUAL(cc1.vout[1].nValue, 60000000000ULL);
-    BOOST_CHECK_EQUAL(HexStr(cc1.vout[1].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+    BOOST_CHECK_EQUAL(cc1.out.nValue, 60000000000ULL);
+    BOOST_CHECK_EQUAL(HexStr(cc1.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
 
     // Good example
-    CDataStream ss2(ParseHex("0111044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa482d21f"), SER_DISK, CLIENT_VERSION);
-    CCoins cc2;
+    CDataStream ss2(ParseHex("8dcb7e86ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4ee"), SER_DISK, CLIENT_VERSION);
+    Coin cc2;
     ss2 >> cc2;
-    BOOST_CHECK_EQUAL(cc2.nVersion, 1);
     BOOST_CHECK_EQUAL(cc2.fCoinBase, true);
+    BOOST_CHECK_EQUAL(cc2.fCoinStake, false);
     BOOST_CHECK_EQUAL(cc2.nHeight, 59807);
-    BOOST_CHECK_EQUAL(cc2.vout.size(), 17);
-    for (int i = 0; i < 17; i++) {
-        BOOST_CHECK_EQUAL(cc2.IsAvailable(i), i == 4 || i == 16);
-    }
-    BOOST_CHECK_EQUAL(cc2.vout[4].nValue, 234925952);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[4].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("61b01caab50f1b8e9c50a5057eb43c2d9563a4ee"))))));
-    BOOST_CHECK_EQUAL(cc2.vout[16].nValue, 110397);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[16].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
+    BOOST_CHECK_EQUAL(cc2.out.nValue, 234925952);
+    BOOST_CHECK_EQUAL(HexStr(cc2.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("61b01caab50f1b8e9c50a5057eb43c2d9563a4ee"))))));
 
-    // Smallest possible example
-    CDataStream ssx(SER_DISK, CLIENT_VERSION);
-    BOOST_CHECK_EQUAL(HexStr(ssx.begin(), ssx.end()), "");
+    // Serialization round trip
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << cc2;
+    BOOST_CHECK_EQUAL(HexStr(ss.begin(), ss.end()), "8dcb7e86ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4ee");
 
-    CDataStream ss3(ParseHex("0004000600"), SER_DISK, CLIENT_VERSION);
-    CCoins cc3;
+    // Smallest possible example
+    CDataStream ss3(ParseHex("000006"), SER_DISK, CLIENT_VERSION);
+    Coin cc3;
     ss3 >> cc3;
-    BOOST_CHECK_EQUAL(cc3.nVersion, 0);
     BOOST_CHECK_EQUAL(cc3.fCoinBase, false);
+    BOOST_CHECK_EQUAL(cc3.fCoinStake, false);
     BOOST_CHECK_EQUAL(cc3.nHeight, 0);
-    BOOST_CHECK_EQUAL(cc3.vout.size(), 1);
-    BOOST_CHECK_EQUAL(cc3.IsAvailable(0), true);
-    BOOST_CHECK_EQUAL(cc3.vout[0].nValue, 0);
-    BOOST_CHECK_EQUAL(cc3.vout[0].scriptPubKey.size(), 0);
+    BOOST_CHECK_EQUAL(cc3.out.nValue, 0);
+    BOOST_CHECK_EQUAL(cc3.out.scriptPubKey.size(), 0);
 
     // scriptPubKey that ends beyond the end of the stream
-    CDataStream ss4(ParseHex("0004000800"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss4(ParseHex("000007"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc4;
+        Coin cc4;
         ss4 >> cc4;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
@@ -238,13 +347,148 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     uint64_t x = 3000000000ULL;
     tmp << VARINT(x);
     BOOST_CHECK_EQUAL(HexStr(tmp.begin(), tmp.end()), "8a95c0bb00");
-    CDataStream ss5(ParseHex("0002008a95c0bb0000"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss5(ParseHex("00008a95c0bb00"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc5;
+        Coin cc5;
         ss5 >> cc5;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
     }
 }
 
+// The per-transaction records of older versions are converted to one record per unspent output
+BOOST_AUTO_TEST_CASE(coins_db_upgrade)
+{
+    CCoinsViewDBTest db;
+    const uint256 txid1 = InsecureRand256();
+    const uint256 txid2 = InsecureRand256();
+    // version 1, vout[1] unspent, at height 870987
+    db.WriteLegacyCoins(txid1, ParseHex("0108835800816115944e077fe7c803cfa57f29b36bf87c1d35b4934b"));
+    // version 1, coinbase with vout[4] and vout[16] unspent, at height 59807
+    db.WriteLegacyCoins(txid2, ParseHex("0111044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa482d21f"));
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txid1, 1)));
+
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(!db.HaveLegacyCoins(txid1));
+    BOOST_CHECK(!db.HaveLegacyCoins(txid2));
+
+    Coin coin;
+    BOOST_CHECK(!db.GetCoin(COutPoint(txid1, 0), coin));
+    BOOST_CHECK(db.GetCoin(COutPoint(txid1, 1), coin));
+    BOOST_CHECK_EQUAL(coin.nHeight, 870987);
+    BOOST_CHECK(!coin.fCoinBase && !coin.fCoinStake);
+    BOOST_CHECK_EQUAL(coin.out.nValue, 60000000000ULL);
+    BOOST_CHECK_EQUAL(HexStr(coin.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+
+    for (uint32_t n = 0; n < 17; n++)
+        BOOST_CHECK_EQUAL(db.HaveCoin(COutPoint(txid2, n)), n == 4 || n == 16);
+    BOOST_CHECK(db.GetCoin(COutPoint(txid2, 16), coin));
+    BOOST_CHECK_EQUAL(coin.nHeight, 59807);
+    BOOST_CHECK(coin.fCoinBase);
+    BOOST_CHECK_EQUAL(coin.out.nValue, 110397);
+
+    // nothing is left to convert
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(db.HaveCoin(COutPoint(txid2, 4)));
+}
+
+// The statistics kept up to date through the caches must match those of a full scan of the set
+BOOST_AUTO_TEST_CASE(coins_stats)
+{
+    CCoinsViewDBTest db;
+    BOOST_CHECK(db.Upgrade());
+    std::vector<std::pair<COutPoint, Coin> > vCoins;
+    {
+        CCoinsViewCache cache(&db);
+        CCoinsStats changes;
+        for (int i = 0; i < 200; i++) {
+            CTxOut txout(InsecureRandRange(100 * COIN), CScript() << OP_DUP << OP_HASH160 << ToByteVector(InsecureRand256()));
+            COutPoint outpoint(InsecureRand256(), InsecureRandRange(4));
+            Coin coin(txout, 1 + InsecureRandRange(1000), InsecureRandBool(), false);
+            changes.AddCoin(outpoint, coin);
+            cache.AddCoin(outpoint, Coin(coin), false);
+            vCoins.emplace_back(outpoint, coin);
+        }
+        cache.UpdateStats(changes);
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+    }
+    {
+        // spend half of the outputs through a stack of two caches
+        CCoinsViewCache cache1(&db);
+        CCoinsViewCache cache2(&cache1);
+        CCoinsStats changes;
+        for (size_t i = 0; i < vCoins.size(); i += 2) {
+            BOOST_CHECK(cache2.SpendCoin(vCoins[i].first));
+            changes.SpendCoin(vCoins[i].first, vCoins[i].second);
+        }
+        cache2.UpdateStats(changes);
+        cache2.SetBestBlock(InsecureRand256());
+
+        CCoinsStats statsCache;
+        BOOST_CHECK(cache2.GetStats(statsCache));
+        BOOST_CHECK_EQUAL(statsCache.nTransactionOutputs, 100);
+        BOOST_CHECK(cache2.Flush());
+        BOOST_CHECK(cache1.Flush());
+    }
+
+    CCoinsStats stats;
+    BOOST_CHECK(db.GetStats(stats));
+    CAmount nTotal = 0;
+    for (size_t i = 1; i < vCoins.size(); i += 2)
+        nTotal += vCoins[i].second.out.nValue;
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 100);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, nTotal);
+
+    db.EraseStats();
+    BOOST_CHECK(db.Upgrade());
+    CCoinsStats statsScan;
+    BOOST_CHECK(db.GetStats(statsScan));
+    BOOST_CHECK_EQUAL(statsScan.nTransactionOutputs, stats.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(statsScan.nSerializedSize, stats.nSerializedSize);
+    BOOST_CHECK_EQUAL(statsScan.nTotalAmount, stats.nTotalAmount);
+    uint256 hash, hashScan;
+    stats.muhash.Finalize(hash);
+    statsScan.muhash.Finalize(hashScan);
+    BOOST_CHECK(hash == hashScan);
+}
+
+// Flushed coins are read back while they are written behind, and after
+BOOST_AUTO_TEST_CASE(coins_db_write_behind)
+{
+    CCoinsViewDBTest db;
+    std::vector<COutPoint> vOutpoints;
+    for (int i = 0; i < 1000; i++)
+        vOutpoints.push_back(COutPoint(InsecureRand256(), InsecureRandRange(4)));
+
+    for (int nFlush = 0; nFlush < 4; nFlush++) {
+        // each flush spends the outputs added by the previous one
+        const uint256 hashBlock = InsecureRand256();
+        {
+            CCoinsViewCache cache(&db);
+            for (size_t i = 0; i < vOutpoints.size(); i++) {
+                if (i % 4 == (size_t)nFlush)
+                    cache.AddCoin(vOutpoints[i], Coin(CTxOut(i, CScript() << OP_TRUE), nFlush, false, false), false);
+                else if (nFlush > 0 && i % 4 == (size_t)nFlush - 1)
+                    BOOST_CHECK(cache.SpendCoin(vOutpoints[i]));
+            }
+            cache.SetBestBlock(hashBlock);
+            BOOST_CHECK(cache.Flush());
+        }
+        BOOST_CHECK(db.GetBestBlock() == hashBlock);
+        for (size_t i = 0; i < vOutpoints.size(); i++) {
+            Coin coin;
+            const bool fUnspent = i % 4 == (size_t)nFlush;
+            BOOST_CHECK_EQUAL(db.HaveCoin(vOutpoints[i]), fUnspent);
+            BOOST_CHECK_EQUAL(db.GetCoin(vOutpoints[i], coin), fUnspent);
+            if (fUnspent)
+                BOOST_CHECK_EQUAL(coin.out.nValue, (CAmount)i);
+        }
+    }
+    BOOST_CHECK(db.Sync());
+    BOOST_CHECK_EQUAL(db.PendingMemoryUsage(), 0U);
+    for (size_t i = 0; i < vOutpoints.size(); i++)
+        BOOST_CHECK_EQUAL(db.HaveCoin(vOutpoints[i]), i % 4 == 3);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,164 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "main.h"
+#include "net.h"
+#include "pow.h"
+#include "test/test_digiwage.h"
+
+#include <boost/test/unit_test.hpp>
+
+// Tests these internal-to-main.cpp methods:
+extern bool ReceivedBlockTransactions(const CBlock& block, CValidationState& state, CBlockIndex* pindexNew, const CDiskBlockPos& pos);
+extern bool AddBlockAwaitingParent(NodeId nodeid, const CBlock& block, int64_t nTime);
+extern void EraseBlocksAwaitingParentFrom(NodeId nodeid);
+extern void ExpireBlocksAwaitingParent(int64_t nTimeBefore);
+extern void ProcessBlocksAwaitingParent(const uint256& hashParent);
+extern std::set<uint256> setBlocksAwaitingParent;
+
+BOOST_FIXTURE_TEST_SUITE(headersfirst_tests, TestingSetup)
+
+// Index entries of blocks that were already downloaded and checked, on top of pindexPrev
+static CBlockIndex* AddCheckedBlocks(CBlockIndex* pindexPrev, int nCount)
+{
+    for (int i = 0; i < nCount; i++) {
+        CBlockIndex* pindex = new CBlockIndex();
+        BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(InsecureRand256(), pindex)).first;
+        pindex->phashBlock = &mi->first;
+        pindex->pprev = pindexPrev;
+        pindex->nHeight = pindexPrev->nHeight + 1;
+        pindex->nTime = pindexPrev->nTime + 60;
+        pindex->nBits = pindexPrev->nBits;
+        pindex->nChainWork = pindexPrev->nChainWork + GetBlockProof(*pindex);
+        pindex->nStatus = BLOCK_VALID_TRANSACTIONS | BLOCK_HAVE_DATA;
+        pindex->BuildSkip();
+        pindexPrev = pindex;
+    }
+    return pindexPrev;
+}
+
+static CBlock HeaderOn(const CBlockIndex* pindexPrev)
+{
+    CBlock block;
+    block.nVersion = CBlockHeader::CURRENT_VERSION;
+    block.hashPrevBlock = pindexPrev->GetBlockHash();
+    block.nTime = pindexPrev->nTime + 60;
+    block.nBits = GetNextWorkRequired(pindexPrev, &block);
+    block.nNonce = InsecureRand32();
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(pos_header_acceptance)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    LOCK(cs_main);
+
+    CBlockIndex* pindexTip = AddCheckedBlocks(chainActive.Tip(), Params().GetConsensus().height_last_PoW + 10);
+    pindexBestHeader = pindexTip;
+
+    // a well-formed header is indexed, but cannot become the best header before its stake is checked
+    CBlock header = HeaderOn(pindexTip);
+    CValidationState state;
+    CBlockIndex* pindex = NULL;
+    BOOST_CHECK(AcceptBlockHeader(header, state, &pindex));
+    BOOST_REQUIRE(pindex != NULL);
+    BOOST_CHECK(pindex->nChainWork > pindexTip->nChainWork);
+    BOOST_CHECK(pindexBestHeader == pindexTip);
+
+    // nor can the headers following it
+    CBlock headerNext = HeaderOn(pindex);
+    CBlockIndex* pindexNext = NULL;
+    BOOST_CHECK(AcceptBlockHeader(headerNext, state, &pindexNext));
+    BOOST_CHECK(pindexBestHeader == pindexTip);
+
+    // until the block data passed AcceptBlock
+    BOOST_CHECK(ReceivedBlockTransactions(header, state, pindex, CDiskBlockPos()));
+    BOOST_CHECK(pindexBestHeader == pindex);
+
+    SelectParams(CBaseChainParams::MAIN);
+}
+
+static CBlock BlockOn(const uint256& hashPrev)
+{
+    // without transactions, so it fails CheckBlock
+    CBlock block;
+    block.hashPrevBlock = hashPrev;
+    block.nNonce = InsecureRand32();
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(blocks_awaiting_parent)
+{
+    CAddress addr1(CService("10.0.0.1", Params().GetDefaultPort()));
+    CAddress addr2(CService("10.0.0.2", Params().GetDefaultPort()));
+    CNode node1(INVALID_SOCKET, addr1, "", true);
+    CNode node2(INVALID_SOCKET, addr2, "", true);
+    const int64_t nNow = GetTimeMicros();
+
+    // children of a parent not downloaded yet, and a grandchild
+    const uint256 hashMissing = InsecureRand256();
+    CBlock block1 = BlockOn(hashMissing), block2 = BlockOn(hashMissing), block3 = BlockOn(block1.GetHash());
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(AddBlockAwaitingParent(node1.GetId(), block1, nNow));
+        BOOST_CHECK(!AddBlockAwaitingParent(node1.GetId(), block1, nNow));
+        BOOST_CHECK(AddBlockAwaitingParent(node2.GetId(), block2, nNow));
+        BOOST_CHECK(AddBlockAwaitingParent(node1.GetId(), block3, nNow - 1000));
+        BOOST_CHECK_EQUAL(setBlocksAwaitingParent.size(), 3U);
+    }
+
+    // a parent that was not accepted drops its children, which are downloaded again if still wanted,
+    // while the grandchild waits for its own parent
+    ProcessBlocksAwaitingParent(hashMissing);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(setBlocksAwaitingParent.size(), 1U);
+        BOOST_CHECK(setBlocksAwaitingParent.count(block3.GetHash()));
+
+        // until it times out
+        ExpireBlocksAwaitingParent(nNow - 2000);
+        BOOST_CHECK_EQUAL(setBlocksAwaitingParent.size(), 1U);
+        ExpireBlocksAwaitingParent(nNow);
+        BOOST_CHECK(setBlocksAwaitingParent.empty());
+
+        // or its peer disconnects
+        BOOST_CHECK(AddBlockAwaitingParent(node1.GetId(), block1, nNow));
+        BOOST_CHECK(AddBlockAwaitingParent(node2.GetId(), block2, nNow));
+        EraseBlocksAwaitingParentFrom(node1.GetId());
+        BOOST_CHECK_EQUAL(setBlocksAwaitingParent.size(), 1U);
+        BOOST_CHECK(setBlocksAwaitingParent.count(block2.GetHash()));
+        EraseBlocksAwaitingParentFrom(node2.GetId());
+
+        // no more than a download window of blocks is held
+        for (unsigned int i = 0; i < BLOCK_DOWNLOAD_WINDOW; i++)
+            BOOST_CHECK(AddBlockAwaitingParent(node1.GetId(), BlockOn(hashMissing), nNow));
+        BOOST_CHECK(!AddBlockAwaitingParent(node1.GetId(), BlockOn(hashMissing), nNow));
+        EraseBlocksAwaitingParentFrom(node1.GetId());
+        BOOST_CHECK(setBlocksAwaitingParent.empty());
+    }
+
+    // once the parent is accepted its children are processed in order, and an invalid
+    // child is blamed on the peer it came from, not on the one of its parent
+    const uint256 hashGenesis = chainActive.Genesis()->GetBlockHash();
+    CBlock blockInvalid = BlockOn(hashGenesis), blockAfterInvalid = BlockOn(blockInvalid.GetHash());
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(AddBlockAwaitingParent(node2.GetId(), blockInvalid, nNow));
+        BOOST_CHECK(AddBlockAwaitingParent(node1.GetId(), blockAfterInvalid, nNow));
+    }
+    ProcessBlocksAwaitingParent(hashGenesis);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(setBlocksAwaitingParent.empty());
+        BOOST_CHECK(!mapBlockIndex.count(blockInvalid.GetHash()));
+        CNodeStateStats stats1, stats2;
+        BOOST_CHECK(GetNodeStateStats(node1.GetId(), stats1));
+        BOOST_CHECK(GetNodeStateStats(node2.GetId(), stats2));
+        BOOST_CHECK_EQUAL(stats1.nMisbehavior, 0);
+        BOOST_CHECK(stats2.nMisbehavior > 0);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
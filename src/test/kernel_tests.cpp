@@ -0,0 +1,100 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "kernel.h"
+#include "legacy/stakemodifier.h"
+#include "main.h"
+#include "stakeinput.h"
+#include "test/test_digiwage.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(kernel_tests, TestingSetup)
+
+// Hashing with the threads given, the input picked must not depend on how the search was split
+static size_t FindStakeWith(int nThreads, const CBlockIndex* pindexPrev, const std::vector<CStakeInput*>& vInputs, size_t nStart, unsigned int nBits, int64_t& nTimeTx, int& nHashes)
+{
+    boost::thread_group threadGroup;
+    StartStakeSearchThreads(threadGroup, nThreads);
+    const size_t nFound = FindStake(pindexPrev, vInputs, nStart, nBits, nTimeTx, nHashes);
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    StartStakeSearchThreads(threadGroup, 1);
+    return nFound;
+}
+
+BOOST_AUTO_TEST_CASE(find_stake_threads)
+{
+    CBlockIndex* pindexGenesis = chainActive.Tip();
+
+    // a v1 chain, so kernels hash with indexed old modifiers
+    std::vector<CBlockIndex> vBlocks(300);
+    std::vector<uint256> vHashes(300);
+    for (int i = 0; i < 300; i++) {
+        CBlockIndex& block = vBlocks[i];
+        vHashes[i] = InsecureRand256();
+        block.phashBlock = &vHashes[i];
+        block.pprev = i ? &vBlocks[i - 1] : pindexGenesis;
+        block.nHeight = block.pprev->nHeight + 1;
+        block.nTime = block.pprev->nTime + 60;
+        block.SetStakeModifier(InsecureRand256().GetCheapHash(), true);
+        block.BuildSkip();
+    }
+    chainActive.SetTip(&vBlocks.back());
+    UpdateOldModifierIndex(chainActive.Tip());
+    const CBlockIndex* pindexPrev = chainActive.Tip();
+
+    std::vector<CStakeCandidate> vCandidates;
+    for (int i = 0; i < 400; i++)
+        vCandidates.emplace_back(COutPoint(InsecureRand256(), i), CTxOut(100 * COIN, CScript()), &vBlocks[InsecureRandRange(200)]);
+    std::vector<CStakeInput*> vInputs;
+    for (CStakeCandidate& candidate : vCandidates)
+        vInputs.push_back(&candidate);
+
+    // about one input in twenty meets the target
+    uint256 bnTarget = (~uint256(0) / 20) / (100 * COIN / 100);
+    const unsigned int nBits = bnTarget.GetCompact();
+
+    int nFoundAfterStart = 0;
+    for (int nRound = 0; nRound < 10; nRound++) {
+        SetMockTime(pindexPrev->nTime + 1000 + nRound * Params().GetConsensus().nTimeSlotLength);
+        const size_t nStart = InsecureRandRange(100);
+
+        int64_t nTimeSerial = 0, nTimeParallel = 0;
+        int nHashesSerial = 0, nHashesParallel = 0;
+        const size_t nFoundSerial = FindStakeWith(1, pindexPrev, vInputs, nStart, nBits, nTimeSerial, nHashesSerial);
+        const size_t nFoundParallel = FindStakeWith(4, pindexPrev, vInputs, nStart, nBits, nTimeParallel, nHashesParallel);
+
+        // the same winner, at the same time, the lowest index at or after nStart meeting the target
+        BOOST_CHECK_EQUAL(nFoundSerial, nFoundParallel);
+        BOOST_CHECK_EQUAL(nTimeSerial, nTimeParallel);
+        BOOST_REQUIRE(nFoundSerial < vInputs.size());
+        BOOST_CHECK(nFoundSerial >= nStart);
+        for (size_t i = nStart; i <= nFoundSerial; i++) {
+            int64_t nTimeTx = 0;
+            BOOST_CHECK_EQUAL(Stake(pindexPrev, vInputs[i], nBits, nTimeTx), i == nFoundSerial);
+        }
+        if (nFoundSerial > nStart)
+            nFoundAfterStart++;
+
+        // the serial search stops at the kernel, the split one hashes at least up to it
+        BOOST_CHECK_EQUAL(nHashesSerial, (int)(nFoundSerial - nStart + 1));
+        BOOST_CHECK(nHashesParallel >= nHashesSerial);
+        BOOST_CHECK(nHashesParallel <= (int)(vInputs.size() - nStart));
+    }
+    BOOST_CHECK(nFoundAfterStart > 0);
+
+    // a search on a tip that is no longer current stops without hashing
+    int64_t nTimeTx = 0;
+    int nHashes = -1;
+    BOOST_CHECK_EQUAL(FindStakeWith(4, pindexPrev->pprev, vInputs, 0, nBits, nTimeTx, nHashes), vInputs.size());
+    BOOST_CHECK_EQUAL(nHashes, 0);
+
+    SetMockTime(0);
+    chainActive.SetTip(pindexGenesis);
+    UpdateOldModifierIndex(pindexGenesis);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,90 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "leveldbwrapper.h"
+#include "test/test_digiwage.h"
+#include "util.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(leveldbwrapper_tests, BasicTestingSetup)
+
+static CLevelDBInfo OpenInfo(size_t nCacheSize)
+{
+    // in memory, the path is only a name
+    CLevelDBWrapper db("test", "leveldbwrapper_tests", nCacheSize, true);
+    return db.GetInfo();
+}
+
+BOOST_AUTO_TEST_CASE(db_options)
+{
+    // the share of -dbcache, with its minimum
+    CLevelDBInfo info = OpenInfo(64 << 20);
+    BOOST_CHECK_EQUAL(info.nCacheSize, 32U << 20);
+    BOOST_CHECK_EQUAL(info.nWriteBufferSize, 16U << 20);
+    BOOST_CHECK_EQUAL(info.nBlockSize, (size_t)DEFAULT_DB_BLOCK_SIZE << 10);
+    info = OpenInfo(0);
+    BOOST_CHECK_EQUAL(info.nCacheSize, (size_t)MIN_DB_CACHE << 20);
+    BOOST_CHECK_EQUAL(info.nWriteBufferSize, (size_t)MIN_DB_CACHE << 20);
+
+    // options for all databases, overridden for this one
+    mapArgs["-dbwritebuffer"] = "8";
+    mapArgs["-test.dbcache"] = "16";
+    mapArgs["-dbblocksize"] = "16";
+    info = OpenInfo(64 << 20);
+    BOOST_CHECK_EQUAL(info.nCacheSize, 8U << 20);
+    BOOST_CHECK_EQUAL(info.nWriteBufferSize, 8U << 20);
+    BOOST_CHECK_EQUAL(info.nBlockSize, 16U << 10);
+    mapArgs["-test.dbwritebuffer"] = "2";
+    BOOST_CHECK_EQUAL(OpenInfo(64 << 20).nWriteBufferSize, 2U << 20);
+
+    // values out of range are clamped
+    mapArgs["-test.dbcache"] = "-1";
+    mapArgs["-test.dbwritebuffer"] = "0";
+    mapArgs["-dbblocksize"] = "-5";
+    info = OpenInfo(64 << 20);
+    BOOST_CHECK_EQUAL(info.nCacheSize, (size_t)MIN_DB_CACHE << 20);
+    BOOST_CHECK_EQUAL(info.nWriteBufferSize, (size_t)MIN_DB_CACHE << 20);
+    BOOST_CHECK_EQUAL(info.nBlockSize, 1U << 10);
+    mapArgs["-test.dbcache"] = "1000000";
+    mapArgs["-test.dbwritebuffer"] = "1000000";
+    info = OpenInfo(64 << 20);
+    BOOST_CHECK_EQUAL(info.nCacheSize, (size_t)MAX_DB_CACHE << 19);
+    BOOST_CHECK_EQUAL(info.nWriteBufferSize, (size_t)MAX_DB_WRITE_BUFFER << 20);
+
+    mapArgs.erase("-dbwritebuffer");
+    mapArgs.erase("-test.dbcache");
+    mapArgs.erase("-test.dbwritebuffer");
+    mapArgs.erase("-dbblocksize");
+}
+
+BOOST_AUTO_TEST_CASE(db_args_check)
+{
+    std::string strError;
+    BOOST_CHECK(CheckDBArgs(strError));
+
+    mapArgs["-dbcache"] = "0"; // clamped by init like before, not a database option
+    mapArgs["-dbwritebuffer"] = "64";
+    mapArgs["-chainstate.dbcache"] = "1024";
+    mapArgs["-sporks.dbwritebuffer"] = "1";
+    BOOST_CHECK(CheckDBArgs(strError));
+
+    for (const char* strArg : {"-dbwritebuffer", "-chainstate.dbcache", "-sporks.dbwritebuffer"}) {
+        const std::string strValid = mapArgs[strArg];
+        for (const char* strValue : {"0", "-1", "abc", "100000"}) {
+            mapArgs[strArg] = strValue;
+            BOOST_CHECK(!CheckDBArgs(strError));
+            BOOST_CHECK(strError.find(strArg) != std::string::npos);
+        }
+        mapArgs[strArg] = strValid;
+    }
+    BOOST_CHECK(CheckDBArgs(strError));
+
+    mapArgs.erase("-dbcache");
+    mapArgs.erase("-dbwritebuffer");
+    mapArgs.erase("-chainstate.dbcache");
+    mapArgs.erase("-sporks.dbwritebuffer");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,149 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternodeman.h"
+#include "primitives/block.h"
+#include "test/test_digiwage.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternode_tests, TestingSetup)
+
+// A chain of blocks with random hashes, branching off pindexFork when given
+static void BuildChain(std::vector<CBlockIndex>& vBlocks, std::vector<uint256>& vHashes, int nLength, CBlockIndex* pindexFork)
+{
+    int nHeight = pindexFork ? pindexFork->nHeight + 1 : 0;
+    vHashes.resize(nLength);
+    vBlocks.resize(nLength);
+    for (int i = 0; i < nLength; i++) {
+        vHashes[i] = InsecureRand256();
+        vBlocks[i].nHeight = nHeight + i;
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : pindexFork;
+        vBlocks[i].phashBlock = &vHashes[i];
+        vBlocks[i].BuildSkip();
+    }
+}
+
+static std::vector<CTxIn> GetRanking(CMasternodeMan& man, int nCount, int nBlockHeight)
+{
+    std::vector<CTxIn> vRanked;
+    for (int nRank = 1; nRank <= nCount; nRank++) {
+        CMasternode* pmn = man.GetMasternodeByRank(nRank, nBlockHeight, 0, false);
+        BOOST_REQUIRE(pmn != NULL);
+        vRanked.push_back(pmn->vin);
+    }
+    return vRanked;
+}
+
+BOOST_AUTO_TEST_CASE(rankings_follow_reorg)
+{
+    std::vector<CBlockIndex> vBlocks, vFork;
+    std::vector<uint256> vHashes, vForkHashes;
+    BuildChain(vBlocks, vHashes, 200, NULL);
+    BuildChain(vFork, vForkHashes, 20, &vBlocks[179]);
+
+    CBlockIndex* pindexOldTip = chainActive.Tip();
+    mapCacheBlockHashes.clear();
+    chainActive.SetTip(&vBlocks.back());
+
+    const int nMasternodes = 20;
+    CMasternodeMan man;
+    for (int i = 0; i < nMasternodes; i++) {
+        CMasternode mn;
+        mn.vin = CTxIn(InsecureRand256(), 0);
+        BOOST_CHECK(man.Add(mn));
+    }
+
+    // rankings of blocks below the fork point are unaffected, the ones above it are scored on the new blocks
+    const int nHeightKept = 150, nHeightForked = 195;
+    std::vector<CTxIn> vKept = GetRanking(man, nMasternodes, nHeightKept);
+    std::vector<CTxIn> vForked = GetRanking(man, nMasternodes, nHeightForked);
+    BOOST_CHECK(GetRanking(man, nMasternodes, nHeightForked) == vForked);
+
+    chainActive.SetTip(&vFork.back());
+    BOOST_CHECK(GetRanking(man, nMasternodes, nHeightKept) == vKept);
+    std::vector<CTxIn> vReorged = GetRanking(man, nMasternodes, nHeightForked);
+    BOOST_CHECK(vReorged != vForked);
+
+    // same as a ranking computed from scratch on the new chain
+    CMasternodeMan manFresh;
+    for (int i = 0; i < nMasternodes; i++) {
+        CMasternode mn;
+        mn.vin = vKept[i];
+        BOOST_CHECK(manFresh.Add(mn));
+    }
+    BOOST_CHECK(GetRanking(manFresh, nMasternodes, nHeightForked) == vReorged);
+
+    // and back
+    chainActive.SetTip(&vBlocks.back());
+    BOOST_CHECK(GetRanking(man, nMasternodes, nHeightForked) == vForked);
+
+    chainActive.SetTip(pindexOldTip);
+    mapCacheBlockHashes.clear();
+}
+
+// Feeds transactions the way the validation interface does
+class CTestCollaterals : public CMasternodeCollaterals
+{
+public:
+    using CMasternodeCollaterals::SyncTransaction;
+};
+
+static CTransaction SpendOf(const COutPoint& outpoint)
+{
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(outpoint));
+    tx.vout.push_back(CTxOut(1 * COIN, CScript() << OP_TRUE));
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(collateral_spends)
+{
+    CMutableTransaction txCreate;
+    txCreate.vin.push_back(CTxIn(InsecureRand256(), 0));
+    txCreate.vout.push_back(CTxOut(12000 * COIN, CScript() << OP_TRUE));
+    const COutPoint collateral(txCreate.GetHash(), 0);
+    const CTransaction txSpend = SpendOf(collateral);
+    CBlock block;
+    block.vtx.push_back(txSpend);
+
+    CTestCollaterals collaterals;
+    BOOST_CHECK_EQUAL(collaterals.GetStatus(collateral), CMasternodeCollaterals::COLLATERAL_UNVERIFIED);
+    collaterals.SetVerified(collateral);
+    BOOST_CHECK_EQUAL(collaterals.GetStatus(collateral), CMasternodeCollaterals::COLLATERAL_UNSPENT);
+
+    // unrelated transactions leave it alone
+    collaterals.SyncTransaction(SpendOf(COutPoint(InsecureRand256(), 0)), &block);
+    collaterals.SyncTransaction(SpendOf(COutPoint(collateral.hash, 1)), NULL);
+    BOOST_CHECK_EQUAL(collaterals.GetStatus(collateral), CMasternodeCollaterals::COLLATERAL_UNSPENT);
+
+    // a mempool spend that never confirms only forces a full check, which finds it unspent again
+    collaterals.SyncTransaction(txSpend, NULL);
+    BOOST_CHECK_EQUAL(collaterals.GetStatus(collateral), CMasternodeCollaterals::COLLATERAL_UNVERIFIED);
+    collaterals.SetVerified(collateral);
+    BOOST_CHECK_EQUAL(collaterals.GetStatus(collateral), CMasternodeCollaterals::COLLATERAL_UNSPENT);
+
+    // spent in a connected block
+    collaterals.SyncTransaction(txSpend, &block);
+    BOOST_CHECK_EQUAL(collaterals.GetStatus(collateral), CMasternodeCollaterals::COLLATERAL_SPENT);
+    collaterals.SetVerified(collateral);
+    BOOST_CHECK_EQUAL(collaterals.GetStatus(collateral), CMasternodeCollaterals::COLLATERAL_SPENT);
+
+    // that block is disconnected
+    collaterals.SyncTransaction(txSpend, NULL);
+    BOOST_CHECK_EQUAL(collaterals.GetStatus(collateral), CMasternodeCollaterals::COLLATERAL_UNVERIFIED);
+    collaterals.SetVerified(collateral);
+    BOOST_CHECK_EQUAL(collaterals.GetStatus(collateral), CMasternodeCollaterals::COLLATERAL_UNSPENT);
+
+    // the transaction creating it is disconnected
+    collaterals.SyncTransaction(txCreate, NULL);
+    BOOST_CHECK_EQUAL(collaterals.GetStatus(collateral), CMasternodeCollaterals::COLLATERAL_UNVERIFIED);
+
+    // forgotten collaterals start over
+    collaterals.SyncTransaction(txSpend, &block);
+    collaterals.Forget(collateral);
+    BOOST_CHECK_EQUAL(collaterals.GetStatus(collateral), CMasternodeCollaterals::COLLATERAL_UNVERIFIED);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,179 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternode.h"
+#include "messagesigner.h"
+#include "messageverifier.h"
+#include "test/test_digiwage.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(messageverifier_tests, TestingSetup)
+
+static std::shared_ptr<CMessageVerifyJob> PingJob(const CKey& key, int i, bool fValid)
+{
+    CMasternodePing mnp;
+    mnp.vin = CTxIn(InsecureRand256(), i);
+    mnp.blockHash = InsecureRand256();
+    mnp.sigTime = 1500000000 + i;
+    BOOST_CHECK(mnp.Sign(key, key.GetPubKey(), i % 2 == 0));
+    if (!fValid) {
+        // a signature no key can be recovered from
+        std::vector<unsigned char> vchSig = mnp.GetVchSig();
+        if (i % 2 == 0)
+            vchSig.pop_back();
+        else
+            std::fill(vchSig.begin() + 1, vchSig.end(), 0);
+        mnp.SetVchSig(vchSig);
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << mnp;
+    return std::make_shared<CMessageVerifyJob>("mnp", ss);
+}
+
+// Irregular pattern, so results handed to the wrong job do not line up by chance
+static bool IsValidAt(unsigned int i)
+{
+    return i % 3 != 1 && i % 7 != 0;
+}
+
+BOOST_AUTO_TEST_CASE(verify_batch)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    std::vector<CMasternodePing> vPings;
+    std::vector<std::shared_ptr<CMessageVerifyJob> > vJobs;
+    for (int i = 0; i < 10; i++) {
+        CMasternodePing mnp;
+        mnp.vin = CTxIn(InsecureRand256(), i);
+        mnp.blockHash = InsecureRand256();
+        mnp.sigTime = 1500000000 + i;
+        BOOST_CHECK(mnp.Sign(key, key.GetPubKey(), i % 2 == 0));
+        vPings.push_back(mnp);
+
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << mnp;
+        vJobs.push_back(std::make_shared<CMessageVerifyJob>("mnp", ss));
+    }
+
+    // a truncated message is left to its handler to reject
+    CDataStream ssShort(SER_NETWORK, PROTOCOL_VERSION);
+    ssShort << vPings[0].vin;
+    vJobs.push_back(std::make_shared<CMessageVerifyJob>("mvote", ssShort));
+
+    CMessageVerifier verifier;
+    verifier.VerifyBatch(vJobs);
+    for (const std::shared_ptr<CMessageVerifyJob>& job : vJobs)
+        BOOST_CHECK(job->fDone);
+
+    // the jobs were verified on copies of their payload
+    CMasternodePing mnp;
+    vJobs[0]->vRecv >> mnp;
+    BOOST_CHECK(mnp.GetHash() == vPings[0].GetHash());
+
+    for (const CMasternodePing& ping : vPings) {
+        CKeyID keyID;
+        BOOST_CHECK(ping.RecoverSigner(keyID));
+        BOOST_CHECK(keyID == key.GetPubKey().GetID());
+        BOOST_CHECK(ping.CheckSignature(key.GetPubKey()));
+    }
+
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    BOOST_CHECK(!vPings[1].CheckSignature(keyOther.GetPubKey()));
+}
+
+BOOST_AUTO_TEST_CASE(verify_batch_mixed)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    std::vector<std::shared_ptr<CMessageVerifyJob> > vJobs;
+    for (unsigned int i = 0; i < 20; i++)
+        vJobs.push_back(PingJob(key, i, IsValidAt(i)));
+    CDataStream ssShort(SER_NETWORK, PROTOCOL_VERSION);
+    ssShort << CTxIn(InsecureRand256(), 0);
+    vJobs.push_back(std::make_shared<CMessageVerifyJob>("mnp", ssShort));
+
+    // verified inline, without workers
+    CMessageVerifier verifier;
+    BOOST_CHECK(!verifier.IsEnabled());
+    verifier.VerifyBatch(vJobs);
+    for (unsigned int i = 0; i < 20; i++) {
+        BOOST_CHECK(vJobs[i]->fDone);
+        BOOST_CHECK_EQUAL(vJobs[i]->fValid, IsValidAt(i));
+    }
+    BOOST_CHECK(vJobs.back()->fDone);
+    BOOST_CHECK(!vJobs.back()->fValid);
+}
+
+BOOST_AUTO_TEST_CASE(verify_batch_workers)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    // a full batch is several times the check queue batch size, so it is split across the workers
+    std::vector<std::shared_ptr<CMessageVerifyJob> > vJobs;
+    for (unsigned int i = 0; i < MAX_MSGVERIFY_BATCH; i++)
+        vJobs.push_back(PingJob(key, i, IsValidAt(i)));
+
+    boost::thread_group threadGroup;
+    CMessageVerifier verifier;
+    verifier.Start(threadGroup, 4);
+    BOOST_CHECK(verifier.IsEnabled());
+    verifier.VerifyBatch(vJobs);
+
+    // every job gets its own result, in the order the jobs were submitted
+    for (unsigned int i = 0; i < vJobs.size(); i++) {
+        BOOST_CHECK(vJobs[i]->fDone);
+        BOOST_CHECK_EQUAL(vJobs[i]->fValid, IsValidAt(i));
+    }
+
+    // a second batch of the opposite results through the same workers
+    std::vector<std::shared_ptr<CMessageVerifyJob> > vJobs2;
+    for (unsigned int i = 0; i < 100; i++)
+        vJobs2.push_back(PingJob(key, i, !IsValidAt(i)));
+    verifier.VerifyBatch(vJobs2);
+    for (unsigned int i = 0; i < vJobs2.size(); i++) {
+        BOOST_CHECK(vJobs2[i]->fDone);
+        BOOST_CHECK_EQUAL(vJobs2[i]->fValid, !IsValidAt(i));
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(verify_invalid_once)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    std::vector<std::shared_ptr<CMessageVerifyJob> > vJobs;
+    unsigned int nInvalid = 0;
+    for (unsigned int i = 0; i < 20; i++) {
+        vJobs.push_back(PingJob(key, i, IsValidAt(i)));
+        if (!IsValidAt(i))
+            nInvalid++;
+    }
+
+    // signing checked the valid signatures already, so only the invalid ones are recovered
+    const uint64_t nRecoveries = CHashSigner::GetKeyRecoveries();
+    CMessageVerifier verifier;
+    verifier.VerifyBatch(vJobs);
+    BOOST_CHECK_EQUAL(CHashSigner::GetKeyRecoveries(), nRecoveries + nInvalid);
+
+    // the handler checks each signature again, valid or not, without another recovery
+    for (unsigned int i = 0; i < vJobs.size(); i++) {
+        CMasternodePing mnp;
+        vJobs[i]->vRecv >> mnp;
+        BOOST_CHECK_EQUAL(mnp.CheckSignature(key.GetPubKey()), IsValidAt(i));
+        BOOST_CHECK_EQUAL(mnp.CheckSignature(key.GetPubKey()), IsValidAt(i));
+    }
+    BOOST_CHECK_EQUAL(CHashSigner::GetKeyRecoveries(), nRecoveries + nInvalid);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,88 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternode-payments.h"
+#include "test/test_digiwage.h"
+
+#include <boost/test/unit_test.hpp>
+
+extern std::map<int64_t, uint256> mapCacheBlockHashes;
+
+BOOST_FIXTURE_TEST_SUITE(mnpayments_tests, TestingSetup)
+
+// The chain walk CMasternode::GetLastPaid used to perform for every masternode
+static int LegacyLastPaidHeight(CMasternodePayments& payments, const CScript& payee, int nBlocks)
+{
+    const CBlockIndex* BlockReading = chainActive.Tip();
+
+    int n = 0;
+    while (BlockReading && BlockReading->nHeight > 0) {
+        if (n >= nBlocks) return 0;
+        n++;
+
+        if (payments.mapMasternodeBlocks.count(BlockReading->nHeight) &&
+            payments.mapMasternodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(payee, MNPAYMENTS_LASTPAID_VOTES_REQUIRED))
+            return BlockReading->nHeight;
+
+        BlockReading = BlockReading->pprev;
+    }
+
+    return 0;
+}
+
+BOOST_AUTO_TEST_CASE(lastpaid_index_matches_chain_walk)
+{
+    const int nChainLength = 400;
+    std::vector<uint256> vHashes(nChainLength);
+    std::vector<CBlockIndex> vBlocks(nChainLength);
+    for (int i = 0; i < nChainLength; i++) {
+        vHashes[i] = InsecureRand256();
+        vBlocks[i].nHeight = i;
+        vBlocks[i].nTime = 1500000000 + i * 60;
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : NULL;
+        vBlocks[i].phashBlock = &vHashes[i];
+        vBlocks[i].BuildSkip();
+    }
+
+    CBlockIndex* pindexOldTip = chainActive.Tip();
+    mapCacheBlockHashes.clear();
+    chainActive.SetTip(&vBlocks.back());
+
+    std::vector<CScript> vPayees;
+    for (int i = 0; i < 20; i++)
+        vPayees.push_back(GetScriptForDestination(CKeyID(uint160(InsecureRandBytes(20)))));
+
+    // votes spread over the recent past and a few blocks ahead of the tip
+    CMasternodePayments payments;
+    for (int i = 0; i < 1500; i++) {
+        CMasternodePaymentWinner winner(CTxIn(InsecureRand256(), InsecureRandRange(4)));
+        winner.nBlockHeight = 110 + InsecureRandRange(nChainLength + 20 - 110);
+        winner.AddPayee(vPayees[InsecureRandRange(vPayees.size())]);
+        BOOST_CHECK(payments.AddWinningMasternode(winner));
+    }
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << payments;
+    CMasternodePayments paymentsLoaded;
+    ss >> paymentsLoaded;
+
+    const int vBlocksBack[] = {0, 1, 10, 50, 125, 299, 1000};
+    for (const CScript& payee : vPayees) {
+        for (int nBlocks : vBlocksBack) {
+            int nExpected = LegacyLastPaidHeight(payments, payee, nBlocks);
+            BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(payee, chainActive.Height(), nBlocks), nExpected);
+            BOOST_CHECK_EQUAL(paymentsLoaded.GetLastPaidHeight(payee, chainActive.Height(), nBlocks), nExpected);
+        }
+    }
+
+    // disconnecting blocks must not report votes above the new tip
+    chainActive.SetTip(&vBlocks[nChainLength - 60]);
+    for (const CScript& payee : vPayees)
+        BOOST_CHECK_EQUAL(payments.GetLastPaidHeight(payee, chainActive.Height(), 125), LegacyLastPaidHeight(payments, payee, 125));
+
+    chainActive.SetTip(pindexOldTip);
+    mapCacheBlockHashes.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,111 @@
+// Copyright (c) 2019 The DIGIWAGE developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "legacy/stakemodifier.h"
+#include "main.h"
+#include "stakeinput.h"
+#include "test/test_digiwage.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(stakemodifier_tests, TestingSetup)
+
+// Extend the chain at pindexPrev with nBlocks v1 blocks, with jittered times and most of them generating a modifier
+static void ExtendChain(std::vector<CBlockIndex>& vBlocks, std::vector<uint256>& vHashes, CBlockIndex* pindexPrev, int nBlocks)
+{
+    vBlocks.resize(nBlocks);
+    vHashes.resize(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockIndex& block = vBlocks[i];
+        vHashes[i] = InsecureRand256();
+        block.phashBlock = &vHashes[i];
+        block.pprev = i ? &vBlocks[i - 1] : pindexPrev;
+        block.nHeight = block.pprev->nHeight + 1;
+        block.nTime = block.pprev->nTime + 20 + InsecureRandRange(80);
+        block.SetStakeModifier(InsecureRand256().GetCheapHash(), InsecureRandRange(4) != 0);
+        block.BuildSkip();
+    }
+}
+
+// The modifier a kernel from pindexFrom hashes with, by definition
+static bool ExpectedOldModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier)
+{
+    for (int nHeight = pindexFrom->nHeight + 1; nHeight <= chainActive.Height(); nHeight++) {
+        const CBlockIndex* pindex = chainActive[nHeight];
+        if (pindex->GeneratedStakeModifier() && pindex->GetBlockTime() >= pindexFrom->GetBlockTime() + 2087) {
+            nStakeModifier = pindex->GetStakeModifierV1();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Lookups must be served from the index: without the modifier flags a chain walk can't find any
+static void CheckIndexedModifiers(std::vector<CBlockIndex*> vChain)
+{
+    std::vector<std::pair<bool, uint64_t> > vExpected;
+    for (CBlockIndex* pindex : vChain) {
+        uint64_t nStakeModifier = 0;
+        bool fFound = ExpectedOldModifier(pindex, nStakeModifier);
+        vExpected.emplace_back(fFound, nStakeModifier);
+    }
+    for (CBlockIndex* pindex : vChain)
+        pindex->nFlags &= ~BLOCK_STAKE_MODIFIER;
+
+    int nFound = 0;
+    for (size_t i = 0; i < vChain.size(); i++) {
+        CStakeCandidate stake(COutPoint(InsecureRand256(), 0), CTxOut(100 * COIN, CScript()), vChain[i]);
+        uint64_t nStakeModifier = 0;
+        BOOST_CHECK_EQUAL(GetOldStakeModifier(&stake, nStakeModifier), vExpected[i].first);
+        if (vExpected[i].first) {
+            BOOST_CHECK_EQUAL(nStakeModifier, vExpected[i].second);
+            nFound++;
+        }
+    }
+    BOOST_CHECK(nFound > (int)vChain.size() / 2);
+}
+
+BOOST_AUTO_TEST_CASE(old_modifier_index)
+{
+    CBlockIndex* pindexGenesis = chainActive.Tip();
+    BOOST_CHECK_EQUAL(pindexGenesis->nHeight, 0);
+
+    std::vector<CBlockIndex> vBlocks;
+    std::vector<uint256> vHashes;
+    ExtendChain(vBlocks, vHashes, pindexGenesis, 300);
+    chainActive.SetTip(&vBlocks.back());
+    UpdateOldModifierIndex(chainActive.Tip());
+
+    std::vector<CBlockIndex*> vChain;
+    for (CBlockIndex& block : vBlocks)
+        vChain.push_back(&block);
+    std::vector<uint32_t> vFlags;
+    for (CBlockIndex* pindex : vChain)
+        vFlags.push_back(pindex->nFlags);
+    CheckIndexedModifiers(vChain);
+    for (size_t i = 0; i < vChain.size(); i++)
+        vChain[i]->nFlags = vFlags[i];
+
+    // reorganize the last 50 blocks away, onto a longer branch
+    std::vector<CBlockIndex> vBranch;
+    std::vector<uint256> vBranchHashes;
+    ExtendChain(vBranch, vBranchHashes, &vBlocks[249], 80);
+    chainActive.SetTip(&vBranch.back());
+    UpdateOldModifierIndex(chainActive.Tip());
+
+    vChain.resize(250);
+    for (CBlockIndex& block : vBranch)
+        vChain.push_back(&block);
+    CheckIndexedModifiers(vChain);
+
+    // blocks off the active chain aren't looked up in the index
+    CStakeCandidate stake(COutPoint(InsecureRand256(), 0), CTxOut(100 * COIN, CScript()), &vBlocks[280]);
+    uint64_t nStakeModifier = 0;
+    BOOST_CHECK(!GetOldStakeModifier(&stake, nStakeModifier));
+
+    chainActive.SetTip(pindexGenesis);
+    UpdateOldModifierIndex(pindexGenesis);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
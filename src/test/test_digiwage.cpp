@@ -7,6 +7,7 @@
 
 #include "test_digiwage.h"
 
+#include "crypto/sha256.h"
 #include "main.h"
 #include "random.h"
 #include "txdb.h"
@@ -31,6 +32,7 @@ extern void noui_connect();
 BasicTestingSetup::BasicTestingSetup()
 {
         RandomInit();
+        SHA256AutoDetect();
         ECC_Start();
         SetupEnvironment();
         fPrintToDebugLog = false; // don't want to write to debug.log file
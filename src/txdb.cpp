@@ -6,6 +6,8 @@
 
 #include "txdb.h"
 
+#include "guiinterface.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
 #include "uint256.h"
@@ -15,12 +17,92 @@
 #include <boost/thread.hpp>
 
 
-void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins)
-{
-    if (coins.IsPruned())
-        batch.Erase(std::make_pair('c', hash));
-    else
-        batch.Write(std::make_pair('c', hash), coins);
+namespace {
+
+//! Key of an unspent output in the coin database: 'C', the txid and the output index
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key('C') {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(key);
+        READWRITE(outpoint->hash);
+        READWRITE(VARINT(outpoint->n));
+    }
+};
+
+/**
+ * The 'c' records of older versions: the unspent outputs of a transaction in one record.
+ * Only read, to upgrade them to per output records.
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode)
+ * - unspentness bitvector, for vout[2] and further; least significant byte first
+ * - the non-spent CTxOuts (via CTxOutCompressor)
+ * - VARINT(nHeight)
+ *
+ * The nCode value consists of:
+ * - bit 1: IsCoinBase()
+ * - bit 2: IsCoinStake()
+ * - bit 4: vout[0] is not spent
+ * - bit 8: vout[1] is not spent
+ * - The higher bits encode N, the number of non-zero bytes in the following bitvector.
+ *   - In case both bit 4 and bit 8 are unset, they encode N-1, as there must be at
+ *     least one non-spent output).
+ */
+class CLegacyCoins
+{
+public:
+    bool fCoinBase;
+    bool fCoinStake;
+    std::vector<CTxOut> vout;
+    int nHeight;
+    int nVersion;
+
+    CLegacyCoins() : fCoinBase(false), fCoinStake(false), nHeight(0), nVersion(0) {}
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        unsigned int nCode = 0;
+        // version
+        ::Unserialize(s, VARINT(this->nVersion), nType, nVersion);
+        // header code
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        fCoinBase = nCode & 1;
+        fCoinStake = (nCode & 2) != 0;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 4) != 0;
+        vAvail[1] = (nCode & 8) != 0;
+        unsigned int nMaskCode = (nCode / 16) + ((nCode & 12) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail, nType, nVersion);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])), nType, nVersion);
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight), nType, nVersion);
+    }
+};
+
 }
 
 void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
@@ -28,136 +110,391 @@ void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
     batch.Write('B', hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db("chainstate", GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe),
+                                                                        nPendingUsage(0),
+                                                                        fPending(false),
+                                                                        fWriteFailed(false),
+                                                                        fWriteQueued(false),
+                                                                        fStopWriter(false)
+{
+    // computed by Upgrade() if the database doesn't have them yet
+    db.Read('S', stats);
+    threadWrite = boost::thread(&CCoinsViewDB::ThreadWrite, this);
+}
+
+CCoinsViewDB::~CCoinsViewDB()
 {
+    if (!Sync())
+        LogPrintf("%s : the last write to the coin database failed\n", __func__);
+    {
+        boost::unique_lock<boost::mutex> lock(mutexWrite);
+        fStopWriter = true;
+    }
+    condWrite.notify_all();
+    threadWrite.join();
 }
 
-bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
+bool CCoinsViewDB::GetCoin(const COutPoint& outpoint, Coin& coin) const
 {
-    return db.Read(std::make_pair('c', txid), coins);
+    {
+        LOCK(cs_pending);
+        if (fPending) {
+            CCoinsMap::const_iterator it = mapPending.find(outpoint);
+            if (it != mapPending.end()) {
+                coin = it->second.coin;
+                return !coin.IsSpent();
+            }
+        }
+    }
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256& txid) const
+bool CCoinsViewDB::HaveCoin(const COutPoint& outpoint) const
 {
-    return db.Exists(std::make_pair('c', txid));
+    {
+        LOCK(cs_pending);
+        if (fPending) {
+            CCoinsMap::const_iterator it = mapPending.find(outpoint);
+            if (it != mapPending.end())
+                return !it->second.coin.IsSpent();
+        }
+    }
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
 {
+    {
+        LOCK(cs_pending);
+        if (fPending && !hashBlockPending.IsNull())
+            return hashBlockPending;
+    }
     uint256 hashBestChain;
     if (!db.Read('B', hashBestChain))
         return UINT256_ZERO;
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+bool CCoinsViewDB::GetStats(CCoinsStats& statsOut) const
 {
-    CLevelDBBatch batch;
-    size_t count = 0;
-    size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
-        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
-            changed++;
-        }
-        count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
-    }
-    if (!hashBlock.IsNull())
-        BatchWriteHashBestChain(batch, hashBlock);
+    statsOut = stats;
+    return true;
+}
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, const CCoinsStats& changes)
+{
+    int64_t nStart = GetTimeMicros();
+    if (!Sync())
+        return false;
+    LogPrint("bench", "    - Waiting for the previous coin database write: %.2fms\n", 0.001 * (GetTimeMicros() - nStart));
+
+    // the coins stay in memory until written, so they count against the coins cache limit
+    size_t nUsage = memusage::DynamicUsage(mapCoins);
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++)
+        nUsage += it->second.coin.DynamicMemoryUsage();
+
+    // take the coins over, the caller gets back the empty map of the previous write
+    stats += changes;
+    {
+        LOCK(cs_pending);
+        mapPending.swap(mapCoins);
+        hashBlockPending = hashBlock;
+        statsPending = stats;
+        nPendingUsage = nUsage;
+        fPending = true;
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(mutexWrite);
+        fWriteQueued = true;
+    }
+    condWrite.notify_all();
+    return true;
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
+bool CCoinsViewDB::Sync()
 {
+    // the write must complete, even on a thread being interrupted for shutdown
+    boost::this_thread::disable_interruption di;
+    {
+        boost::unique_lock<boost::mutex> lock(mutexWrite);
+        while (fWriteQueued)
+            condWrite.wait(lock);
+    }
+    LOCK(cs_pending);
+    return !fWriteFailed;
 }
 
-bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
+size_t CCoinsViewDB::PendingMemoryUsage() const
 {
-    return Write(std::make_pair('b', blockindex.GetBlockHash()), blockindex);
+    LOCK(cs_pending);
+    return fPending ? nPendingUsage : 0;
 }
 
-bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo& info)
+void CCoinsViewDB::ThreadWrite()
 {
-    return Read(std::make_pair('f', nFile), info);
+    util::ThreadRename("digiwage-coindb");
+    boost::unique_lock<boost::mutex> lock(mutexWrite);
+    while (true) {
+        while (!fWriteQueued && !fStopWriter)
+            condWrite.wait(lock);
+        // a write handed over before the stop is still done
+        if (!fWriteQueued)
+            return;
+
+        lock.unlock();
+        WritePending();
+        lock.lock();
+        fWriteQueued = false;
+        condWrite.notify_all();
+    }
 }
 
-bool CBlockTreeDB::WriteReindexing(bool fReindexing)
+void CCoinsViewDB::WritePending()
 {
-    if (fReindexing)
-        return Write('R', '1');
-    else
-        return Erase('R');
+    int64_t nStart = GetTimeMicros();
+    size_t count = 0;
+    size_t changed = 0;
+    size_t nBytes = 0;
+    bool fOk = false;
+    try {
+        // mapPending is only changed by this thread while a write is in flight
+        CLevelDBBatch batch;
+        for (CCoinsMap::const_iterator it = mapPending.begin(); it != mapPending.end(); it++) {
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                CoinEntry entry(&it->first);
+                if (it->second.coin.IsSpent()) {
+                    batch.Erase(entry);
+                } else {
+                    batch.Write(entry, it->second.coin);
+                    nBytes += ::GetSerializeSize(it->second.coin, SER_DISK, CLIENT_VERSION);
+                }
+                changed++;
+            }
+            count++;
+        }
+        // the statistics are written in the batch of the coins they describe, and the
+        // best block marker last: the batch is applied atomically, so that a crash
+        // leaves the database at either the previous or this best block
+        batch.Write('S', statsPending);
+        if (!hashBlockPending.IsNull())
+            BatchWriteHashBestChain(batch, hashBlockPending);
+
+        LogPrint("coindb", "Committing %u changed coins (out of %u), %u bytes, to coin database...\n", (unsigned int)changed, (unsigned int)count, (unsigned int)nBytes);
+        fOk = db.WriteBatch(batch);
+    } catch (const std::exception& e) {
+        LogPrintf("%s : %s\n", __func__, e.what());
+    }
+
+    // the coins are freed outside the lock, readers find them in the database now
+    CCoinsMap mapWritten;
+    {
+        LOCK(cs_pending);
+        if (fOk) {
+            mapWritten.swap(mapPending);
+            nPendingUsage = 0;
+            fPending = false;
+        } else {
+            fWriteFailed = true;
+        }
+    }
+    if (!fOk)
+        LogPrintf("%s : failed to write to coin database\n", __func__);
+    LogPrint("bench", "    - Coin database write: %u changed coins in %.2fms\n", (unsigned int)changed, 0.001 * (GetTimeMicros() - nStart));
 }
 
-bool CBlockTreeDB::ReadReindexing(bool& fReindexing)
+bool CCoinsViewDB::Upgrade()
 {
-    fReindexing = Exists('R');
+    if (!Sync())
+        return false;
+    if (!UpgradeCoins())
+        return false;
+    if (!db.Exists('S'))
+        return ComputeStats();
     return true;
 }
 
-bool CBlockTreeDB::ReadLastBlockFile(int& nFile)
+bool CCoinsViewDB::ComputeStats()
 {
-    return Read('l', nFile);
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'C';
+    pcursor->Seek(leveldb::Slice(&ssKeySet[0], ssKeySet.size()));
+
+    const int64_t nStart = GetTimeMillis();
+    LogPrintf("Computing the UTXO set statistics...\n");
+    uiInterface.ShowProgress(_("Computing UTXO set statistics"), 0);
+    CCoinsStats statsNew;
+    int nReportDone = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            return false;
+        // the records after the coins may be too short for a coin key
+        if (pcursor->key()[0] != 'C')
+            break;
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            COutPoint outpoint;
+            CoinEntry entry(&outpoint);
+            ssKey >> entry;
+            int nPercentageDone = (int)(*outpoint.hash.begin()) * 100 / 256;
+            if (nPercentageDone > nReportDone) {
+                uiInterface.ShowProgress(_("Computing UTXO set statistics"), nPercentageDone);
+                nReportDone = nPercentageDone;
+            }
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            Coin coin;
+            ssValue >> coin;
+            statsNew.AddCoin(outpoint, coin);
+        } catch (const std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+        pcursor->Next();
+    }
+    uiInterface.ShowProgress("", 100);
+    if (!db.Write('S', statsNew))
+        return false;
+    stats = statsNew;
+    LogPrintf("Computed the statistics of %u unspent outputs in %dms\n", (unsigned int)stats.nTransactionOutputs, GetTimeMillis() - nStart);
+    return true;
 }
 
-bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
+bool CCoinsViewDB::CountTransactions(uint64_t& nTransactions)
 {
-    /* It seems that there are no "const iterators" for LevelDB.  Since we
-       only need read operations on it, use a const-cast to get around
-       that restriction.  */
-    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    if (!Sync())
+        return false;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'C';
+    pcursor->Seek(leveldb::Slice(&ssKeySet[0], ssKeySet.size()));
+
+    // the outputs of a transaction are next to each other
+    nTransactions = 0;
+    uint256 hashPrev;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        // the records after the coins may be too short for a coin key
+        if (pcursor->key()[0] != 'C')
+            break;
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            COutPoint outpoint;
+            CoinEntry entry(&outpoint);
+            ssKey >> entry;
+            if (nTransactions == 0 || outpoint.hash != hashPrev) {
+                nTransactions++;
+                hashPrev = outpoint.hash;
+            }
+        } catch (const std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+        pcursor->Next();
+    }
+    return true;
+}
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
+bool CCoinsViewDB::UpgradeCoins()
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << std::make_pair('c', UINT256_ZERO);
+    pcursor->Seek(leveldb::Slice(&ssKeySet[0], ssKeySet.size()));
+    if (!pcursor->Valid() || pcursor->key()[0] != 'c')
+        return true;
+
+    const int64_t nStart = GetTimeMillis();
+    LogPrintf("Upgrading the UTXO database to per output records...\n");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    unsigned int nTxs = 0, nCoins = 0, nBatch = 0;
+    int nReportDone = 0;
+    CLevelDBBatch batch;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            break;
         try {
             leveldb::Slice slKey = pcursor->key();
             CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i = 0; i < coins.vout.size(); i++) {
-                    const CTxOut& out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i + 1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+            if (chType != 'c')
+                break;
+            uint256 txid;
+            ssKey >> txid;
+            // the records are sorted by txid, whose first byte tells the progress
+            int nPercentageDone = (int)(*txid.begin()) * 100 / 256;
+            if (nPercentageDone > nReportDone) {
+                uiInterface.ShowProgress(_("Upgrading UTXO database"), nPercentageDone);
+                nReportDone = nPercentageDone;
+            }
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CLegacyCoins old;
+            ssValue >> old;
+            for (size_t i = 0; i < old.vout.size(); i++) {
+                if (!old.vout[i].IsNull() && !old.vout[i].scriptPubKey.IsUnspendable()) {
+                    COutPoint outpoint(txid, i);
+                    batch.Write(CoinEntry(&outpoint), Coin(std::move(old.vout[i]), old.nHeight, old.fCoinBase, old.fCoinStake));
+                    nCoins++;
+                    nBatch++;
                 }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
             }
-            pcursor->Next();
+            // a transaction is converted in the batch that erases it, so an interrupted upgrade resumes cleanly
+            batch.Erase(std::make_pair('c', txid));
+            nTxs++;
+            if (++nBatch >= 100000) {
+                db.WriteBatch(batch);
+                batch.Clear();
+                nBatch = 0;
+            }
         } catch (const std::exception& e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
+        pcursor->Next();
     }
-    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
+    db.WriteBatch(batch);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("Upgraded %u transactions to %u unspent outputs in %dms\n", nTxs, nCoins, GetTimeMillis() - nStart);
+    return !ShutdownRequested();
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper("blockindex", GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
+{
+}
+
+bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
+{
+    return Write(std::make_pair('b', blockindex.GetBlockHash()), blockindex);
+}
+
+bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo& info)
+{
+    return Read(std::make_pair('f', nFile), info);
+}
+
+bool CBlockTreeDB::WriteReindexing(bool fReindexing)
+{
+    if (fReindexing)
+        return Write('R', '1');
+    else
+        return Erase('R');
+}
+
+bool CBlockTreeDB::ReadReindexing(bool& fReindexing)
+{
+    fReindexing = Exists('R');
     return true;
 }
 
+bool CBlockTreeDB::ReadLastBlockFile(int& nFile)
+{
+    return Read('l', nFile);
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CLevelDBBatch batch;
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
@@ -272,7 +609,7 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
     return true;
 }
 
-CZerocoinDB::CZerocoinDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "zerocoin", nCacheSize, fMemory, fWipe)
+CZerocoinDB::CZerocoinDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper("zerocoin", GetDataDir() / "zerocoin", nCacheSize, fMemory, fWipe)
 {
 }
 
@@ -9,6 +9,7 @@
 
 #include "leveldbwrapper.h"
 #include "main.h"
+#include "sync.h"
 #include "zpiv/zerocoin.h"
 
 #include <map>
@@ -16,7 +17,8 @@
 #include <utility>
 #include <vector>
 
-class CCoins;
+#include <boost/thread.hpp>
+
 class uint256;
 
 //! -dbcache default (MiB)
@@ -54,7 +56,14 @@ struct CDiskTxPos : public CDiskBlockPos {
     }
 };
 
-/** CCoinsView backed by the LevelDB coin database (chainstate/) */
+/**
+ * CCoinsView backed by the LevelDB coin database (chainstate/)
+ *
+ * Writes are done behind: BatchWrite takes over the flushed coins and returns, and a
+ * writer thread, running for the lifetime of the view, writes them in one batch with the
+ * best block. Until that batch is written the coins are served from memory. A single write
+ * is in flight at a time, a flush while one is waits for it.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
@@ -62,12 +71,52 @@ protected:
 
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
-    bool GetCoins(const uint256& txid, CCoins& coins) const;
-    bool HaveCoins(const uint256& txid) const;
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
     uint256 GetBestBlock() const;
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, const CCoinsStats& changes);
     bool GetStats(CCoinsStats& stats) const;
+
+    //! Wait for the write in flight, returns false if it failed
+    bool Sync();
+
+    //! Memory used by the coins of the write in flight
+    size_t PendingMemoryUsage() const;
+
+    //! Count the transactions with unspent outputs, scanning the whole database
+    bool CountTransactions(uint64_t& nTransactions);
+
+    //! Convert the per-transaction records of older versions to per-output records,
+    //! and compute the set statistics which older versions didn't keep
+    bool Upgrade();
+
+private:
+    //! Statistics of the set in the database, as of its best block
+    CCoinsStats stats;
+
+    //! Protects the coins being written, read by the write thread
+    mutable RecursiveMutex cs_pending;
+    CCoinsMap mapPending;
+    uint256 hashBlockPending;
+    CCoinsStats statsPending;
+    size_t nPendingUsage;
+    bool fPending;
+    bool fWriteFailed;
+
+    //! Hands the writes to the writer thread and tells it to stop
+    boost::mutex mutexWrite;
+    boost::condition_variable condWrite;
+    bool fWriteQueued;
+    bool fStopWriter;
+    boost::thread threadWrite;
+
+    void ThreadWrite();
+    void WritePending();
+
+    bool UpgradeCoins();
+    bool ComputeStats();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -11,7 +11,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 80810;
+static const int PROTOCOL_VERSION = 80812;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -19,6 +19,12 @@ static const int INIT_PROTO_VERSION = 209;
 //! In this version, 'getheaders' was introduced.
 static const int GETHEADERS_VERSION = 70077;
 
+//! In this version, 'getheaders' is answered with a 'headers' message instead of block invs
+static const int HEADERS_FIRST_VERSION = 80811;
+
+//! "sendcmpct", "cmpctblock", "getblocktxn" and "blocktxn" messages start with this version
+static const int COMPACT_BLOCKS_VERSION = 80812;
+
 //! disconnect from peers older than this proto version
 static const int MIN_PEER_PROTO_VERSION_BEFORE_ENFORCEMENT = 70810;
 static const int MIN_PEER_PROTO_VERSION_AFTER_ENFORCEMENT = 80810;
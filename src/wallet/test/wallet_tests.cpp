@@ -20,6 +20,7 @@
 // we repeat those tests this many times and only complain if all iterations of the test fail
 #define RANDOM_REPEATS 5
 
+extern CWallet* pwalletMain;
 
 typedef std::set<std::pair<const CWalletTx*,unsigned int> > CoinSet;
 
@@ -266,8 +267,8 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
             for (int i2 = 0; i2 < 100; i2++)
                 add_coin(COIN);
 
-            // picking 50 from 100 coins doesn't depend on the shuffle,
-            // but does depend on randomness in the stochastic approximation code
+            // picking 50 from 100 identical coins depends on the shuffle, which orders
+            // the coins of the same value in the subset search
             BOOST_CHECK(wallet.SelectCoinsMinConf(50 * COIN, 1, 6, vCoins, setCoinsRet , nValueRet));
             BOOST_CHECK(wallet.SelectCoinsMinConf(50 * COIN, 1, 6, vCoins, setCoinsRet2, nValueRet));
             BOOST_CHECK(!equal_sets(setCoinsRet, setCoinsRet2));
@@ -305,4 +306,517 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(coin_selection_bnb_tests)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+
+    // taking the largest coins first overshoots, the search backtracks to the exact pair
+    empty_wallet();
+    add_coin(7 * CENT);
+    add_coin(5 * CENT);
+    add_coin(4 * CENT);
+    add_coin(3 * CENT);
+    BOOST_CHECK(wallet.SelectCoinsMinConf(8 * CENT, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 8 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+
+    // among many coins of the same value, only the odd coin makes the exact amount
+    empty_wallet();
+    for (int i = 0; i < 20000; i++)
+        add_coin(COIN);
+    add_coin(0.37 * COIN);
+    BOOST_CHECK(wallet.SelectCoinsMinConf(100.37 * COIN, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 100.37 * COIN);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 101U);
+
+    // no exact subset, the least value above the target without sub-cent change
+    empty_wallet();
+    for (int i = 0; i < 1000; i++)
+        add_coin(3 * COIN);
+    BOOST_CHECK(wallet.SelectCoinsMinConf(100 * COIN, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 102 * COIN);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 34U);
+
+    empty_wallet();
+}
+
+static CWalletTx AddTxTo(const CScript& script, CAmount nValue, const uint256& hashBlock, const COutPoint& prevout = COutPoint())
+{
+    CMutableTransaction tx;
+    if (!prevout.IsNull())
+        tx.vin.emplace_back(prevout);
+    tx.vout.emplace_back(nValue, script);
+    CWalletTx wtx(pwalletMain, tx);
+    if (!hashBlock.IsNull()) {
+        wtx.hashBlock = hashBlock;
+        wtx.nIndex = 1;
+    }
+    BOOST_CHECK(pwalletMain->AddToWallet(wtx, false, nullptr));
+    return wtx;
+}
+
+static std::set<COutPoint> StakeCandidateOutPoints()
+{
+    std::vector<CStakeCandidate> vCandidates;
+    pwalletMain->GetStakeCandidates(vCandidates);
+    std::set<COutPoint> ret;
+    for (const CStakeCandidate& candidate : vCandidates)
+        ret.insert(candidate.GetOutPoint());
+    return ret;
+}
+
+static std::set<COutPoint> StakeableCoinsOutPoints()
+{
+    std::vector<COutput> vCoins;
+    pwalletMain->StakeableCoins(&vCoins);
+    std::set<COutPoint> ret;
+    for (const COutput& out : vCoins)
+        ret.insert(COutPoint(out.tx->GetHash(), out.i));
+    return ret;
+}
+
+// Extend the active chain past the stake min depth with dummy block indexes
+static void ExtendDummyChain(std::vector<CBlockIndex>& vBlocks, std::vector<uint256>& vHashes)
+{
+    CBlockIndex* pindexTip = chainActive.Tip();
+    const int nBlocks = Params().GetConsensus().nStakeMinDepth + 10;
+    vHashes.resize(nBlocks);
+    vBlocks.resize(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        vHashes[i] = InsecureRand256();
+        vBlocks[i].phashBlock = &vHashes[i];
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : pindexTip;
+        vBlocks[i].nHeight = pindexTip->nHeight + i + 1;
+        vBlocks[i].nTime = pindexTip->nTime + 60 * (i + 1);
+        mapBlockIndex[vHashes[i]] = &vBlocks[i];
+    }
+    chainActive.SetTip(&vBlocks.back());
+}
+
+BOOST_AUTO_TEST_CASE(stake_candidates_tests)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    BOOST_CHECK(pwalletMain->AddKey(key));
+
+    // Extend the chain past the stake min depth with dummy block indexes
+    CBlockIndex* pindexTip = chainActive.Tip();
+    std::vector<uint256> vHashes;
+    std::vector<CBlockIndex> vBlocks;
+    ExtendDummyChain(vBlocks, vHashes);
+
+    // Deep enough, too shallow and unconfirmed outputs
+    const CWalletTx wtxDeep = AddTxTo(script, 100 * COIN, vHashes[0]);
+    AddTxTo(script, 101 * COIN, vHashes.back());
+    AddTxTo(script, 102 * COIN, UINT256_ZERO);
+    const COutPoint outDeep(wtxDeep.GetHash(), 0);
+
+    std::vector<CStakeCandidate> vCandidates;
+    BOOST_CHECK(pwalletMain->GetStakeCandidates(vCandidates));
+    BOOST_CHECK_EQUAL(vCandidates.size(), 1);
+    BOOST_CHECK(vCandidates[0].GetOutPoint() == outDeep);
+    BOOST_CHECK(vCandidates[0].GetIndexFrom() == &vBlocks[0]);
+    BOOST_CHECK_EQUAL(vCandidates[0].GetValue(), 100 * COIN);
+    CPivStake stake;
+    stake.SetPrevout(wtxDeep, 0);
+    BOOST_CHECK(vCandidates[0].GetUniqueness().str() == stake.GetUniqueness().str());
+    BOOST_CHECK(StakeCandidateOutPoints() == StakeableCoinsOutPoints());
+
+    // Outputs added to the wallet afterwards are picked up
+    const CWalletTx wtxDeep2 = AddTxTo(script, 50 * COIN, vHashes[1]);
+    const COutPoint outDeep2(wtxDeep2.GetHash(), 0);
+    BOOST_CHECK_EQUAL(StakeCandidateOutPoints().size(), 2);
+    BOOST_CHECK(StakeCandidateOutPoints() == StakeableCoinsOutPoints());
+
+    // Locked coins do not stake
+    pwalletMain->LockCoin(outDeep);
+    BOOST_CHECK(StakeCandidateOutPoints() == std::set<COutPoint>{outDeep2});
+    pwalletMain->UnlockCoin(outDeep);
+    BOOST_CHECK_EQUAL(StakeCandidateOutPoints().size(), 2);
+
+    // Spent coins do not stake
+    AddTxTo(script, 99 * COIN, UINT256_ZERO, outDeep);
+    BOOST_CHECK(StakeCandidateOutPoints() == std::set<COutPoint>{outDeep2});
+    BOOST_CHECK(StakeCandidateOutPoints() == StakeableCoinsOutPoints());
+
+    // Coins of blocks no longer in the active chain do not stake
+    chainActive.SetTip(pindexTip);
+    BOOST_CHECK(StakeCandidateOutPoints().empty());
+
+    for (const uint256& hash : vHashes)
+        mapBlockIndex.erase(hash);
+}
+
+static std::set<COutPoint> AvailableOutPoints()
+{
+    std::vector<COutput> vCoins;
+    pwalletMain->AvailableCoins(&vCoins);
+    std::set<COutPoint> ret;
+    for (const COutput& out : vCoins)
+        ret.insert(COutPoint(out.tx->GetHash(), out.i));
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(available_coins_tests)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    BOOST_CHECK(pwalletMain->AddKey(key));
+
+    CBlockIndex* pindexTip = chainActive.Tip();
+    std::vector<uint256> vHashes;
+    std::vector<CBlockIndex> vBlocks;
+    ExtendDummyChain(vBlocks, vHashes);
+    const std::set<COutPoint> setInitial = AvailableOutPoints();
+
+    // Outputs to others are not indexed
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    AddTxTo(GetScriptForDestination(keyOther.GetPubKey().GetID()), 5 * COIN, vHashes[0]);
+    BOOST_CHECK(AvailableOutPoints() == setInitial);
+
+    const COutPoint out1(AddTxTo(script, 20 * COIN, vHashes[0]).GetHash(), 0);
+    const COutPoint out2(AddTxTo(script, 21 * COIN, vHashes[1]).GetHash(), 0);
+    std::set<COutPoint> setExpected = setInitial;
+    setExpected.insert(out1);
+    setExpected.insert(out2);
+    BOOST_CHECK(AvailableOutPoints() == setExpected);
+
+    // Spent outputs leave the index, and are back once the spend is abandoned
+    const CWalletTx wtxSpend = AddTxTo(script, 19 * COIN, UINT256_ZERO, out1);
+    setExpected.erase(out1);
+    BOOST_CHECK(AvailableOutPoints() == setExpected);
+    BOOST_CHECK(pwalletMain->AbandonTransaction(wtxSpend.GetHash()));
+    setExpected.insert(out1);
+    BOOST_CHECK(AvailableOutPoints() == setExpected);
+
+    // Outputs of blocks no longer in the active chain are unconfirmed
+    chainActive.SetTip(pindexTip);
+    BOOST_CHECK(AvailableOutPoints() == setInitial);
+
+    for (const uint256& hash : vHashes)
+        mapBlockIndex.erase(hash);
+}
+
+// The cached balances must match the ones computed from scratch
+static CWalletBalance CheckedBalances()
+{
+    const CWalletBalance balance = pwalletMain->GetBalances();
+    pwalletMain->MarkBalanceDirty();
+    const CWalletBalance fresh = pwalletMain->GetBalances();
+    BOOST_CHECK_EQUAL(balance.nBalance, fresh.nBalance);
+    BOOST_CHECK_EQUAL(balance.nUnconfirmed, fresh.nUnconfirmed);
+    BOOST_CHECK_EQUAL(balance.nImmature, fresh.nImmature);
+    BOOST_CHECK_EQUAL(balance.nStakingOwn, fresh.nStakingOwn);
+    BOOST_CHECK_EQUAL(balance.nLocked, fresh.nLocked);
+    BOOST_CHECK_EQUAL(balance.nUnlocked, fresh.nUnlocked);
+    return balance;
+}
+
+BOOST_AUTO_TEST_CASE(balance_cache_tests)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    BOOST_CHECK(pwalletMain->AddKey(key));
+
+    CBlockIndex* pindexTip = chainActive.Tip();
+    std::vector<uint256> vHashes;
+    std::vector<CBlockIndex> vBlocks;
+    ExtendDummyChain(vBlocks, vHashes);
+    const CWalletBalance initial = CheckedBalances();
+
+    // Confirmed transactions are added to the balance, deep enough ones to the staking balance
+    const CWalletTx wtxDeep = AddTxTo(script, 100 * COIN, vHashes[0]);
+    AddTxTo(script, 10 * COIN, vHashes.back());
+    const COutPoint outDeep(wtxDeep.GetHash(), 0);
+    CWalletBalance balance = CheckedBalances();
+    BOOST_CHECK_EQUAL(balance.nBalance, initial.nBalance + 110 * COIN);
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), balance.nBalance);
+    BOOST_CHECK_EQUAL(pwalletMain->GetStakingBalance(false), initial.nStakingOwn + 100 * COIN);
+
+    // Locked coins don't stake
+    pwalletMain->LockCoin(outDeep);
+    BOOST_CHECK_EQUAL(pwalletMain->GetStakingBalance(false), initial.nStakingOwn);
+    BOOST_CHECK_EQUAL(CheckedBalances().nLocked, initial.nLocked + 100 * COIN);
+    pwalletMain->UnlockCoin(outDeep);
+    BOOST_CHECK_EQUAL(pwalletMain->GetStakingBalance(false), initial.nStakingOwn + 100 * COIN);
+
+    // Spent coins leave the balance
+    AddTxTo(script, 99 * COIN, UINT256_ZERO, outDeep);
+    BOOST_CHECK_EQUAL(CheckedBalances().nBalance, initial.nBalance + 10 * COIN);
+
+    // So do the coins of blocks no longer in the active chain
+    chainActive.SetTip(pindexTip);
+    BOOST_CHECK_EQUAL(CheckedBalances().nBalance, initial.nBalance);
+
+    for (const uint256& hash : vHashes)
+        mapBlockIndex.erase(hash);
+}
+
+// Proof of stake blocks written to disk on top of the chain tip, every fourth paying to script
+static void WriteDummyBlocks(std::vector<CBlockIndex>& vBlocks, std::vector<uint256>& vHashes, std::vector<CTransaction>& vPayments, const CScript& script)
+{
+    CBlockIndex* pindexTip = chainActive.Tip();
+    const int nBlocks = 40;
+    vHashes.resize(nBlocks);
+    vBlocks.resize(nBlocks);
+    CDiskBlockPos pos(1, 0);
+    for (int i = 0; i < nBlocks; i++) {
+        CBlock block;
+        block.nVersion = 5;
+        block.hashPrevBlock = pindexTip->GetBlockHash();
+        block.nTime = pindexTip->nTime + 60 * (i + 1);
+
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << (pindexTip->nHeight + i + 1) << OP_0;
+        coinbase.vout.resize(1);
+        block.vtx.push_back(coinbase);
+
+        CMutableTransaction coinstake;
+        coinstake.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+        coinstake.vout.resize(2);
+        coinstake.vout[0].SetEmpty();
+        coinstake.vout[1] = CTxOut(10 * COIN, CScript() << OP_TRUE);
+        block.vtx.push_back(coinstake);
+
+        CMutableTransaction payment;
+        payment.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+        payment.vout.emplace_back(COIN, i % 4 == 0 ? script : CScript() << OP_TRUE);
+        block.vtx.push_back(payment);
+        if (i % 4 == 0)
+            vPayments.push_back(payment);
+
+        // the last block spends the first payment
+        if (i == nBlocks - 1) {
+            CMutableTransaction spend;
+            spend.vin.emplace_back(COutPoint(vPayments[0].GetHash(), 0));
+            spend.vout.emplace_back(COIN / 2, CScript() << OP_TRUE);
+            block.vtx.push_back(spend);
+            vPayments.push_back(spend);
+        }
+
+        BOOST_CHECK(WriteBlockToDisk(block, pos));
+        vHashes[i] = block.GetHash();
+        vBlocks[i].phashBlock = &vHashes[i];
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : pindexTip;
+        vBlocks[i].nHeight = pindexTip->nHeight + i + 1;
+        vBlocks[i].nTime = block.nTime;
+        vBlocks[i].nFile = pos.nFile;
+        vBlocks[i].nDataPos = pos.nPos;
+        vBlocks[i].nStatus |= BLOCK_HAVE_DATA;
+        mapBlockIndex[vHashes[i]] = &vBlocks[i];
+        pos.nPos += ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    }
+    chainActive.SetTip(&vBlocks.back());
+}
+
+BOOST_AUTO_TEST_CASE(rescan_tests)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+
+    CBlockIndex* pindexGenesis = chainActive.Tip();
+    std::vector<CBlockIndex> vBlocks;
+    std::vector<uint256> vHashes;
+    std::vector<CTransaction> vPayments;
+    WriteDummyBlocks(vBlocks, vHashes, vPayments, script);
+
+    size_t nWalletTxs;
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->AddKey(key));
+        pwalletMain->nTimeFirstKey = 1;
+        nWalletTxs = pwalletMain->mapWallet.size();
+    }
+
+    // the payments, and the spend of one of them matched by its input
+    BOOST_CHECK_EQUAL(pwalletMain->ScanForWalletTransactions(pindexGenesis, true), 11);
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK_EQUAL(pwalletMain->mapWallet.size(), nWalletTxs + 11);
+        for (size_t i = 0; i < vPayments.size(); i++) {
+            BOOST_CHECK(pwalletMain->mapWallet.count(vPayments[i].GetHash()));
+            BOOST_CHECK(pwalletMain->mapWallet[vPayments[i].GetHash()].hashBlock == (i < 10 ? vHashes[4 * i] : vHashes.back()));
+        }
+        BOOST_CHECK(pwalletMain->IsSpent(vPayments[0].GetHash(), 0));
+    }
+
+    // the same with blocks read and matched by worker threads
+    mapArgs["-rescanthreads"] = "4";
+    BOOST_CHECK_EQUAL(pwalletMain->ScanForWalletTransactions(pindexGenesis, true), 11);
+    BOOST_CHECK_EQUAL(pwalletMain->ScanForWalletTransactions(&vBlocks[20], true), 6);
+    mapArgs.erase("-rescanthreads");
+
+    // a completed scan leaves no progress to resume
+    CBlockLocator locator;
+    BOOST_CHECK(!CWalletDB(pwalletMain->strWalletFile).ReadRescanProgress(locator));
+
+    chainActive.SetTip(pindexGenesis);
+    for (const uint256& hash : vHashes)
+        mapBlockIndex.erase(hash);
+}
+
+BOOST_AUTO_TEST_CASE(rescan_tip_advance_tests)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+
+    CBlockIndex* pindexGenesis = chainActive.Tip();
+    std::vector<CBlockIndex> vBlocks;
+    std::vector<uint256> vHashes;
+    std::vector<CTransaction> vPayments;
+    WriteDummyBlocks(vBlocks, vHashes, vPayments, script);
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->AddKey(key));
+        pwalletMain->nTimeFirstKey = 1;
+    }
+
+    // the rest of the blocks connect while the rescan adds the payment of what was the tip,
+    // after every block up to it was queued
+    const uint256 hashLastQueued = vPayments[2].GetHash();
+    boost::signals2::connection connection = pwalletMain->NotifyTransactionChanged.connect(
+        [&](CWallet* wallet, const uint256& hashTx, ChangeType status) {
+            if (hashTx == hashLastQueued && chainActive.Tip() == &vBlocks[8])
+                chainActive.SetTip(&vBlocks.back());
+        });
+
+    for (const char* strThreads : {"1", "4"}) {
+        chainActive.SetTip(&vBlocks[8]);
+        mapArgs["-rescanthreads"] = strThreads;
+        BOOST_CHECK_EQUAL(pwalletMain->ScanForWalletTransactions(pindexGenesis, true), 11);
+        BOOST_CHECK(chainActive.Tip() == &vBlocks.back());
+        LOCK(pwalletMain->cs_wallet);
+        for (const CTransaction& tx : vPayments)
+            BOOST_CHECK(pwalletMain->mapWallet.count(tx.GetHash()));
+    }
+    mapArgs.erase("-rescanthreads");
+    connection.disconnect();
+
+    chainActive.SetTip(pindexGenesis);
+    for (const uint256& hash : vHashes)
+        mapBlockIndex.erase(hash);
+}
+
+BOOST_AUTO_TEST_CASE(block_sync_batch_tests)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->AddKey(key));
+    }
+
+    // a block of a busy staking wallet: payments to it among unrelated transactions, and a spend of one of them
+    CBlock block;
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < 20; i++) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+        tx.vout.emplace_back(COIN, i % 2 == 0 ? script : CScript() << OP_TRUE);
+        block.vtx.push_back(tx);
+        if (i % 2 == 0)
+            vHashes.push_back(tx.GetHash());
+    }
+    CMutableTransaction spend;
+    spend.vin.emplace_back(COutPoint(vHashes[0], 0));
+    spend.vout.emplace_back(COIN / 2, CScript() << OP_TRUE);
+    block.vtx.push_back(spend);
+    vHashes.push_back(spend.GetHash());
+
+    pwalletMain->SyncTransactions(block.vtx, &block);
+
+    std::vector<uint256> vTxHash;
+    std::vector<CWalletTx> vWtx;
+    BOOST_CHECK(CWalletDB(pwalletMain->strWalletFile).FindWalletTx(pwalletMain, vTxHash, vWtx) == DB_LOAD_OK);
+    {
+        LOCK(pwalletMain->cs_wallet);
+        for (const uint256& hash : vHashes) {
+            BOOST_CHECK(pwalletMain->mapWallet.count(hash));
+            BOOST_CHECK(std::find(vTxHash.begin(), vTxHash.end(), hash) != vTxHash.end());
+        }
+        BOOST_CHECK(pwalletMain->IsSpent(vHashes[0], 0));
+    }
+
+    // all updates of the block are committed together: a failure halfway through
+    // the block leaves none of them on disk, where separate writes would keep the first ones
+    CBlock blockFailed;
+    std::vector<uint256> vHashesFailed;
+    for (int i = 0; i < 5; i++) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+        tx.vout.emplace_back(COIN, script);
+        blockFailed.vtx.push_back(tx);
+        vHashesFailed.push_back(tx.GetHash());
+    }
+    int nNotified = 0;
+    {
+        boost::signals2::scoped_connection conn(pwalletMain->NotifyTransactionChanged.connect(
+            [&nNotified](CWallet*, const uint256&, ChangeType) {
+                if (++nNotified == 3)
+                    throw std::runtime_error("wallet update failed");
+            }));
+        BOOST_CHECK_THROW(pwalletMain->SyncTransactions(blockFailed.vtx, &blockFailed), std::runtime_error);
+    }
+    BOOST_CHECK_EQUAL(nNotified, 3);
+    vTxHash.clear();
+    vWtx.clear();
+    BOOST_CHECK(CWalletDB(pwalletMain->strWalletFile).FindWalletTx(pwalletMain, vTxHash, vWtx) == DB_LOAD_OK);
+    for (const uint256& hash : vHashesFailed)
+        BOOST_CHECK(std::find(vTxHash.begin(), vTxHash.end(), hash) == vTxHash.end());
+}
+
+BOOST_AUTO_TEST_CASE(wallet_load_tests)
+{
+    // more transaction records than the loader unserializes in one batch
+    std::vector<CMutableTransaction> vTxs(2500);
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    for (size_t i = 0; i < vTxs.size(); i++) {
+        vTxs[i].vin.emplace_back(COutPoint(InsecureRand256(), 0));
+        vTxs[i].vout.emplace_back(COIN, CScript() << OP_TRUE);
+        CWalletTx wtx(pwalletMain, vTxs[i]);
+        wtx.nOrderPos = 100000 + i;
+        wtx.mapValue["comment"] = strprintf("%d", i);
+        BOOST_CHECK(walletdb.WriteTx(wtx.GetHash(), wtx));
+    }
+
+    // a later double spend of the first one, which takes its metadata once loaded
+    CMutableTransaction txDoubleSpend;
+    txDoubleSpend.vin.push_back(vTxs[0].vin[0]);
+    txDoubleSpend.vout.emplace_back(COIN / 2, CScript() << OP_TRUE);
+    CWalletTx wtxDoubleSpend(pwalletMain, txDoubleSpend);
+    wtxDoubleSpend.nOrderPos = 200000;
+    BOOST_CHECK(walletdb.WriteTx(wtxDoubleSpend.GetHash(), wtxDoubleSpend));
+
+    for (const char* threads : {"1", "4"}) {
+        mapArgs["-walletloadthreads"] = threads;
+        CWallet wallet(pwalletMain->strWalletFile);
+        // records left by other suites in the shared mock database may be unreadable
+        BOOST_CHECK(walletdb.LoadWallet(&wallet) != DB_CORRUPT);
+        LOCK(wallet.cs_wallet);
+        for (size_t i = 0; i < vTxs.size(); i++) {
+            BOOST_CHECK(wallet.mapWallet.count(vTxs[i].GetHash()));
+            BOOST_CHECK_EQUAL(wallet.mapWallet[vTxs[i].GetHash()].nOrderPos, 100000 + (int64_t)i);
+        }
+        BOOST_CHECK_EQUAL(wallet.mapWallet[wtxDoubleSpend.GetHash()].mapValue["comment"], "0");
+    }
+    mapArgs.erase("-walletloadthreads");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -15,6 +15,7 @@
 #include "spork.h"
 #include "swifttx.h"    // mapTxLockReq
 #include "util.h"
+#include "util/memory.h"
 #include "utilmoneystr.h"
 #include "zpivchain.h"
 
@@ -775,10 +776,12 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
     return false;
 }
 
-void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
+void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid, bool fSyncMetaData)
 {
     mapTxSpends.insert(std::make_pair(outpoint, wtxid));
     setLockedCoins.erase(outpoint);
+    if (!fSyncMetaData)
+        return;
 
     std::pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
@@ -786,7 +789,7 @@ void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 }
 
 
-void CWallet::AddToSpends(const uint256& wtxid)
+void CWallet::AddToSpends(const uint256& wtxid, bool fSyncMetaData)
 {
     assert(mapWallet.count(wtxid));
     CWalletTx& thisTx = mapWallet[wtxid];
@@ -794,7 +797,20 @@ void CWallet::AddToSpends(const uint256& wtxid)
         return;
 
     for (const CTxIn& txin : thisTx.vin)
-        AddToSpends(txin.prevout, wtxid);
+        AddToSpends(txin.prevout, wtxid, fSyncMetaData);
+}
+
+void CWallet::SyncAllMetaData()
+{
+    LOCK(cs_wallet);
+    TxSpends::iterator it = mapTxSpends.begin();
+    while (it != mapTxSpends.end()) {
+        std::pair<TxSpends::iterator, TxSpends::iterator> range = mapTxSpends.equal_range(it->first);
+        // only outpoints spent more than once have metadata to share
+        if (std::next(range.first) != range.second)
+            SyncMetaData(range);
+        it = range.second;
+    }
 }
 
 bool CWallet::GetVinAndKeysFromOutput(COutput out, CTxIn& txinRet, CPubKey& pubKeyRet, CKey& keyRet, bool fColdStake)
@@ -1077,19 +1093,29 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         for (PAIRTYPE(const uint256, CWalletTx) & item : mapWallet)
             item.second.MarkDirty();
+        // Called after keys or scripts were imported, which may own more outputs
+        InvalidateOutputIndexes();
     }
 }
 
+void CWallet::InvalidateOutputIndexes()
+{
+    AssertLockHeld(cs_wallet);
+    fStakeCandidatesValid = false;
+    fAvailableCoinsValid = false;
+}
+
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb)
 {
     uint256 hash = wtxIn.GetHash();
 
     if (fFromLoadWallet) {
-        mapWallet[hash] = wtxIn;
+        // the metadata of conflicting spends is synced once the load completes, by SyncAllMetaData
         CWalletTx& wtx = mapWallet[hash];
+        wtx = wtxIn;
         wtx.BindWallet(this);
         wtxOrdered.insert(std::make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
-        AddToSpends(hash);
+        AddToSpends(hash, false);
     } else {
         LOCK(cs_wallet);
         // Inserts only if not already there, returns tx inserted or tx found
@@ -1148,6 +1174,12 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         // Break debit/credit balance caches:
         wtx.MarkDirty();
 
+        // Refresh the outputs that may be spent or stake
+        if (fAvailableCoinsValid)
+            AddAvailableCoins(wtx);
+        if (fStakeCandidatesValid)
+            AddStakeCandidates(wtx);
+
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
@@ -1193,6 +1225,8 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
             // Get merkle branch if transaction was found in a block
             if (pblock)
                 wtx.SetMerkleBranch(*pblock);
+            if (pwalletdbBatch)
+                return AddToWallet(wtx, false, pwalletdbBatch);
             // Do not flush the wallet here for performance reasons
             // this is safe, as in case of a crash, we rescan the necessary blocks on startup through our SetBestChain-mechanism
             CWalletDB walletdb(strWalletFile, "r+", false);
@@ -1220,6 +1254,8 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
     }
 
     todo.insert(hashTx);
+    // Coins spent by abandoned transactions may be spent or stake again
+    InvalidateOutputIndexes();
 
     while (!todo.empty()) {
         uint256 now = *todo.begin();
@@ -1274,12 +1310,19 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
     assert(conflictconfirms < 0);
 
     // Do not flush the wallet here for performance reasons
-    CWalletDB walletdb(strWalletFile, "r+", false);
+    std::unique_ptr<CWalletDB> walletdb;
+    CWalletDB* pwalletdb = pwalletdbBatch;
+    if (!pwalletdb) {
+        walletdb = MakeUnique<CWalletDB>(strWalletFile, "r+", false);
+        pwalletdb = walletdb.get();
+    }
 
     std::set<uint256> todo;
     std::set<uint256> done;
 
     todo.insert(hashTx);
+    // Coins spent by conflicted transactions may be spent or stake again
+    InvalidateOutputIndexes();
 
     while (!todo.empty()) {
         uint256 now = *todo.begin();
@@ -1294,7 +1337,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             wtx.nIndex = -1;
             wtx.hashBlock = hashBlock;
             wtx.MarkDirty();
-            wtx.WriteToDisk(&walletdb);
+            wtx.WriteToDisk(pwalletdb);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them conflicted too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(now, 0));
             while (iter != mapTxSpends.end() && iter->first.hash == now) {
@@ -1320,6 +1363,10 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     if (!AddToWalletIfInvolvingMe(tx, pblock, true))
         return; // Not one of ours
 
+    // A disconnected coinstake no longer spends its inputs
+    if (!pblock && tx.IsCoinStake())
+        InvalidateOutputIndexes();
+
     // If a transaction changes 'conflicted' state, that changes the balance
     // available of the outputs it spends. So force those to be
     // recomputed, also:
@@ -1329,6 +1376,44 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     }
 }
 
+/**
+ * Sync the transactions of a block, writing the wallet updates in one database transaction
+ * instead of committing every write on its own.
+ */
+void CWallet::SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock)
+{
+    LOCK(cs_wallet);
+    if (!fFileBacked) {
+        for (const CTransaction& tx : vtx)
+            SyncTransaction(tx, pblock);
+        return;
+    }
+
+    const int64_t nTimeStart = GetTimeMicros();
+    const unsigned int nUpdatedStart = nWalletDBUpdated;
+    CWalletDB walletdb(strWalletFile, "r+", false);
+    const bool fBatch = walletdb.TxnBegin();
+    if (fBatch)
+        pwalletdbBatch = &walletdb;
+    try {
+        for (const CTransaction& tx : vtx)
+            SyncTransaction(tx, pblock);
+    } catch (...) {
+        pwalletdbBatch = nullptr;
+        if (fBatch)
+            walletdb.TxnAbort();
+        throw;
+    }
+    pwalletdbBatch = nullptr;
+    if (fBatch && !walletdb.TxnCommit())
+        LogPrintf("%s: failed to commit the wallet updates of block %s\n", __func__, pblock ? pblock->GetHash().ToString() : "(disconnected)");
+
+    const unsigned int nWrites = nWalletDBUpdated - nUpdatedStart;
+    if (nWrites)
+        LogPrint("bench", "  - Wallet sync: %u writes of %u transactions in %s, %.2fms\n", nWrites, vtx.size(),
+                 fBatch ? "one commit" : "separate commits", (GetTimeMicros() - nTimeStart) * 0.001);
+}
+
 void CWallet::EraseFromWallet(const uint256& hash)
 {
     if (!fFileBacked)
@@ -1337,6 +1422,7 @@ void CWallet::EraseFromWallet(const uint256& hash)
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
+        InvalidateOutputIndexes();
         LogPrintf("%s: Erased wtx %s from wallet\n", __func__, hash.GetHex());
     }
     return;
@@ -1856,6 +1942,140 @@ bool CWalletTx::WriteToDisk(CWalletDB *pwalletdb)
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+namespace {
+
+/** A block ahead of the rescan, with the transactions paying to the wallet */
+struct CRescanBlock
+{
+    CBlockIndex* pindex;
+    CBlock block;
+    std::vector<bool> vfMine;
+    bool fRead{false};
+    bool fClaimed{false};
+    bool fDone{false};
+
+    explicit CRescanBlock(CBlockIndex* pindexIn) : pindex(pindexIn) {}
+};
+
+/**
+ * Blocks queued ahead of the rescan. Worker threads, and the rescan while it waits,
+ * read them from disk and match their outputs against the keystore in parallel.
+ * The rescan takes them back in chain order to add the matches to the wallet.
+ */
+class CRescanQueue
+{
+private:
+    const CWallet& wallet;
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    boost::condition_variable condDone;
+    std::deque<CRescanBlock> queue;
+    bool fQuit{false};
+    boost::thread_group workers;
+
+    CRescanBlock* Claim()
+    {
+        for (CRescanBlock& entry : queue) {
+            if (!entry.fClaimed) {
+                entry.fClaimed = true;
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    // Called with the mutex held, released while working on the block
+    void Process(boost::unique_lock<boost::mutex>& lock, CRescanBlock& entry)
+    {
+        lock.unlock();
+        entry.fRead = ReadBlockFromDisk(entry.block, entry.pindex);
+        entry.vfMine.reserve(entry.block.vtx.size());
+        for (const CTransaction& tx : entry.block.vtx)
+            entry.vfMine.push_back(wallet.IsMine(tx));
+        lock.lock();
+        entry.fDone = true;
+        condDone.notify_all();
+    }
+
+    void Thread()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (true) {
+            CRescanBlock* entry = nullptr;
+            while (!fQuit && !(entry = Claim()))
+                condWork.wait(lock);
+            if (fQuit)
+                return;
+            Process(lock, *entry);
+        }
+    }
+
+public:
+    CRescanQueue(const CWallet& walletIn, int nWorkers) : wallet(walletIn)
+    {
+        for (int i = 0; i < nWorkers; i++)
+            workers.create_thread(boost::bind(&CRescanQueue::Thread, this));
+    }
+
+    ~CRescanQueue()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fQuit = true;
+        }
+        condWork.notify_all();
+        workers.join_all();
+    }
+
+    size_t Size()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return queue.size();
+    }
+
+    void Push(CBlockIndex* pindex)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        queue.emplace_back(pindex);
+        condWork.notify_one();
+    }
+
+    /** The first block of the queue, once processed */
+    CRescanBlock& Front()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        assert(!queue.empty());
+        CRescanBlock& front = queue.front();
+        while (!front.fDone) {
+            CRescanBlock* entry = Claim();
+            if (entry)
+                Process(lock, *entry);
+            else
+                condDone.wait(lock);
+        }
+        return front;
+    }
+
+    void Pop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        queue.pop_front();
+    }
+
+    /** Drop the queued blocks, once the workers are done with them */
+    void Clear()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (CRescanBlock& entry : queue) {
+            while (entry.fClaimed && !entry.fDone)
+                condDone.wait(lock);
+        }
+        queue.clear();
+    }
+};
+
+} // namespace
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -1864,12 +2084,27 @@ bool CWalletTx::WriteToDisk(CWalletDB *pwalletdb)
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, bool fromStartup)
 {
+    AssertLockNotHeld(cs_main);
+    AssertLockNotHeld(cs_wallet);
+
+    if (fScanningWallet.exchange(true)) {
+        LogPrintf("%s: a rescan is already running\n", __func__);
+        return -1;
+    }
+    struct ScanningReset {
+        std::atomic<bool>& fScanning;
+        ~ScanningReset() { fScanning = false; }
+    } scanningReset{fScanningWallet};
+    fAbortRescan = false;
+
     int ret = 0;
     int64_t nNow = GetTime();
 
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart;
+    double dProgressTip;
     {
-        LOCK2(cs_main, cs_wallet);
+        LOCK(cs_main);
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
@@ -1877,33 +2112,84 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, b
             pindex = chainActive.Next(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
-        std::set<uint256> setAddedToWallet;
-        while (pindex) {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
-
-            if (fromStartup && ShutdownRequested()) {
-                return -1;
+        dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+        if (pindex)
+            CWalletDB(strWalletFile).WriteRescanProgress(chainActive.GetLocator(pindex));
+    }
+
+    // -rescanthreads=0 means one thread per core, the rescan itself being one of them
+    int nThreads = GetArg("-rescanthreads", DEFAULT_RESCAN_THREADS);
+    if (nThreads <= 0)
+        nThreads += boost::thread::hardware_concurrency();
+    nThreads = std::max(1, std::min(nThreads, MAX_RESCAN_THREADS));
+    const size_t nQueueSize = 8 * nThreads;
+
+    CRescanQueue queue(*this, nThreads - 1);
+    CBlockIndex* pindexQueued = pindex;
+    bool fInterrupted = false;
+    while (pindex) {
+        if (fAbortRescan || ShutdownRequested()) {
+            LogPrintf("Rescan %s at block %d\n", fAbortRescan ? "aborted" : "interrupted by shutdown", pindex->nHeight);
+            fInterrupted = true;
+            break;
+        }
+        if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+            ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+        // blocks connected during the scan, after the last one queued
+        if (!pindexQueued && queue.Size() == 0)
+            pindexQueued = pindex;
+        if (pindexQueued) {
+            LOCK(cs_main);
+            while (pindexQueued && queue.Size() < nQueueSize) {
+                queue.Push(pindexQueued);
+                pindexQueued = chainActive.Next(pindexQueued);
             }
+        }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            for (CTransaction& tx : block.vtx) {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+        CRescanBlock& entry = queue.Front();
+        {
+            LOCK2(cs_main, cs_wallet);
+            if (!chainActive.Contains(entry.pindex)) {
+                // reorganized away while queued, carry on from the fork with the active chain
+                pindex = chainActive.Next(chainActive.FindFork(entry.pindex));
+                pindexQueued = pindex;
+                queue.Clear();
+                continue;
+            }
+            if (!entry.fRead)
+                LogPrintf("%s: failed to read block %d\n", __func__, entry.pindex->nHeight);
+
+            for (size_t i = 0; i < entry.block.vtx.size(); i++) {
+                const CTransaction& tx = entry.block.vtx[i];
+                // The outputs were matched ahead, the inputs may spend or conflict with what was just added
+                bool fRelevant = entry.vfMine[i] || mapWallet.count(tx.GetHash());
+                for (size_t j = 0; !fRelevant && j < tx.vin.size(); j++)
+                    fRelevant = mapWallet.count(tx.vin[j].prevout.hash) || mapTxSpends.count(tx.vin[j].prevout);
+                if (fRelevant && AddToWalletIfInvolvingMe(tx, &entry.block, fUpdate))
                     ret++;
             }
+            pindex = chainActive.Next(entry.pindex);
 
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
+            if (pindex && GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
+                CWalletDB(strWalletFile).WriteRescanProgress(chainActive.GetLocator(pindex));
             }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+        queue.Pop();
     }
-    return ret;
+
+    // a scan interrupted by a shutdown resumes at the next startup
+    if (!fInterrupted || fAbortRescan)
+        CWalletDB(strWalletFile).EraseRescanProgress();
+    else if (pindex) {
+        LOCK(cs_main);
+        CWalletDB(strWalletFile).WriteRescanProgress(chainActive.GetLocator(pindex));
+    }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+    return fInterrupted ? -1 : ret;
 }
 
 void CWallet::ReacceptWalletTransactions(bool fFirstLoad)
@@ -2021,134 +2307,130 @@ void CWallet::ResendWalletTransactions()
  * @{
  */
 
-CAmount CWallet::loopTxsBalance(std::function<void(const uint256&, const CWalletTx&, CAmount&)> method) const
+CWalletBalance CWallet::GetBalances() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (const auto& it : mapWallet) {
-            method(it.first, it.second, nTotal);
+    LOCK2(cs_main, cs_wallet);
+    // Depths, maturity and trust only change with the tip, the memory pool or the swiftx locks
+    const unsigned int nMempoolUpdated = mempool.GetTransactionsUpdated();
+    const unsigned int nWalletUpdatedNow = nWalletUpdated;
+    if (pindexBalance == chainActive.Tip() && nMempoolUpdatedBalance == nMempoolUpdated &&
+            nWalletUpdatedBalance == nWalletUpdatedNow && nTXLocksBalance == nCompleteTXLocks)
+        return cachedBalance;
+
+    const int nStakeMinDepth = Params().GetConsensus().nStakeMinDepth;
+    CWalletBalance balance;
+    for (const auto& it : mapWallet) {
+        const CWalletTx& pcoin = it.second;
+        const bool fTrusted = pcoin.IsTrusted();
+        const int nDepth = pcoin.GetDepthInMainChain();
+        if (fTrusted) {
+            const CAmount nAvailable = pcoin.GetAvailableCredit();
+            balance.nBalance += nAvailable;
+            balance.nWatchOnly += pcoin.GetAvailableWatchOnlyCredit();
+            if (pcoin.HasP2CSOutputs()) {
+                balance.nColdStaking += pcoin.GetColdStakingCredit();
+                balance.nDelegated += pcoin.GetStakeDelegationCredit();
+            }
+            if (nDepth > 0) {
+                balance.nLocked += pcoin.GetLockedCredit();
+                balance.nUnlocked += pcoin.GetUnlockedCredit();
+                balance.nLockedWatchOnly += pcoin.GetLockedWatchOnlyCredit();
+            }
+            if (nDepth >= nStakeMinDepth) {
+                balance.nStakingOwn += nAvailable - pcoin.GetStakeDelegationCredit() - pcoin.GetLockedCredit();
+                balance.nStakingCold += pcoin.GetColdStakingCredit();
+            }
+        } else if (nDepth == 0 && pcoin.InMempool()) {
+            balance.nUnconfirmed += pcoin.GetAvailableCredit();
+            balance.nUnconfirmedWatchOnly += pcoin.GetAvailableWatchOnlyCredit();
         }
+        balance.nImmature += pcoin.GetImmatureCredit(false);
+        balance.nImmatureColdStaking += pcoin.GetImmatureCredit(false, ISMINE_COLD);
+        balance.nImmatureDelegated += pcoin.GetImmatureCredit(false, ISMINE_SPENDABLE_DELEGATED);
+        balance.nImmatureWatchOnly += pcoin.GetImmatureWatchOnlyCredit();
     }
-    return nTotal;
+
+    cachedBalance = balance;
+    pindexBalance = chainActive.Tip();
+    nMempoolUpdatedBalance = nMempoolUpdated;
+    nWalletUpdatedBalance = nWalletUpdatedNow;
+    nTXLocksBalance = nCompleteTXLocks;
+    return balance;
 }
 
 CAmount CWallet::GetBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal){
-        if (pcoin.IsTrusted())
-            nTotal += pcoin.GetAvailableCredit();
-    });
+    return GetBalances().nBalance;
 }
 
 CAmount CWallet::GetColdStakingBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-        if (pcoin.HasP2CSOutputs() && pcoin.IsTrusted())
-            nTotal += pcoin.GetColdStakingCredit();
-    });
+    return GetBalances().nColdStaking;
 }
 
 CAmount CWallet::GetStakingBalance(const bool fIncludeColdStaking) const
 {
-    return std::max(CAmount(0), loopTxsBalance(
-            [fIncludeColdStaking](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-        if (pcoin.IsTrusted() && pcoin.GetDepthInMainChain() >= Params().GetConsensus().nStakeMinDepth) {
-            nTotal += pcoin.GetAvailableCredit();       // available coins
-            nTotal -= pcoin.GetStakeDelegationCredit(); // minus delegated coins, if any
-            nTotal -= pcoin.GetLockedCredit();          // minus locked coins, if any
-            if (fIncludeColdStaking)
-                nTotal += pcoin.GetColdStakingCredit(); // plus cold coins, if any and if requested
-        }
-    }));
+    const CWalletBalance balance = GetBalances();
+    return std::max(CAmount(0), balance.nStakingOwn + (fIncludeColdStaking ? balance.nStakingCold : 0));
 }
 
 CAmount CWallet::GetDelegatedBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (pcoin.HasP2CSOutputs() && pcoin.IsTrusted())
-                nTotal += pcoin.GetStakeDelegationCredit();
-    });
+    return GetBalances().nDelegated;
 }
 
 CAmount CWallet::GetUnlockedCoins() const
 {
     if (fLiteMode) return 0;
 
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (pcoin.IsTrusted() && pcoin.GetDepthInMainChain() > 0)
-                nTotal += pcoin.GetUnlockedCredit();
-    });
+    return GetBalances().nUnlocked;
 }
 
 CAmount CWallet::GetLockedCoins() const
 {
     if (fLiteMode) return 0;
 
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (pcoin.IsTrusted() && pcoin.GetDepthInMainChain() > 0)
-                nTotal += pcoin.GetLockedCredit();
-    });
+    return GetBalances().nLocked;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (!pcoin.IsTrusted() && pcoin.GetDepthInMainChain() == 0 && pcoin.InMempool())
-                nTotal += pcoin.GetAvailableCredit();
-    });
+    return GetBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            nTotal += pcoin.GetImmatureCredit(false);
-    });
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetImmatureColdStakingBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            nTotal += pcoin.GetImmatureCredit(false, ISMINE_COLD);
-    });
+    return GetBalances().nImmatureColdStaking;
 }
 
 CAmount CWallet::GetImmatureDelegatedBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            nTotal += pcoin.GetImmatureCredit(false, ISMINE_SPENDABLE_DELEGATED);
-    });
+    return GetBalances().nImmatureDelegated;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (pcoin.IsTrusted())
-                nTotal += pcoin.GetAvailableWatchOnlyCredit();
-    });
+    return GetBalances().nWatchOnly;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (!pcoin.IsTrusted() && pcoin.GetDepthInMainChain() == 0 && pcoin.InMempool())
-                nTotal += pcoin.GetAvailableWatchOnlyCredit();
-    });
+    return GetBalances().nUnconfirmedWatchOnly;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            nTotal += pcoin.GetImmatureWatchOnlyCredit();
-    });
+    return GetBalances().nImmatureWatchOnly;
 }
 
 CAmount CWallet::GetLockedWatchOnlyBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (pcoin.IsTrusted() && pcoin.GetDepthInMainChain() > 0)
-                nTotal += pcoin.GetLockedWatchOnlyCredit();
-    });
+    return GetBalances().nLockedWatchOnly;
 }
 
 void CWallet::GetAvailableP2CSCoins(std::vector<COutput>& vCoins) const {
@@ -2288,64 +2570,80 @@ bool CWallet::AvailableCoins(
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+        if (!fAvailableCoinsValid) {
+            mapAvailableCoins.clear();
+            for (const auto& it : mapWallet)
+                AddAvailableCoins(it.second);
+            fAvailableCoinsValid = true;
+            LogPrint("selectcoins", "%s: indexed %d wallet outputs\n", __func__, mapAvailableCoins.size());
+        }
 
-            // Check if the tx is selectable
-            int nDepth;
-            if (!CheckTXAvailability(pcoin, fOnlyConfirmed, fUseIX, nDepth))
+        const CWalletTx* pcoinPrev = nullptr;
+        bool fTxAvailable = false;
+        int nDepth = 0;
+        for (auto it = mapAvailableCoins.begin(); it != mapAvailableCoins.end();) {
+            const uint256& wtxid = it->first.hash;
+            const unsigned int i = it->first.n;
+            const CWalletTx* pcoin = it->second.pcoin;
+            const isminetype mine = it->second.mine;
+            // Spends are final until conflicted, abandoned or disconnected, which rebuild the index
+            if (IsSpent(wtxid, i)) {
+                it = mapAvailableCoins.erase(it);
                 continue;
-
-            // Check min depth requirement for stake inputs
-            if (nCoinType == STAKEABLE_COINS && nDepth < Params().GetConsensus().nStakeMinDepth) continue;
-
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                bool found = false;
-                if (nCoinType == ONLY_DENOMINATED) {
-                    found = IsDenominatedAmount(pcoin->vout[i].nValue);
-                } else if (nCoinType == ONLY_NOT12000IFMN) {
-                    found = !(fMasterNode && pcoin->vout[i].nValue == 12000 * COIN);
-                } else if (nCoinType == ONLY_NONDENOMINATED_NOT12000IFMN) {
-                    if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
-                    found = !IsDenominatedAmount(pcoin->vout[i].nValue);
-                    if (found && fMasterNode) found = pcoin->vout[i].nValue != 12000 * COIN; // do not use Hot MN funds
-                } else if (nCoinType == ONLY_12000) {
-                    found = pcoin->vout[i].nValue == 12000 * COIN;
-                } else {
-                    found = true;
-                }
-                if (!found) continue;
-
-                if (nCoinType == STAKEABLE_COINS && pcoin->vout[i].IsZerocoinMint()) continue;
-                if (IsSpent(wtxid, i)) continue;
-
-                isminetype mine = IsMine(pcoin->vout[i]);
-                if (  (mine == ISMINE_NO) ||
-                      ((mine == ISMINE_MULTISIG || mine == ISMINE_SPENDABLE) && nWatchonlyConfig == 2) ||
-                      (mine == ISMINE_WATCH_ONLY && nWatchonlyConfig == 1) ||
-                      (IsLockedCoin((*it).first, i) && nCoinType != ONLY_12000) ||
-                      (pcoin->vout[i].nValue <= 0 && !fIncludeZeroValue) ||
-                      (fCoinsSelected && !coinControl->fAllowOtherInputs && !coinControl->IsSelected((*it).first, i))
-                   ) continue;
-
-                // --Skip P2CS outputs
-                // skip cold coins
-                if (mine == ISMINE_COLD && (!fIncludeColdStaking || !HasDelegator(pcoin->vout[i]))) continue;
-                // skip delegated coins
-                if (mine == ISMINE_SPENDABLE_DELEGATED && !fIncludeDelegated) continue;
-                // skip auto-delegated coins
-                if (mine == ISMINE_SPENDABLE_STAKEABLE && !fIncludeColdStaking && !fIncludeDelegated) continue;
-
-                bool fIsValid = (
-                        ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
-                        ((mine & (ISMINE_MULTISIG | (fIncludeColdStaking ? ISMINE_COLD : ISMINE_NO) |
-                                (fIncludeDelegated ? ISMINE_SPENDABLE_DELEGATED : ISMINE_NO) )) != ISMINE_NO));
-
-                // found valid coin
-                if (!pCoins) return true;
-                pCoins->emplace_back(COutput(pcoin, i, nDepth, fIsValid));
             }
+            ++it;
+
+            if (pcoin != pcoinPrev) {
+                pcoinPrev = pcoin;
+                // Check if the tx is selectable
+                fTxAvailable = CheckTXAvailability(pcoin, fOnlyConfirmed, fUseIX, nDepth);
+                // Check min depth requirement for stake inputs
+                if (nCoinType == STAKEABLE_COINS && nDepth < Params().GetConsensus().nStakeMinDepth)
+                    fTxAvailable = false;
+            }
+            if (!fTxAvailable) continue;
+
+            bool found = false;
+            if (nCoinType == ONLY_DENOMINATED) {
+                found = IsDenominatedAmount(pcoin->vout[i].nValue);
+            } else if (nCoinType == ONLY_NOT12000IFMN) {
+                found = !(fMasterNode && pcoin->vout[i].nValue == 12000 * COIN);
+            } else if (nCoinType == ONLY_NONDENOMINATED_NOT12000IFMN) {
+                if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
+                found = !IsDenominatedAmount(pcoin->vout[i].nValue);
+                if (found && fMasterNode) found = pcoin->vout[i].nValue != 12000 * COIN; // do not use Hot MN funds
+            } else if (nCoinType == ONLY_12000) {
+                found = pcoin->vout[i].nValue == 12000 * COIN;
+            } else {
+                found = true;
+            }
+            if (!found) continue;
+
+            if (nCoinType == STAKEABLE_COINS && pcoin->vout[i].IsZerocoinMint()) continue;
+
+            if (  ((mine == ISMINE_MULTISIG || mine == ISMINE_SPENDABLE) && nWatchonlyConfig == 2) ||
+                  (mine == ISMINE_WATCH_ONLY && nWatchonlyConfig == 1) ||
+                  (IsLockedCoin(wtxid, i) && nCoinType != ONLY_12000) ||
+                  (pcoin->vout[i].nValue <= 0 && !fIncludeZeroValue) ||
+                  (fCoinsSelected && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(wtxid, i))
+               ) continue;
+
+            // --Skip P2CS outputs
+            // skip cold coins
+            if (mine == ISMINE_COLD && (!fIncludeColdStaking || !HasDelegator(pcoin->vout[i]))) continue;
+            // skip delegated coins
+            if (mine == ISMINE_SPENDABLE_DELEGATED && !fIncludeDelegated) continue;
+            // skip auto-delegated coins
+            if (mine == ISMINE_SPENDABLE_STAKEABLE && !fIncludeColdStaking && !fIncludeDelegated) continue;
+
+            bool fIsValid = (
+                    ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
+                    ((mine & (ISMINE_MULTISIG | (fIncludeColdStaking ? ISMINE_COLD : ISMINE_NO) |
+                            (fIncludeDelegated ? ISMINE_SPENDABLE_DELEGATED : ISMINE_NO) )) != ISMINE_NO));
+
+            // found valid coin
+            if (!pCoins) return true;
+            pCoins->emplace_back(COutput(pcoin, i, nDepth, fIsValid));
         }
         return (pCoins && pCoins->size() > 0);
     }
@@ -2378,7 +2676,77 @@ std::map<CBitcoinAddress, std::vector<COutput> > CWallet::AvailableCoinsByAddres
     return mapCoins;
 }
 
-static void ApproximateBestSubset(std::vector<std::pair<CAmount, std::pair<const CWalletTx*, unsigned int> > > vValue, const CAmount& nTotalLower, const CAmount& nTargetValue, std::vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
+/**
+ * Steps of the depth first search before SelectCoinsBnB settles for the best subset found so far.
+ * A step count rather than a time limit, so that a wallet selects the same coins on any machine,
+ * each step is constant time and the whole budget takes a few milliseconds.
+ */
+static const int BNB_MAX_TRIES = 100000;
+
+/**
+ * Smallest subset of vValue, sorted by decreasing value, worth at least nTargetValue.
+ * Branch and bound over the inclusion of each coin, pruning branches which can no longer
+ * reach the target or improve on the best subset, within a budget of BNB_MAX_TRIES steps.
+ * Returns false if the budget ran out before the search was exhausted or hit the target exactly.
+ */
+bool SelectCoinsBnB(const std::vector<std::pair<CAmount, std::pair<const CWalletTx*, unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue, std::vector<char>& vfBest, CAmount& nBest)
+{
+    // value of the coins from each position onwards
+    std::vector<CAmount> vRemaining(vValue.size() + 1, 0);
+    for (size_t i = vValue.size(); i > 0; i--)
+        vRemaining[i - 1] = vRemaining[i] + vValue[i - 1].first;
+
+    std::vector<size_t> vSelected, vBestSelected;
+    bool fBestAll = true;
+    nBest = nTotalLower;
+
+    CAmount nTotal = 0;
+    size_t nDepth = 0;
+    int nTries = 0;
+    for (; nTries < BNB_MAX_TRIES; nTries++) {
+        bool fBacktrack = false;
+        if (nTotal >= nBest || nTotal + vRemaining[nDepth] < nTargetValue) {
+            fBacktrack = true;
+        } else if (nTotal >= nTargetValue) {
+            nBest = nTotal;
+            vBestSelected = vSelected;
+            fBestAll = false;
+            if (nBest == nTargetValue)
+                break;
+            fBacktrack = true;
+        }
+
+        if (!fBacktrack) {
+            vSelected.push_back(nDepth);
+            nTotal += vValue[nDepth].first;
+            nDepth++;
+            continue;
+        }
+
+        // leave out the last coin taken, and the coins of the same value after it, which give the same totals
+        if (vSelected.empty())
+            break;
+        nDepth = vSelected.back();
+        vSelected.pop_back();
+        nTotal -= vValue[nDepth].first;
+        const CAmount nSkipped = vValue[nDepth].first;
+        while (nDepth < vValue.size() && vValue[nDepth].first == nSkipped)
+            nDepth++;
+    }
+
+    vfBest.assign(vValue.size(), fBestAll);
+    if (!fBestAll) {
+        for (size_t i : vBestSelected)
+            vfBest[i] = true;
+    }
+    return nTries < BNB_MAX_TRIES;
+}
+
+/**
+ * The stochastic approximation SelectCoinsMinConf used before SelectCoinsBnB, no longer called by
+ * the wallet but kept as the baseline the search is benchmarked against.
+ */
+void ApproximateBestSubset(std::vector<std::pair<CAmount, std::pair<const CWalletTx*, unsigned int> > > vValue, const CAmount& nTotalLower, const CAmount& nTargetValue, std::vector<char>& vfBest, CAmount& nBest, int iterations)
 {
     std::vector<char> vfIncluded;
 
@@ -2443,6 +2811,95 @@ bool CWallet::StakeableCoins(std::vector<COutput>* pCoins)
     return AvailableCoins(pCoins, true, nullptr, false, STAKEABLE_COINS,  false, 1, fIncludeCold, false);
 }
 
+void CWallet::AddAvailableCoins(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_wallet);
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        const COutPoint outpoint(hash, i);
+        isminetype mine = IsMine(wtx.vout[i]);
+        if (mine == ISMINE_NO)
+            mapAvailableCoins.erase(outpoint);
+        else
+            mapAvailableCoins[outpoint] = CAvailableOutput{&wtx, mine};
+    }
+}
+
+void CWallet::AddStakeCandidates(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+        mapStakeCandidates.erase(COutPoint(hash, i));
+
+    // Only confirmed outputs can stake, conflicted transactions have no index
+    if (wtx.hashUnset() || wtx.nIndex == -1)
+        return;
+
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        const CTxOut& out = wtx.vout[i];
+        if (out.nValue <= 0 || out.IsZerocoinMint()) continue;
+        isminetype mine = IsMine(out);
+        if (mine == ISMINE_NO || mine == ISMINE_WATCH_ONLY || mine == ISMINE_SPENDABLE_DELEGATED) continue;
+        const COutPoint outpoint(hash, i);
+        mapStakeCandidates.emplace(outpoint, CStakeableOutput{CStakeCandidate(outpoint, out, nullptr),
+                wtx.hashBlock, mine, wtx.IsCoinBase() || wtx.IsCoinStake()});
+    }
+}
+
+/**
+ * Outputs able to stake on top of the chain tip, the same set as StakeableCoins,
+ * taken from the stake candidates instead of a scan of every wallet transaction.
+ */
+bool CWallet::GetStakeCandidates(std::vector<CStakeCandidate>& vCandidates)
+{
+    vCandidates.clear();
+    const bool fIncludeCold = (sporkManager.IsSporkActive(SPORK_17_COLDSTAKING_ENFORCEMENT) &&
+                               GetBoolArg("-coldstaking", true));
+
+    LOCK2(cs_main, cs_wallet);
+    if (!fStakeCandidatesValid) {
+        mapStakeCandidates.clear();
+        for (const auto& it : mapWallet)
+            AddStakeCandidates(it.second);
+        fStakeCandidatesValid = true;
+        LogPrint("staking", "%s: loaded %d stake candidates\n", __func__, mapStakeCandidates.size());
+    }
+
+    const Consensus::Params& consensus = Params().GetConsensus();
+    const int nHeight = chainActive.Height();
+    for (auto it = mapStakeCandidates.begin(); it != mapStakeCandidates.end();) {
+        const COutPoint& outpoint = it->first;
+        CStakeableOutput& candidate = it->second;
+        // Spends are final until conflicted or abandoned, which rebuild the candidates
+        if (IsSpent(outpoint.hash, outpoint.n)) {
+            it = mapStakeCandidates.erase(it);
+            continue;
+        }
+        ++it;
+
+        CBlockIndex* pindexFrom = candidate.stake.GetIndexFrom();
+        if (!pindexFrom) {
+            BlockMap::const_iterator mi = mapBlockIndex.find(candidate.hashBlock);
+            if (mi == mapBlockIndex.end() || !mi->second) continue;
+            pindexFrom = mi->second;
+            candidate.stake.SetIndexFrom(pindexFrom);
+        }
+        if (!chainActive.Contains(pindexFrom)) continue;
+        const int nDepth = nHeight - pindexFrom->nHeight + 1;
+        if (nDepth < consensus.nStakeMinDepth) continue;
+        if (candidate.fRequiresMaturity && nDepth <= consensus.nCoinbaseMaturity) continue;
+        if (IsLockedCoin(outpoint.hash, outpoint.n)) continue;
+
+        // skip cold coins without a known delegator, and auto-delegated coins, unless cold staking
+        if (candidate.mine == ISMINE_COLD && (!fIncludeCold || !HasDelegator(candidate.stake.GetTxOut()))) continue;
+        if (candidate.mine == ISMINE_SPENDABLE_STAKEABLE && !fIncludeCold) continue;
+
+        vCandidates.push_back(candidate.stake);
+    }
+    return !vCandidates.empty();
+}
+
 bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
     setCoinsRet.clear();
@@ -2520,16 +2977,17 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         break;
     }
 
-    // Solve subset sum by stochastic approximation
+    // Solve subset sum by branch and bound
     std::sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
     std::vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
+    if (!SelectCoinsBnB(vValue, nTotalLower, nTargetValue, vfBest, nBest))
+        LogPrint("selectcoins", "%s: search budget reached for %d coins\n", __func__, vValue.size());
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+        SelectCoinsBnB(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest);
 
-    // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
+    // If we have a bigger coin and (either the subset search didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
     if (coinLowestLarger.second.first &&
         ((nBest != nTargetValue && nBest < nTargetValue + CENT) || coinLowestLarger.first <= nBest)) {
@@ -2880,20 +3338,12 @@ bool CWallet::CreateCoinStake(
         )
 {
     // Get the list of stakable utxos
-    std::vector<COutput> vCoins;
-    if (!StakeableCoins(&vCoins)) {
+    std::vector<CStakeCandidate> vCandidates;
+    if (!GetStakeCandidates(vCandidates)) {
         LogPrintf("%s: No coin available to stake.\n", __func__);
         return false;
     }
 
-    // Parse utxos into CPivStakes
-    std::list<std::unique_ptr<CStakeInput> > listInputs;
-    for (const COutput &out : vCoins) {
-        std::unique_ptr<CPivStake> input(new CPivStake());
-        input->SetPrevout((CTransaction) *out.tx, out.i);
-        listInputs.emplace_back(std::move(input));
-    }
-
     // Mark coin stake transaction
     txNew.vin.clear();
     txNew.vout.clear();
@@ -2901,14 +3351,19 @@ bool CWallet::CreateCoinStake(
 
     // update staker status (hash)
     pStakerStatus->SetLastTip(pindexPrev);
-    pStakerStatus->SetLastCoins(listInputs.size());
+    pStakerStatus->SetLastCoins(vCandidates.size());
 
     // Kernel Search
     CAmount nCredit;
     CScript scriptPubKeyKernel;
     bool fKernelFound = false;
     int nAttempts = 0;
-    for (std::unique_ptr<CStakeInput>& stakeInput : listInputs) {
+    std::vector<CStakeInput*> vInputs;
+    vInputs.reserve(vCandidates.size());
+    for (CStakeCandidate& candidate : vCandidates)
+        vInputs.push_back(&candidate);
+    size_t nStart = 0;
+    while (nStart < vInputs.size()) {
         //new block came in, move on
         if (chainActive.Height() != pindexPrev->nHeight) return false;
 
@@ -2917,14 +3372,21 @@ bool CWallet::CreateCoinStake(
 
         nCredit = 0;
 
-        nAttempts++;
-        fKernelFound = Stake(pindexPrev, stakeInput.get(), nBits, nTxNewTime);
+        int nHashes = 0;
+        const int64_t nSearchStart = GetTimeMicros();
+        const size_t nFound = FindStake(pindexPrev, vInputs, nStart, nBits, nTxNewTime, nHashes);
+        nAttempts += nHashes;
 
-        // update staker status (time, attempts)
+        // update staker status (time, attempts, hash rate)
         pStakerStatus->SetLastTime(nTxNewTime);
         pStakerStatus->SetLastTries(nAttempts);
+        pStakerStatus->SetLastSearch(nHashes, GetTimeMicros() - nSearchStart);
 
-        if (!fKernelFound) continue;
+        fKernelFound = (nFound < vInputs.size());
+        if (!fKernelFound) break;
+        // resume after this input if it can't be used
+        nStart = nFound + 1;
+        CStakeInput* stakeInput = vInputs[nFound];
 
         // Found a kernel
         LogPrintf("CreateCoinStake : kernel found\n");
@@ -2940,6 +3402,7 @@ bool CWallet::CreateCoinStake(
         std::vector<CTxOut> vout;
         if (!stakeInput->CreateTxOuts(this, vout, nCredit)) {
             LogPrintf("%s : failed to create output\n", __func__);
+            fKernelFound = false;
             continue;
         }
         txNew.vout.insert(txNew.vout.end(), vout.begin(), vout.end());
@@ -2974,6 +3437,7 @@ bool CWallet::CreateCoinStake(
             LogPrintf("%s : failed to create TxIn\n", __func__);
             txNew.vin.clear();
             txNew.vout.clear();
+            fKernelFound = false;
             continue;
         }
         txNew.vin.emplace_back(in);
@@ -3642,18 +4106,21 @@ void CWallet::LockCoin(const COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    MarkBalanceDirty();
 }
 
 void CWallet::UnlockCoin(const COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    MarkBalanceDirty();
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.clear();
+    MarkBalanceDirty();
 }
 
 bool CWallet::IsLockedCoin(const uint256& hash, unsigned int n) const
@@ -4464,6 +4931,8 @@ void CWalletTx::MarkDirty()
     fColdCreditCached = false;
     fDelegatedDebitCached = false;
     fDelegatedCreditCached = false;
+    if (pwallet)
+        pwallet->MarkBalanceDirty();
 }
 
 void CWalletTx::BindWallet(CWallet* pwalletIn)
@@ -30,6 +30,7 @@
 #include "zpiv/zpivmodule.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -65,6 +66,14 @@ static const bool DEFAULT_USE_HD_WALLET = false;
 static const bool DEFAULT_ENABLE_WARN_ENCRYPTHD = false;
 //! -custombackupthreshold default
 static const int DEFAULT_CUSTOMBACKUPTHRESHOLD = 1;
+//! -rescanthreads default, 0 = one per core
+static const int DEFAULT_RESCAN_THREADS = 0;
+//! Maximum number of threads reading and matching blocks during a rescan
+static const int MAX_RESCAN_THREADS = 16;
+//! -walletloadthreads default, 0 = one per core
+static const int DEFAULT_WALLET_LOAD_THREADS = 0;
+//! Maximum number of threads deserializing transaction records during the wallet load
+static const int MAX_WALLET_LOAD_THREADS = 16;
 
 class CAccountingEntry;
 class CCoinControl;
@@ -159,6 +168,8 @@ public:
  *  - nTime          time slot of last attempt
  *  - nTries         number of UTXOs hashed during last attempt
  *  - nCoins         number of stakeable utxos during last attempt
+ *  - nHashes        number of kernels hashed by the last kernel search
+ *  - nSearchTime    duration of the last kernel search, in microseconds
 **/
 class CStakerStatus
 {
@@ -167,6 +178,8 @@ private:
     int64_t nTime{0};
     int nTries{0};
     int nCoins{0};
+    int nHashes{0};
+    int64_t nSearchTime{0};
 
 public:
     // Get
@@ -176,22 +189,49 @@ public:
     int GetLastCoins() const { return nCoins; }
     int GetLastTries() const { return nTries; }
     int64_t GetLastTime() const { return nTime; }
+    // Kernel hashes per second of the last search
+    int64_t GetLastHashRate() const { return nSearchTime > 0 ? (int64_t)nHashes * 1000000 / nSearchTime : 0; }
     // Set
     void SetLastCoins(const int coins) { nCoins = coins; }
     void SetLastTries(const int tries) { nTries = tries; }
     void SetLastTip(const CBlockIndex* lastTip) { tipBlock = lastTip; }
     void SetLastTime(const uint64_t lastTime) { nTime = lastTime; }
+    void SetLastSearch(const int hashes, const int64_t searchTime) { nHashes = hashes; nSearchTime = searchTime; }
     void SetNull()
     {
         SetLastCoins(0);
         SetLastTries(0);
         SetLastTip(nullptr);
         SetLastTime(0);
+        SetLastSearch(0, 0);
     }
     // Check whether staking status is active (last attempt earlier than 30 seconds ago)
     bool IsActive() const { return (nTime + 30) >= GetTime(); }
 };
 
+/** All the balance categories of a wallet, computed together in a single pass over its transactions */
+struct CWalletBalance {
+    CAmount nBalance{0};
+    CAmount nUnconfirmed{0};
+    CAmount nImmature{0};
+    CAmount nColdStaking{0};            // delegated coins for which we have the staking key
+    CAmount nImmatureColdStaking{0};
+    CAmount nDelegated{0};              // delegated coins for which we have the spending key
+    CAmount nImmatureDelegated{0};
+    CAmount nStakingOwn{0};             // own mature coins which are not delegated nor locked
+    CAmount nStakingCold{0};            // mature cold staking coins
+    CAmount nLocked{0};
+    CAmount nUnlocked{0};
+    CAmount nWatchOnly{0};
+    CAmount nUnconfirmedWatchOnly{0};
+    CAmount nImmatureWatchOnly{0};
+    CAmount nLockedWatchOnly{0};
+};
+
+/** Subset sum solvers of SelectCoinsMinConf, over candidate coins sorted by decreasing value */
+bool SelectCoinsBnB(const std::vector<std::pair<CAmount, std::pair<const CWalletTx*, unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue, std::vector<char>& vfBest, CAmount& nBest);
+void ApproximateBestSubset(std::vector<std::pair<CAmount, std::pair<const CWalletTx*, unsigned int> > > vValue, const CAmount& nTotalLower, const CAmount& nTargetValue, std::vector<char>& vfBest, CAmount& nBest, int iterations = 1000);
+
 /**
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -222,13 +262,61 @@ private:
      */
     typedef std::multimap<COutPoint, uint256> TxSpends;
     TxSpends mapTxSpends;
-    void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
-    void AddToSpends(const uint256& wtxid);
+    void AddToSpends(const COutPoint& outpoint, const uint256& wtxid, bool fSyncMetaData = true);
+    void AddToSpends(const uint256& wtxid, bool fSyncMetaData = true);
 
     /* Mark a transaction (and its in-wallet descendants) as conflicting with a particular block. */
     void MarkConflicted(const uint256& hashBlock, const uint256& hashTx);
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
+
+    /**
+     * Outputs that may stake, with the data of the kernel precomputed.
+     * Kept in step with mapWallet by AddToWallet, rebuilt from scratch
+     * when transactions are conflicted, abandoned or erased.
+     */
+    struct CStakeableOutput {
+        CStakeCandidate stake;
+        uint256 hashBlock;         // block of the output, resolved into the stake on first use
+        isminetype mine;
+        bool fRequiresMaturity;    // coinbase or coinstake output
+    };
+    std::map<COutPoint, CStakeableOutput> mapStakeCandidates;
+    bool fStakeCandidatesValid{false};
+    void AddStakeCandidates(const CWalletTx& wtx);
+
+    /**
+     * Outputs of ours which may be unspent, in the order of mapWallet, with their ownership type.
+     * Kept in step with mapWallet like the stake candidates, entries found spent are dropped
+     * by AvailableCoins so that it scales with the unspent outputs instead of the wallet history.
+     */
+    struct CAvailableOutput {
+        const CWalletTx* pcoin;
+        isminetype mine;
+    };
+    mutable std::map<COutPoint, CAvailableOutput> mapAvailableCoins;
+    mutable bool fAvailableCoinsValid{false};
+    void AddAvailableCoins(const CWalletTx& wtx) const;
+    /* Forget the output indexes, when spends or ownership may have been undone */
+    void InvalidateOutputIndexes();
+
+    /**
+     * Balances as of the chain tip, memory pool update and wallet update they were computed at.
+     * Any change of a wallet transaction marks it dirty, which bumps nWalletUpdated.
+     */
+    mutable CWalletBalance cachedBalance;
+    mutable const CBlockIndex* pindexBalance{nullptr};
+    mutable unsigned int nMempoolUpdatedBalance{0};
+    mutable unsigned int nWalletUpdatedBalance{0};
+    mutable int nTXLocksBalance{0};
+    mutable std::atomic<unsigned int> nWalletUpdated{1};
+
+    std::atomic<bool> fScanningWallet{false};
+    std::atomic<bool> fAbortRescan{false};
+
+    /* Database transaction the updates of a block are written in, while SyncTransactions runs */
+    CWalletDB* pwalletdbBatch{nullptr};
+
     /* HD derive new child key (on internal or external chain) */
     void DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, uint32_t nAccountIndex, bool fInternal /*= false*/);
 
@@ -241,6 +329,7 @@ public:
     static const int DEFAULT_STAKE_SPLIT_THRESHOLD = 2000;
 
     bool StakeableCoins(std::vector<COutput>* pCoins = nullptr);
+    bool GetStakeCandidates(std::vector<CStakeCandidate>& vCandidates);
     bool IsCollateralAmount(CAmount nInputAmount) const;
 
     /*
@@ -424,7 +513,10 @@ public:
 
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
+    //! Sync the metadata of the transactions spending the same outpoints, deferred by the wallet load
+    void SyncAllMetaData();
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256& hash);
 
@@ -432,11 +524,22 @@ public:
      * Upgrade wallet to HD if needed. Does nothing if not.
      */
 
+    /**
+     * Scan the active chain from pindexStart for transactions of ours. Blocks are read and matched
+     * against the keystore ahead of the scan by worker threads, and added to the wallet in chain order,
+     * locking cs_main and cs_wallet for one block at a time: it must be called without them held.
+     * The progress is saved in the wallet for a scan interrupted by a shutdown to resume at startup.
+     * Returns the number of transactions added or updated, or -1 if the scan was interrupted.
+     */
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false, bool fromStartup = false);
+    bool IsScanning() const { return fScanningWallet; }
+    void AbortRescan() { fAbortRescan = true; }
     void ReacceptWalletTransactions(bool fFirstLoad = false);
     void ResendWalletTransactions();
 
-    CAmount loopTxsBalance(std::function<void(const uint256&, const CWalletTx&, CAmount&)>method) const;
+    /** Mark the cached balances stale, on any change of the transactions or locked coins */
+    void MarkBalanceDirty() const { nWalletUpdated++; }
+    CWalletBalance GetBalances() const;
     CAmount GetBalance() const;
     CAmount GetColdStakingBalance() const;  // delegated coins for which we have the staking key
     CAmount GetImmatureColdStakingBalance() const;
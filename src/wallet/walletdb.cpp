@@ -8,6 +8,7 @@
 #include "wallet/walletdb.h"
 
 #include "base58.h"
+#include "checkqueue.h"
 #include "protocol.h"
 #include "serialize.h"
 #include "sync.h"
@@ -153,6 +154,23 @@ bool CWalletDB::ReadBestBlock(CBlockLocator& locator)
     return Read(std::string("bestblock_nomerkle"), locator);
 }
 
+bool CWalletDB::WriteRescanProgress(const CBlockLocator& locator)
+{
+    nWalletDBUpdated++;
+    return Write(std::string("rescanprogress"), locator);
+}
+
+bool CWalletDB::ReadRescanProgress(CBlockLocator& locator)
+{
+    return Read(std::string("rescanprogress"), locator);
+}
+
+bool CWalletDB::EraseRescanProgress()
+{
+    nWalletDBUpdated++;
+    return Erase(std::string("rescanprogress"));
+}
+
 bool CWalletDB::WriteOrderPosNext(int64_t nOrderPosNext)
 {
     nWalletDBUpdated++;
@@ -410,6 +428,32 @@ public:
     }
 };
 
+// Unserialize a "tx" record past its type, undoing the serialize changes in 31600
+static bool ReadWalletTx(CDataStream& ssKey, CDataStream& ssValue, CWalletTx& wtx, bool& fUpgraded, std::string& strErr)
+{
+    uint256 hash;
+    ssKey >> hash;
+    ssValue >> wtx;
+    if (wtx.GetHash() != hash)
+        return false;
+
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703) {
+        if (!ssValue.empty()) {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        } else {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgraded = true;
+    }
+    return true;
+}
+
 bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CWalletScanState& wss, std::string& strType, std::string& strErr)
 {
     try {
@@ -426,28 +470,12 @@ bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CW
             ssKey >> strAddress;
             ssValue >> pwallet->mapAddressBook[CBitcoinAddress(strAddress).Get()].purpose;
         } else if (strType == "tx") {
-            uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            if (wtx.GetHash() != hash)
+            bool fUpgraded = false;
+            if (!ReadWalletTx(ssKey, ssValue, wtx, fUpgraded, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703) {
-                if (!ssValue.empty()) {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                        wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                } else {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
+            if (fUpgraded)
+                wss.vWalletUpgrade.push_back(wtx.GetHash());
 
             if (wtx.nOrderPos == -1)
                 wss.fAnyUnordered = true;
@@ -709,9 +737,152 @@ static bool IsKeyType(std::string strType)
             strType == "hdchain" || strType == "chdchain");
 }
 
+/** A "tx" record taken off the cursor, unserialized by the wallet loader */
+struct CWalletTxRecord {
+    CDataStream ssKey;
+    CDataStream ssValue;
+    CWalletTx wtx;
+    bool fRead{false};
+    bool fUpgraded{false};
+    std::string strErr;
+
+    CWalletTxRecord(CDataStream&& ssKeyIn, CDataStream&& ssValueIn) : ssKey(std::move(ssKeyIn)), ssValue(std::move(ssValueIn)) {}
+};
+
+/** Unserialization of one transaction record, as run by CCheckQueue */
+class CWalletTxRecordCheck
+{
+private:
+    CWalletTxRecord* record{nullptr};
+
+public:
+    CWalletTxRecordCheck() {}
+    explicit CWalletTxRecordCheck(CWalletTxRecord* recordIn) : record(recordIn) {}
+
+    // a record that can't be read must not stop the check queue from reading the rest of the batch
+    bool operator()()
+    {
+        try {
+            std::string strType;
+            record->ssKey >> strType;
+            record->fRead = ReadWalletTx(record->ssKey, record->ssValue, record->wtx, record->fUpgraded, record->strErr);
+        } catch (...) {
+            record->fRead = false;
+        }
+        return true;
+    }
+
+    void swap(CWalletTxRecordCheck& check)
+    {
+        std::swap(record, check.record);
+    }
+};
+
+/**
+ * Transaction records, by far the most of a staking wallet, are collected off the cursor
+ * in batches. Each batch is unserialized by parallel threads and then added to the wallet
+ * in cursor order. The derived state of the transactions is left to be computed lazily.
+ */
+class CWalletTxLoader
+{
+private:
+    static const size_t BATCH_SIZE = 1000;
+
+    CWallet* pwallet;
+    CWalletScanState& wss;
+    int nThreads;
+    std::vector<CWalletTxRecord> vBatch;
+    //! Workers kept for every batch of the load, the loading thread joins them while waiting
+    CCheckQueue<CWalletTxRecordCheck> checkqueue;
+    boost::thread_group workers;
+
+public:
+    unsigned int nRecords{0};
+    int64_t nTimeRead{0};
+    int64_t nTimeAdd{0};
+
+    CWalletTxLoader(CWallet* pwalletIn, CWalletScanState& wssIn) : pwallet(pwalletIn), wss(wssIn), checkqueue(32)
+    {
+        // -walletloadthreads=0 means one thread per core, the loading thread being one of them
+        nThreads = GetArg("-walletloadthreads", DEFAULT_WALLET_LOAD_THREADS);
+        if (nThreads <= 0)
+            nThreads += boost::thread::hardware_concurrency();
+        nThreads = std::max(1, std::min(nThreads, MAX_WALLET_LOAD_THREADS));
+        vBatch.reserve(BATCH_SIZE);
+        for (int i = 0; i < nThreads - 1; i++)
+            workers.create_thread(boost::bind(&CCheckQueue<CWalletTxRecordCheck>::Thread, &checkqueue));
+    }
+
+    ~CWalletTxLoader()
+    {
+        // the workers wait for checks in an interruption point
+        workers.interrupt_all();
+        workers.join_all();
+    }
+
+    // Returns false if any transaction record of the batch couldn't be read
+    bool Push(CDataStream&& ssKey, CDataStream&& ssValue)
+    {
+        vBatch.emplace_back(std::move(ssKey), std::move(ssValue));
+        return vBatch.size() < BATCH_SIZE || Flush();
+    }
+
+    bool Flush()
+    {
+        int64_t nTimeStart = GetTimeMicros();
+        std::vector<CWalletTxRecordCheck> vChecks;
+        vChecks.reserve(vBatch.size());
+        for (CWalletTxRecord& record : vBatch)
+            vChecks.emplace_back(&record);
+        if (nThreads > 1) {
+            CCheckQueueControl<CWalletTxRecordCheck> control(&checkqueue);
+            control.Add(vChecks);
+            control.Wait();
+        } else {
+            for (CWalletTxRecordCheck& check : vChecks)
+                check();
+        }
+        nTimeRead += GetTimeMicros() - nTimeStart;
+
+        nTimeStart = GetTimeMicros();
+        bool fAllRead = true;
+        for (CWalletTxRecord& record : vBatch) {
+            if (!record.strErr.empty())
+                LogPrintf("%s\n", record.strErr);
+            if (!record.fRead) {
+                fAllRead = false;
+                continue;
+            }
+            if (record.fUpgraded)
+                wss.vWalletUpgrade.push_back(record.wtx.GetHash());
+            if (record.wtx.nOrderPos == -1)
+                wss.fAnyUnordered = true;
+            pwallet->AddToWallet(record.wtx, true, nullptr);
+        }
+        nTimeAdd += GetTimeMicros() - nTimeStart;
+        nRecords += vBatch.size();
+        vBatch.clear();
+        return fAllRead;
+    }
+};
+
+static bool IsTxRecord(const CDataStream& ssKey)
+{
+    try {
+        CDataStream ssType(ssKey.begin(), ssKey.end(), SER_DISK, CLIENT_VERSION);
+        std::string strType;
+        ssType >> strType;
+        return strType == "tx";
+    } catch (...) {
+        return false;
+    }
+}
+
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     CWalletScanState wss;
+    CWalletTxLoader txLoader(pwallet, wss);
+    std::map<std::string, std::pair<unsigned int, int64_t> > mapLoadTime;
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
 
@@ -743,9 +914,22 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 return DB_CORRUPT;
             }
 
+            if (IsTxRecord(ssKey)) {
+                if (!txLoader.Push(std::move(ssKey), std::move(ssValue))) {
+                    fNoncriticalErrors = true;
+                    // Rescan if there is a bad transaction record:
+                    SoftSetBoolArg("-rescan", true);
+                }
+                continue;
+            }
+
             // Try to be tolerant of single corrupt records:
+            const int64_t nTimeStart = GetTimeMicros();
             std::string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr)) {
+            bool fRead = ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr);
+            mapLoadTime[strType].first++;
+            mapLoadTime[strType].second += GetTimeMicros() - nTimeStart;
+            if (!fRead) {
                 // losing keys is considered a catastrophic error, anything else
                 // we assume the user can live with:
                 if (IsKeyType(strType) || strType == "defaultkey")
@@ -762,6 +946,13 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 LogPrintf("%s\n", strErr);
         }
         pcursor->close();
+        if (!txLoader.Flush()) {
+            fNoncriticalErrors = true;
+            SoftSetBoolArg("-rescan", true);
+        }
+        const int64_t nTimeStart = GetTimeMicros();
+        pwallet->SyncAllMetaData();
+        txLoader.nTimeAdd += GetTimeMicros() - nTimeStart;
     } catch (const boost::thread_interrupted&) {
         throw;
     } catch (...) {
@@ -776,6 +967,11 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     if (result != DB_LOAD_OK)
         return result;
 
+    LogPrint("db", "%s: %u tx records, %.2fms to read, %.2fms to add\n", __func__, txLoader.nRecords,
+        txLoader.nTimeRead * 0.001, txLoader.nTimeAdd * 0.001);
+    for (const auto& item : mapLoadTime)
+        LogPrint("db", "%s: %u %s records, %.2fms\n", __func__, item.second.first, item.first, item.second.second * 0.001);
+
     LogPrintf("nFileVersion = %d\n", wss.nFileVersion);
 
     LogPrintf("Keys: %u plaintext, %u encrypted, %u w/ metadata, %u total\n",